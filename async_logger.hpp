@@ -0,0 +1,427 @@
+#ifndef YOLOV5_ASYNC_LOGGER_H_
+#define YOLOV5_ASYNC_LOGGER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Asynchronous logger for the pipeline threads.
+//
+// A log call copies the format string pointer, its arguments and a timestamp
+// into a slot of a bounded lock-free ring and returns; formatting and the
+// write to the terminal happen on a background drain thread. When the ring is
+// full the record is dropped and counted instead of blocking the caller.
+//
+// Format strings use "{}" placeholders and must be string literals, string
+// arguments are copied. Sites logged with ALOG_EVERY_MS() are rate limited:
+// calls inside the interval only bump a counter that is reported with the
+// next record from that site. set_binary_output() switches the drain thread
+// to a compact binary format that decode_binary() turns back into text.
+namespace alog {
+
+// same values as nvinfer1::ILogger::Severity
+enum class Severity : uint8_t { kINTERNAL_ERROR = 0, kERROR = 1, kWARNING = 2, kINFO = 3, kVERBOSE = 4 };
+
+// one static instance per call site, created by the ALOG macros
+struct Site {
+    Site(const char* fmt_, const char* file_, int line_, int interval_ms = 0)
+        : fmt(fmt_), file(file_), line(line_), interval_ns((int64_t)interval_ms * 1000000), next_ns(0), suppressed(0), id(0) {}
+    const char* fmt;
+    const char* file;
+    int line;
+    int64_t interval_ns;
+    std::atomic<int64_t> next_ns;
+    std::atomic<uint32_t> suppressed;
+    std::atomic<uint32_t> id;
+};
+
+enum class ArgType : uint8_t { kInt, kUInt, kDouble, kString };
+
+struct Arg {
+    ArgType type;
+    uint16_t str_off;
+    uint16_t str_len;
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+    };
+};
+
+static const int kMaxArgs = 8;
+static const int kTextBytes = 256;
+
+struct Record {
+    int64_t time_ns;    // system clock
+    Site* site;
+    uint32_t suppressed;
+    Severity severity;
+    uint8_t nargs;
+    uint16_t text_len;
+    Arg args[kMaxArgs];
+    char text[kTextBytes];
+};
+
+inline int64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class AsyncLogger {
+public:
+    explicit AsyncLogger(size_t capacity = 4096)
+        : slots_(round_pow2(capacity))
+        , mask_(slots_.size() - 1)
+        , tail_(0)
+        , head_(0)
+        , dropped_(0)
+        , level_((uint8_t)Severity::kINFO)
+        , stop_(false)
+        , text_out_(nullptr)
+        , binary_out_(nullptr)
+        , next_site_id_(1)
+    {
+        for (size_t i = 0; i < slots_.size(); i++) slots_[i].seq.store(i, std::memory_order_relaxed);
+        drain_thread_ = std::thread(&AsyncLogger::drain_loop, this);
+    }
+
+    ~AsyncLogger() {
+        stop_.store(true);
+        drain_thread_.join();
+        if (binary_out_.load()) fclose(binary_out_.load());
+    }
+
+    void set_reportable_severity(Severity s) { level_.store((uint8_t)s, std::memory_order_relaxed); }
+
+    bool should_log(Severity s) const { return (uint8_t)s <= level_.load(std::memory_order_relaxed); }
+
+    // text goes to this stream instead of stdout/stderr, nullptr restores the default
+    void set_text_output(FILE* fp) {
+        flush();
+        text_out_.store(fp);
+    }
+
+    // switches to the binary format, returns false if path cannot be opened
+    bool set_binary_output(const std::string& path) {
+        FILE* fp = fopen(path.c_str(), "wb");
+        if (!fp) return false;
+        flush();
+        fwrite("YLOG", 1, 4, fp);
+        binary_out_.store(fp);
+        return true;
+    }
+
+    template<typename... Args>
+    void log(Severity severity, Site& site, const Args&... args) {
+        if (!should_log(severity)) return;
+        write(severity, site, args...);
+    }
+
+    // same as log() without the severity check, for callers that filter themselves
+    template<typename... Args>
+    void write(Severity severity, Site& site, const Args&... args) {
+        if (site.interval_ns > 0 && !rate_allows(site)) return;
+        Slot* slot = acquire();
+        if (!slot) return;
+        Record& rec = slot->rec;
+        rec.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        rec.site = &site;
+        rec.suppressed = site.interval_ns > 0 ? site.suppressed.exchange(0, std::memory_order_relaxed) : 0;
+        rec.severity = severity;
+        rec.nargs = 0;
+        rec.text_len = 0;
+        pack(rec, args...);
+        publish(slot);
+        // errors are rare and often followed by an abort, make sure they reach the terminal
+        if (severity <= Severity::kERROR) flush();
+    }
+
+    // blocks until everything logged before the call has been written
+    void flush() {
+        size_t target = tail_.load(std::memory_order_acquire);
+        while (head_.load(std::memory_order_acquire) < target) std::this_thread::yield();
+    }
+
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    // converts a file written with set_binary_output() back to text, returns the number of records
+    static long decode_binary(const char* path, FILE* out) {
+        FILE* in = fopen(path, "rb");
+        if (!in) return -1;
+        char magic[4];
+        if (fread(magic, 1, 4, in) != 4 || memcmp(magic, "YLOG", 4)) {
+            fclose(in);
+            return -1;
+        }
+        std::vector<std::string> fmts(1);
+        long records = 0;
+        int tag;
+        while ((tag = fgetc(in)) != EOF) {
+            if (tag == 'S') {
+                uint32_t id, len;
+                if (fread(&id, 4, 1, in) != 1 || fread(&len, 4, 1, in) != 1) break;
+                std::string fmt(len, '\0');
+                if (len && fread(&fmt[0], 1, len, in) != len) break;
+                if (fmts.size() <= id) fmts.resize(id + 1);
+                fmts[id] = fmt;
+            } else if (tag == 'R') {
+                BinaryRecordHeader h;
+                if (fread(&h, sizeof(h), 1, in) != 1 || h.nargs > kMaxArgs || h.text_len > kTextBytes) break;
+                Record rec;
+                rec.time_ns = h.time_ns;
+                rec.suppressed = h.suppressed;
+                rec.severity = (Severity)h.severity;
+                rec.nargs = h.nargs;
+                rec.text_len = h.text_len;
+                if (fread(rec.args, sizeof(Arg), h.nargs, in) != h.nargs || fread(rec.text, 1, h.text_len, in) != h.text_len) break;
+                const char* fmt = h.site_id < fmts.size() ? fmts[h.site_id].c_str() : "";
+                std::string line = format(rec, fmt);
+                fwrite(line.data(), 1, line.size(), out);
+                records++;
+            } else {
+                break;
+            }
+        }
+        fclose(in);
+        return records;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        Record rec;
+    };
+
+    struct BinaryRecordHeader {
+        int64_t time_ns;
+        uint32_t site_id;
+        uint32_t suppressed;
+        uint8_t severity;
+        uint8_t nargs;
+        uint16_t text_len;
+    };
+
+    static size_t round_pow2(size_t n) {
+        size_t p = 2;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    bool rate_allows(Site& site) {
+        int64_t now = steady_ns();
+        int64_t next = site.next_ns.load(std::memory_order_relaxed);
+        if (now >= next && site.next_ns.compare_exchange_strong(next, now + site.interval_ns, std::memory_order_relaxed))
+            return true;
+        site.suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // bounded multi-producer ring, each slot carries a sequence number (Vyukov)
+    Slot* acquire() {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots_[pos & mask_];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return &slot;
+            } else if (dif < 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // a claimed slot still holds its claim position as sequence, pos + 1 hands it to the consumer
+    void publish(Slot* slot) {
+        size_t pos = slot->seq.load(std::memory_order_relaxed);
+        slot->seq.store(pos + 1, std::memory_order_release);
+    }
+
+    static void pack(Record&) {}
+
+    template<typename T, typename... Rest>
+    static void pack(Record& rec, const T& first, const Rest&... rest) {
+        if (rec.nargs < kMaxArgs) put(rec, rec.args[rec.nargs++], first);
+        pack(rec, rest...);
+    }
+
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+    put(Record&, Arg& a, const T& v) { a.type = ArgType::kInt; a.i = v; }
+
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+    put(Record&, Arg& a, const T& v) { a.type = ArgType::kUInt; a.u = v; }
+
+    template<typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type
+    put(Record&, Arg& a, const T& v) { a.type = ArgType::kDouble; a.d = v; }
+
+    static void put(Record& rec, Arg& a, const char* s) { put_str(rec, a, s, s ? strlen(s) : 0); }
+    static void put(Record& rec, Arg& a, const std::string& s) { put_str(rec, a, s.data(), s.size()); }
+
+    static void put_str(Record& rec, Arg& a, const char* s, size_t len) {
+        size_t room = kTextBytes - rec.text_len;
+        if (len > room) len = room;
+        a.type = ArgType::kString;
+        a.str_off = rec.text_len;
+        a.str_len = (uint16_t)len;
+        memcpy(rec.text + rec.text_len, s, len);
+        rec.text_len += len;
+    }
+
+    static const char* severity_prefix(Severity s) {
+        switch (s) {
+        case Severity::kINTERNAL_ERROR: return "[F] ";
+        case Severity::kERROR: return "[E] ";
+        case Severity::kWARNING: return "[W] ";
+        case Severity::kINFO: return "[I] ";
+        default: return "[V] ";
+        }
+    }
+
+    // same "[MM/DD/YYYY-HH:MM:SS] [I] " prefix as LogStreamConsumer in logging.h
+    static std::string format(const Record& rec, const char* fmt) {
+        char buf[64];
+        std::time_t t = rec.time_ns / 1000000000;
+        tm tm_local;
+        localtime_r(&t, &tm_local);
+        strftime(buf, sizeof(buf), "[%m/%d/%Y-%H:%M:%S] ", &tm_local);
+        std::string line(buf);
+        line += severity_prefix(rec.severity);
+        int arg = 0;
+        for (const char* p = fmt; *p; ++p) {
+            if (p[0] == '{' && p[1] == '}') {
+                if (arg < rec.nargs) append_arg(line, rec, rec.args[arg++]);
+                ++p;
+            } else {
+                line += *p;
+            }
+        }
+        if (rec.suppressed) {
+            snprintf(buf, sizeof(buf), " (%u similar suppressed)", rec.suppressed);
+            line += buf;
+        }
+        line += '\n';
+        return line;
+    }
+
+    static void append_arg(std::string& line, const Record& rec, const Arg& a) {
+        char buf[32];
+        switch (a.type) {
+        case ArgType::kInt: snprintf(buf, sizeof(buf), "%lld", (long long)a.i); line += buf; break;
+        case ArgType::kUInt: snprintf(buf, sizeof(buf), "%llu", (unsigned long long)a.u); line += buf; break;
+        case ArgType::kDouble: snprintf(buf, sizeof(buf), "%g", a.d); line += buf; break;
+        case ArgType::kString: line.append(rec.text + a.str_off, a.str_len); break;
+        }
+    }
+
+    void write_text(const Record& rec) {
+        std::string line = format(rec, rec.site->fmt);
+        FILE* fp = text_out_.load();
+        if (!fp) fp = rec.severity >= Severity::kINFO ? stdout : stderr;
+        fwrite(line.data(), 1, line.size(), fp);
+    }
+
+    void write_binary(const Record& rec, FILE* fp) {
+        Site* site = rec.site;
+        uint32_t id = site->id.load(std::memory_order_relaxed);
+        if (id == 0) {
+            // first record of this site, write its format string once
+            id = next_site_id_++;
+            site->id.store(id, std::memory_order_relaxed);
+            uint32_t len = strlen(site->fmt);
+            fputc('S', fp);
+            fwrite(&id, 4, 1, fp);
+            fwrite(&len, 4, 1, fp);
+            fwrite(site->fmt, 1, len, fp);
+        }
+        BinaryRecordHeader h;
+        h.time_ns = rec.time_ns;
+        h.site_id = id;
+        h.suppressed = rec.suppressed;
+        h.severity = (uint8_t)rec.severity;
+        h.nargs = rec.nargs;
+        h.text_len = rec.text_len;
+        fputc('R', fp);
+        fwrite(&h, sizeof(h), 1, fp);
+        fwrite(rec.args, sizeof(Arg), rec.nargs, fp);
+        fwrite(rec.text, 1, rec.text_len, fp);
+    }
+
+    // single consumer, drains the ring in order and writes each batch with one flush
+    void drain_loop() {
+        while (true) {
+            bool stopping = stop_.load();
+            size_t n = 0;
+            size_t head = head_.load(std::memory_order_relaxed);
+            while (true) {
+                Slot& slot = slots_[head & mask_];
+                if (slot.seq.load(std::memory_order_acquire) != head + 1) break;
+                FILE* bin = binary_out_.load();
+                if (bin) write_binary(slot.rec, bin);
+                else write_text(slot.rec);
+                slot.seq.store(head + slots_.size(), std::memory_order_release);
+                head_.store(++head, std::memory_order_release);
+                n++;
+            }
+            if (n) {
+                if (FILE* bin = binary_out_.load()) fflush(bin);
+                fflush(text_out_.load() ? text_out_.load() : stdout);
+                fflush(stderr);
+            } else if (stopping) {
+                return;
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+        }
+    }
+
+    std::vector<Slot> slots_;
+    size_t mask_;
+    std::atomic<size_t> tail_;
+    std::atomic<size_t> head_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint8_t> level_;
+    std::atomic<bool> stop_;
+    std::atomic<FILE*> text_out_;
+    std::atomic<FILE*> binary_out_;
+    uint32_t next_site_id_;
+    std::thread drain_thread_;
+};
+
+inline AsyncLogger& logger() {
+    static AsyncLogger instance;
+    return instance;
+}
+
+} // namespace alog
+
+#define ALOG(severity, fmt, ...) \
+    do { \
+        static alog::Site alog_site_(fmt, __FILE__, __LINE__); \
+        alog::logger().log(severity, alog_site_, ##__VA_ARGS__); \
+    } while (0)
+
+// logs at most once per interval_ms from this call site
+#define ALOG_EVERY_MS(severity, interval_ms, fmt, ...) \
+    do { \
+        static alog::Site alog_site_(fmt, __FILE__, __LINE__, interval_ms); \
+        alog::logger().log(severity, alog_site_, ##__VA_ARGS__); \
+    } while (0)
+
+#define ALOG_VERBOSE(fmt, ...) ALOG(alog::Severity::kVERBOSE, fmt, ##__VA_ARGS__)
+#define ALOG_INFO(fmt, ...) ALOG(alog::Severity::kINFO, fmt, ##__VA_ARGS__)
+#define ALOG_WARN(fmt, ...) ALOG(alog::Severity::kWARNING, fmt, ##__VA_ARGS__)
+#define ALOG_ERROR(fmt, ...) ALOG(alog::Severity::kERROR, fmt, ##__VA_ARGS__)
+
+#endif  // YOLOV5_ASYNC_LOGGER_H_
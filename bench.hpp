@@ -0,0 +1,494 @@
+#ifndef YOLOV5_BENCH_H_
+#define YOLOV5_BENCH_H_
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <random>
+#include "async_logger.hpp"
+#include "classfilter.hpp"
+#include "common.hpp"
+#include "executor.hpp"
+#include "overlay.hpp"
+#include "passing_one_obj.hpp"
+#include "placement.hpp"
+#include "shm_ring.hpp"
+#include "taskpool.hpp"
+#include "trace.hpp"
+#include "utils.h"
+
+// micro benchmarks run by "-b", all but bench_executor with an engine backend need no GPU
+
+static inline double bench_ms(std::chrono::steady_clock::time_point t0, std::chrono::steady_clock::time_point t1) {
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+// per-call cost of the async logger against formatting and flushing synchronously like LogStreamConsumer
+static void bench_logger(int iterations) {
+    const int burst = 1024;     // fits the ring, so the numbers are not dominated by drops
+    FILE* devnull = fopen("/dev/null", "w");
+    if (!devnull) return;
+    alog::logger().set_text_output(devnull);
+    uint64_t dropped = alog::logger().dropped();
+    double async_ms = 0, limited_ms = 0, sync_ms = 0;
+    long calls = 0;
+    for (int it = 0; it < iterations; it++) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < burst; i++)
+            ALOG_INFO("bench frame {} source {} took {}ms", i, i & 7, 1.5);
+        auto t1 = std::chrono::steady_clock::now();
+        for (int i = 0; i < burst; i++)
+            ALOG_EVERY_MS(alog::Severity::kINFO, 1000, "bench rate limited frame {}", i);
+        auto t2 = std::chrono::steady_clock::now();
+        for (int i = 0; i < burst; i++) {
+            std::ostringstream ss;
+            ss << "[I] bench frame " << i << " source " << (i & 7) << " took " << 1.5 << "ms" << std::endl;
+            fputs(ss.str().c_str(), devnull);
+            fflush(devnull);
+        }
+        auto t3 = std::chrono::steady_clock::now();
+        alog::logger().flush();
+        async_ms += bench_ms(t0, t1);
+        limited_ms += bench_ms(t1, t2);
+        sync_ms += bench_ms(t2, t3);
+        calls += burst;
+    }
+    alog::logger().set_text_output(nullptr);
+    fclose(devnull);
+    std::cout << "logger per call: async " << 1e6 * async_ms / calls << "ns, rate limited (suppressed) "
+              << 1e6 * limited_ms / calls << "ns, synchronous stream " << 1e6 * sync_ms / calls << "ns, "
+              << alog::logger().dropped() - dropped << " records dropped" << std::endl;
+}
+
+// frames/s of the executor with 1 to 4 workers, make() builds the backend of one worker.
+// A consumer collects the sources round-robin like the display loop and counts
+// results that come back out of order, or with MockBackend tags of another job.
+static void bench_executor(const std::function<std::unique_ptr<InferBackend>()>& make, const cv::Mat& frame,
+                           int sources, int frames, bool mock) {
+    double base = 0;
+    for (int k = 1; k <= 4; k++) {
+        std::vector<std::unique_ptr<InferBackend>> workers;
+        for (int i = 0; i < k; i++) workers.push_back(make());
+        InferExecutor executor(std::move(workers), sources, 2 * sources);
+        size_t wrong = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        std::thread consumer([&] {
+            InferJob job;
+            for (int i = 0; i < frames; i++) {
+                for (int s = 0; s < sources; s++) {
+                    if (!executor.next(s, job) || job.source != s || job.seq != (uint64_t)i)
+                        wrong++;
+                    else if (mock && (job.dets.size() != 1 || job.dets[0].class_id != s || job.dets[0].bbox[0] != (float)i))
+                        wrong++;
+                }
+            }
+        });
+        for (int i = 0; i < frames; i++)
+            for (int s = 0; s < sources; s++)
+                executor.submit(s, frame);
+        consumer.join();
+        double fps = sources * frames / (bench_ms(t0, std::chrono::steady_clock::now()) / 1000);
+        if (k == 1) base = fps;
+        std::cout << (mock ? "mock" : "engine") << " executor, " << k << " worker(s): " << fps << " frames/s, x" << fps / base
+                  << ", " << wrong << " out of order" << std::endl;
+    }
+}
+
+static void bench_report_transport(bool shared, std::vector<double>& latency_us, int frames, double ms, uint64_t torn) {
+    std::sort(latency_us.begin(), latency_us.end());
+    double mean = 0;
+    for (double l : latency_us) mean += l;
+    size_t n = latency_us.size();
+    std::cout << (shared ? "shared memory" : "in-process") << ": " << n << "/" << frames << " frames letterboxed, " << 1000.0 * n / ms << " frames/s, latency mean "
+              << (n ? mean / n : 0) << "us p99 " << (n ? latency_us[n * 99 / 100] : 0) << "us";
+    if (shared) std::cout << ", " << torn << " torn";
+    std::cout << std::endl;
+}
+
+// 1080p frames from a decoder to letterboxing: a thread handing over through passing_one_obj
+// like read_video_src, against a forked decoder process publishing into the shared-memory
+// ring, read in place. Frames carry their publish time in the first pixels.
+static void bench_shm(int frames, int input_w, int input_h) {
+    const int w = 1920, h = 1080;
+    const auto interval = std::chrono::microseconds(2000);
+    std::vector<uchar> input(3 * input_w * input_h);
+    auto stamp = [](cv::Mat& frame, int i) {
+        frame.setTo(cv::Scalar(i & 255, 120, 150));
+        int64_t t = shm::now_ns();
+        memcpy(frame.data, &t, sizeof(t));
+    };
+    auto age_us = [](const cv::Mat& frame) {
+        int64_t t;
+        memcpy(&t, frame.data, sizeof(t));
+        return (shm::now_ns() - t) / 1000.0;
+    };
+
+    {
+        passing_one_obj<cv::Mat> channel(false);
+        std::thread producer([&] {
+            auto next = std::chrono::steady_clock::now();
+            for (int i = 0; i < frames; i++) {
+                cv::Mat frame(h, w, CV_8UC3);  // a decoder hands out a new image every time
+                stamp(frame, i);
+                channel.send(frame);
+                next += interval;
+                std::this_thread::sleep_until(next);
+            }
+            channel.send(cv::Mat());
+        });
+        std::vector<double> latency;
+        auto t0 = std::chrono::steady_clock::now();
+        while (true) {
+            cv::Mat frame = channel.receive();
+            if (frame.empty()) break;
+            latency.push_back(age_us(frame));
+            preprocess_img(frame, input_w, input_h, input.data());
+        }
+        double ms = bench_ms(t0, std::chrono::steady_clock::now());
+        producer.join();
+        bench_report_transport(false, latency, frames, ms, 0);
+    }
+
+    std::string name = "/yolov5_bench_" + std::to_string(getpid());
+    pid_t child = fork();
+    if (child < 0) return;
+    if (child == 0) {
+        shm::FrameWriter writer(name);
+        cv::Mat frame(h, w, CV_8UC3);
+        auto next = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++) {
+            stamp(frame, i);
+            writer.publish(frame);
+            next += interval;
+            std::this_thread::sleep_until(next);
+        }
+        // keep the ring until the reader has the last frame
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        _exit(0);
+    }
+    shm::FrameReader reader(name);
+    shm::Frame f;
+    std::vector<double> latency;
+    auto t0 = std::chrono::steady_clock::now(), t1 = t0;
+    while (reader.next(f, latency.empty() ? 2000 : 200)) {  // the first wait covers the fork
+        double age = age_us(f.view);
+        preprocess_img(f.view, input_w, input_h, input.data());
+        if (reader.valid(f)) latency.push_back(age);
+        t1 = std::chrono::steady_clock::now();
+        if (f.frame + 1 == (uint64_t)frames) break;
+    }
+    waitpid(child, nullptr, 0);
+    bench_report_transport(true, latency, frames, bench_ms(t0, t1), reader.torn());
+}
+
+// one 1080p frame with 120 boxes onto a 320x180 mosaic tile: drawing at full resolution with
+// per-box putText and scaling down afterwards, against scaling first and copying atlas labels
+static void bench_overlay(int iterations, int input_w, int input_h) {
+    cv::Mat frame(1080, 1920, CV_8UC3, cv::Scalar(90, 120, 150));
+    cv::Mat tile(180, 320, CV_8UC3);
+    std::vector<Yolo::Detection> dets(120);
+    for (size_t i = 0; i < dets.size(); i++) {
+        Yolo::Detection& d = dets[i];
+        d.bbox[0] = (i * 37) % input_w;
+        d.bbox[1] = input_h / 4 + (i * 53) % (input_h / 2);
+        d.bbox[2] = 20 + i % 60;
+        d.bbox[3] = 30 + i % 90;
+        d.conf = 0.9f;
+        d.class_id = i % Yolo::CLASS_NUM;
+    }
+    overlay::Renderer renderer;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        for (auto& d : dets) {
+            cv::Rect r = overlay::map_box(d.bbox, frame.cols, frame.rows, input_w, input_h);
+            cv::rectangle(frame, r, cv::Scalar(0x27, 0xC1, 0x36), 2);
+            cv::putText(frame, std::to_string((int)d.class_id), cv::Point(r.x, r.y - 1), cv::FONT_HERSHEY_PLAIN, 1.2, cv::Scalar(0xFF, 0xFF, 0xFF), 2);
+        }
+        cv::resize(frame, tile, tile.size(), 0, 0, cv::INTER_AREA);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++)
+        renderer.render(frame, dets, input_w, input_h, tile);
+    auto t2 = std::chrono::steady_clock::now();
+    std::cout << "overlay, " << dets.size() << " boxes: " << bench_ms(t0, t1) / iterations << "ms drawn at full resolution, "
+              << bench_ms(t1, t2) / iterations << "ms drawn on the tile" << std::endl;
+}
+
+// host side of a batch of 1 to 16 images from the decoded output to their tiles: nms(), mapping and
+// drawing of every image one after another, against one task per image on the pool. The decoded
+// output is synthetic, 300 candidates per image in clusters of 3 around 100 objects.
+static void bench_postprocess(TaskPool& pool, int iterations, int input_w, int input_h) {
+    const int max_batch = 16, det_size = sizeof(Yolo::Detection) / sizeof(float);
+    const int output_size = 1 + Yolo::MAX_OUTPUT_BBOX_COUNT * det_size;
+    std::vector<float> prob(max_batch * output_size);
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int b = 0; b < max_batch; b++) {
+        float* out = &prob[b * output_size];
+        out[0] = 300;
+        for (int i = 0; i < 300; i++) {
+            Yolo::Detection d;
+            int object = i / 3;
+            float cx = (object * 97) % input_w, cy = (object * 61) % input_h;
+            d.bbox[0] = cx + 4 * unit(rng);
+            d.bbox[1] = cy + 4 * unit(rng);
+            d.bbox[2] = 40 + object % 50;
+            d.bbox[3] = 60 + object % 70;
+            d.conf = 0.3f + 0.7f * unit(rng);
+            d.class_id = object % Yolo::CLASS_NUM;
+            memcpy(out + 1 + i * det_size, &d, sizeof(d));
+        }
+    }
+    // a 1080p camera per image, drawn on its tile of a 4x4 mosaic
+    cv::Mat frame(1080, 1920, CV_8UC3, cv::Scalar(90, 120, 150));
+    cv::Mat mosaic(540, 960, CV_8UC3);
+    overlay::Renderer renderer;
+    std::vector<std::vector<Yolo::Detection>> res(max_batch), ref(max_batch);
+    auto post = [&](int b, std::vector<std::vector<Yolo::Detection>>& out) {
+        out[b].clear();
+        nms(out[b], &prob[b * output_size], 0.5f, 0.4f);
+        cv::Mat tile = mosaic(cv::Rect((b % 4) * 240, (b / 4) * 135, 240, 135));
+        renderer.render(frame, out[b], input_w, input_h, tile);
+    };
+    for (int batch = 1; batch <= max_batch; batch *= 2) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int it = 0; it < iterations; it++)
+            for (int b = 0; b < batch; b++) post(b, ref);
+        auto t1 = std::chrono::steady_clock::now();
+        for (int it = 0; it < iterations; it++)
+            pool.for_each(batch, [&](int b) { post(b, res); });
+        auto t2 = std::chrono::steady_clock::now();
+        size_t mismatches = 0;
+        for (int b = 0; b < batch; b++)
+            mismatches += res[b].size() != ref[b].size() || memcmp(res[b].data(), ref[b].data(), res[b].size() * sizeof(Yolo::Detection)) != 0;
+        double serial = bench_ms(t0, t1) / iterations, pooled = bench_ms(t1, t2) / iterations;
+        std::cout << "post-processing, batch " << batch << ": " << serial << "ms/batch serial, " << pooled << "ms/batch on "
+                  << pool.threads() << " threads, x" << serial / pooled << ", " << ref[0].size() << " boxes/image, "
+                  << mismatches << " mismatches" << std::endl;
+    }
+}
+
+// a class filter applied in the decode, in nms() and after nms() must keep the same boxes. Random head
+// tensors of one image are decoded on the host with decodeCpu, the reference of the device decode; the
+// time of decode and NMS is compared for the three places and the output slots the decode saves.
+static void bench_classfilter(int iterations, int input_w, int input_h, float conf_thresh, float nms_thresh, const std::string& spec) {
+    classfilter::Filter filter;
+    if (!filter.parse(spec)) return;
+    const float anchors[Yolo::MAX_KERNEL_COUNT][Yolo::CHECK_COUNT * 2] = {
+        {10, 13, 16, 30, 33, 23}, {30, 61, 62, 45, 59, 119}, {116, 90, 156, 198, 373, 326}};
+    std::vector<Yolo::YoloKernel> kernels(Yolo::MAX_KERNEL_COUNT);
+    std::vector<std::vector<float>> heads(kernels.size());
+    std::vector<const float*> inputs;
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> logit(-10.0f, 3.0f);
+    for (size_t h = 0; h < kernels.size(); h++) {
+        int stride = 8 << h;
+        kernels[h].width = input_w / stride;
+        kernels[h].height = input_h / stride;
+        memcpy(kernels[h].anchors, anchors[h], sizeof(kernels[h].anchors));
+        int grid = kernels[h].width * kernels[h].height;
+        heads[h].resize((size_t)Yolo::CHECK_COUNT * (5 + Yolo::CLASS_NUM) * grid);
+        for (auto& v : heads[h]) v = logit(rng);
+        for (int a = 0; a < Yolo::CHECK_COUNT; a++)
+            for (int i = 0; i < grid; i++)
+                heads[h][(a * (5 + Yolo::CLASS_NUM) + 4) * grid + i] = (rng() % 64) ? -6.0f : logit(rng) + 4.0f;  // about 1.5% objects
+        inputs.push_back(heads[h].data());
+    }
+    const int output_size = 1 + Yolo::MAX_OUTPUT_BBOX_COUNT * sizeof(Yolo::Detection) / sizeof(float);
+    std::vector<float> all(output_size), kept(output_size);
+    const float* class_min = filter.min_scores().data();
+    std::vector<Yolo::Detection> after, within, decoded;
+    auto after_nms = [&] {
+        Yolo::decodeCpu(inputs.data(), all.data(), kernels, 1, input_w, input_h, Yolo::MAX_OUTPUT_BBOX_COUNT, Yolo::CLASS_NUM);
+        after.clear();
+        nms(after, all.data(), conf_thresh, nms_thresh);
+        after.erase(std::remove_if(after.begin(), after.end(), [&](const Yolo::Detection& d) { return !filter.keeps(d); }), after.end());
+    };
+    auto within_nms = [&] {
+        Yolo::decodeCpu(inputs.data(), all.data(), kernels, 1, input_w, input_h, Yolo::MAX_OUTPUT_BBOX_COUNT, Yolo::CLASS_NUM);
+        within.clear();
+        nms(within, all.data(), conf_thresh, nms_thresh, class_min);
+    };
+    auto in_decode = [&] {
+        Yolo::decodeCpu(inputs.data(), kept.data(), kernels, 1, input_w, input_h, Yolo::MAX_OUTPUT_BBOX_COUNT, Yolo::CLASS_NUM, class_min);
+        decoded.clear();
+        nms(decoded, kept.data(), conf_thresh, nms_thresh);
+    };
+    std::vector<std::function<void()>> runs = {after_nms, within_nms, in_decode};
+    std::vector<double> ms(runs.size());
+    for (size_t r = 0; r < runs.size(); r++) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int it = 0; it < iterations; it++) runs[r]();
+        ms[r] = bench_ms(t0, std::chrono::steady_clock::now()) / iterations;
+    }
+    // nms() sorts by score, boxes of equal score may come out in any order
+    auto sorted = [](std::vector<Yolo::Detection> v) {
+        std::sort(v.begin(), v.end(), [](const Yolo::Detection& a, const Yolo::Detection& b) { return memcmp(&a, &b, sizeof(a)) < 0; });
+        return v;
+    };
+    auto differ = [&](const std::vector<Yolo::Detection>& a, const std::vector<Yolo::Detection>& b) {
+        return a.size() != b.size() || memcmp(sorted(a).data(), sorted(b).data(), a.size() * sizeof(Yolo::Detection)) != 0;
+    };
+    std::cout << "class filter " << filter.str() << ": " << (int)all[0] << " decoded boxes, " << (int)kept[0] << " written with the filter in the decode, "
+              << after.size() << " kept, mismatches " << differ(after, within) + differ(after, decoded) << "; decode and nms "
+              << 1e3 * ms[0] << "us/image filtered after nms(), " << 1e3 * ms[1] << "us in nms(), " << 1e3 * ms[2] << "us in the decode" << std::endl;
+}
+
+// cost of a trace span with tracing off, as every build has them compiled in, and with it on.
+// the spans on go to a thread of their own and into the trace if one is being recorded.
+static void bench_trace(int iterations) {
+    const int spans = 1 << 16;  // fits a thread's buffer
+    double off_ns = 0, on_ns = 0;
+    bool was_on = trace::tracer().enabled();
+    if (!was_on) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int it = 0; it < iterations; it++)
+            for (int i = 0; i < spans; i++) {
+                trace::Span span("bench", 0, i);
+            }
+        off_ns = 1e6 * bench_ms(t0, std::chrono::steady_clock::now()) / ((double)iterations * spans);
+        trace::tracer().start();
+    }
+    std::thread([&] {
+        trace::tracer().set_thread_name("bench trace");
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < spans; i++) {
+            trace::Span span("bench", 0, i);
+        }
+        on_ns = 1e6 * bench_ms(t0, std::chrono::steady_clock::now()) / spans;
+    }).join();
+    if (!was_on) trace::tracer().stop();
+    std::cout << "trace span: " << (was_on ? std::string("tracing is on, ") : "off " + std::to_string(off_ns) + "ns, ")
+              << "on " << on_ns << "ns" << std::endl;
+}
+
+// the work-stealing pool against a std::async thread per task: cost of an empty task, and
+// scaling of 256 tasks of about 50us of arithmetic over 1 to 8 threads
+static void bench_pool(int iterations) {
+    const int tasks = 256;
+    TaskPool pool(4);
+    auto t0 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        std::vector<std::future<void>> done;
+        for (int i = 0; i < tasks; i++) done.push_back(std::async(std::launch::async, [] {}));
+        for (auto& d : done) d.get();
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        std::vector<std::future<void>> done;
+        for (int i = 0; i < tasks; i++) done.push_back(pool.submit([] {}, i));
+        for (auto& d : done) d.get();
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++)
+        pool.for_each(tasks, [](int) {});
+    auto t3 = std::chrono::steady_clock::now();
+    double per_task = 1e3 / ((double)iterations * tasks);
+    std::cout << "empty task: std::async " << bench_ms(t0, t1) * per_task << "us, pool submit " << bench_ms(t1, t2) * per_task
+              << "us, pool for_each " << bench_ms(t2, t3) * per_task << "us" << std::endl;
+
+    std::vector<double> sink(tasks);
+    auto work = [&](int i) {
+        double x = i;
+        for (int k = 0; k < 20000; k++) x = x * 0.999999 + 1e-3;
+        sink[i] = x;
+    };
+    double base = 0;
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        TaskPool scaled(threads);
+        auto s0 = std::chrono::steady_clock::now();
+        for (int it = 0; it < iterations; it++)
+            scaled.for_each(tasks, work);
+        double ms = bench_ms(s0, std::chrono::steady_clock::now()) / iterations;
+        if (threads == 1) base = ms;
+        std::cout << "pool, " << threads << " thread(s): " << ms << "ms for " << tasks << " tasks, x" << base / ms << std::endl;
+    }
+    auto a0 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        std::vector<std::future<void>> done;
+        for (int i = 0; i < tasks; i++) done.push_back(std::async(std::launch::async, work, i));
+        for (auto& d : done) d.get();
+    }
+    double ms = bench_ms(a0, std::chrono::steady_clock::now()) / iterations;
+    std::cout << "std::async, a thread per task: " << ms << "ms for " << tasks << " tasks, x" << base / ms
+              << " (" << std::thread::hardware_concurrency() << " cores)" << std::endl;
+}
+
+// decoder threads handing 1080p frames to the driver, which letterboxes one frame of every
+// source per round on a pinned pool, with the placement off and with spec: frames/s, the
+// spread of the round times and the age of the frames once letterboxed
+static void bench_placement(const std::string& spec, int node, int infer_threads, int pool_threads,
+                            int iterations, int input_w, int input_h) {
+    const int sources = 4, depth = 2;
+    const int w = 1920, h = 1080;
+    const std::string modes[2] = {"off", spec == "off" ? "auto" : spec};
+    for (const std::string& mode : modes) {
+        if (!placement::placement().configure(mode, node, infer_threads, pool_threads)) continue;
+        placement::placement().unpin();
+        placement::placement().pin(placement::kMain);
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::vector<std::deque<std::pair<int64_t, cv::Mat>>> queues(sources);
+        std::vector<std::thread> decoders;
+        for (int s = 0; s < sources; s++) {
+            decoders.emplace_back([&, s] {
+                placement::placement().pin(placement::kDecode);
+                for (int i = 0; i < iterations; i++) {
+                    cv::Mat frame(h, w, CV_8UC3);  // a decoder hands out a new image every time
+                    frame.setTo(cv::Scalar(i & 255, 40 * s, 150));
+                    std::unique_lock<std::mutex> lk(mutex);
+                    ready.wait(lk, [&] { return (int)queues[s].size() < depth; });
+                    queues[s].emplace_back(shm::now_ns(), frame);
+                    ready.notify_all();
+                }
+            });
+        }
+        std::vector<uchar> input((size_t)sources * 3 * input_w * input_h);
+        std::vector<double> round_ms, age_ms;
+        TaskPool pool(pool_threads, true);
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            std::vector<std::pair<int64_t, cv::Mat>> round(sources);
+            {
+                std::unique_lock<std::mutex> lk(mutex);
+                for (int s = 0; s < sources; s++) {
+                    ready.wait(lk, [&] { return !queues[s].empty(); });
+                    round[s] = queues[s].front();
+                    queues[s].pop_front();
+                }
+                ready.notify_all();
+            }
+            auto r0 = std::chrono::steady_clock::now();
+            pool.for_each(sources, [&](int s) {
+                preprocess_img(round[s].second, input_w, input_h, input.data() + (size_t)s * 3 * input_w * input_h);
+            });
+            round_ms.push_back(bench_ms(r0, std::chrono::steady_clock::now()));
+            for (auto& f : round) age_ms.push_back((shm::now_ns() - f.first) / 1e6);
+        }
+        double ms = bench_ms(t0, std::chrono::steady_clock::now());
+        for (auto& d : decoders) d.join();
+        placement::placement().unpin();
+
+        double mean = 0, var = 0;
+        for (double r : round_ms) mean += r / round_ms.size();
+        for (double r : round_ms) var += (r - mean) * (r - mean) / round_ms.size();
+        std::sort(round_ms.begin(), round_ms.end());
+        std::sort(age_ms.begin(), age_ms.end());
+        size_t n = round_ms.size();
+        std::cout << "placement " << mode << ": " << 1000.0 * sources * iterations / ms << " frames/s, letterboxing a round p50 "
+                  << round_ms[n / 2] << "ms p99 " << round_ms[n * 99 / 100] << "ms stddev " << std::sqrt(var)
+                  << "ms, frame age p99 " << age_ms[age_ms.size() * 99 / 100] << "ms" << std::endl;
+    }
+}
+
+#endif  // YOLOV5_BENCH_H_
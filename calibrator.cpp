@@ -1,29 +1,114 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <iterator>
 #include <fstream>
-#include <opencv2/dnn/dnn.hpp>
 #include "calibrator.h"
 #include "cuda_utils.h"
+#include "preprocesslayer.h"
 #include "utils.h"
 
-Int8EntropyCalibrator2::Int8EntropyCalibrator2(int batchsize, int input_w, int input_h, const char* img_dir, const char* calib_table_name, const char* input_blob_name, bool read_cache)
+namespace {
+// header of the tensor cache file, the images follow at a 64 byte offset
+struct TensorCacheHeader {
+    char magic[4];
+    int32_t version;
+    int32_t input_w;
+    int32_t input_h;
+    int64_t count;
+    uint64_t folder_hash;   // of the names, sizes and modification times of the images it was built from
+    char reserved[32];
+};
+static_assert(sizeof(TensorCacheHeader) == 64, "tensor cache header must stay 64 bytes");
+
+// FNV-1a over the sorted names of the images of the shard with their sizes and modification times, so that a
+// cache is rebuilt once an image is replaced, added or removed
+uint64_t folder_hash(const std::string& dir, int shard_id, int num_shards)
+{
+    DirScanner scanner(dir, shard_id, num_shards);
+    std::vector<std::string> names;
+    std::string name;
+    if (!scanner.open()) return 0;
+    while (scanner.next(name)) names.push_back(name);
+    std::sort(names.begin(), names.end());
+    uint64_t h = 1469598103934665603ULL;
+    auto mix = [&h](const void* p, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            h ^= ((const unsigned char*)p)[i];
+            h *= 1099511628211ULL;
+        }
+    };
+    for (auto& n : names) {
+        struct stat st;
+        int64_t meta[3] = {0, 0, 0};
+        if (stat((dir + n).c_str(), &st) == 0) {
+            meta[0] = st.st_size;
+            meta[1] = st.st_mtim.tv_sec;
+            meta[2] = st.st_mtim.tv_nsec;
+        }
+        mix(n.c_str(), n.size() + 1);
+        mix(meta, sizeof(meta));
+    }
+    return h;
+}
+}
+
+Int8EntropyCalibrator2::Int8EntropyCalibrator2(int batchsize, int input_w, int input_h, const char* img_dir, const char* calib_table_name, const char* input_blob_name, bool read_cache, int shard_id, int num_shards, bool packed_u8, const char* tensor_cache_name)
     : batchsize_(batchsize)
     , input_w_(input_w)
     , input_h_(input_h)
     , img_idx_(0)
     , img_dir_(img_dir)
+    , img_scanner_(img_dir, shard_id, num_shards)
+    , folder_hash_(0)
     , calib_table_name_(calib_table_name)
     , input_blob_name_(input_blob_name)
     , read_cache_(read_cache)
+    , packed_u8_(packed_u8)
+    , tensor_cache_name_(tensor_cache_name)
+    , cache_data_(nullptr)
+    , cache_count_(0)
+    , cache_map_len_(0)
+    , cache_out_(nullptr)
+    , cache_written_(0)
+    , next_index_(0)
+    , consumed_(0)
+    , scan_done_(false)
+    , stop_(false)
 {
     input_count_ = 3 * input_w * input_h * batchsize;
+    image_bytes_ = 3 * input_w * input_h;
+    host_batch_.resize(image_bytes_ * batchsize);
     CUDA_CHECK(cudaMalloc(&device_input_, input_count_ * sizeof(float)));
-    read_files_in_dir(img_dir, img_files_);
+    CUDA_CHECK(cudaMalloc(&device_hwc_, image_bytes_ * batchsize));
+    int threads = std::max(1, (int)std::thread::hardware_concurrency());
+    prefetch_depth_ = std::max(2 * threads, 2 * batchsize);
+    if (!tensor_cache_name_.empty()) folder_hash_ = folder_hash(img_dir_, shard_id, num_shards);
+    if (!open_tensor_cache() && !img_scanner_.open()) {
+        std::cerr << "could not open calibration dir " << img_dir << std::endl;
+    }
 }
 
 Int8EntropyCalibrator2::~Int8EntropyCalibrator2()
 {
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        stop_ = true;
+    }
+    space_.notify_all();
+    for (auto& t : workers_) t.join();
+    if (cache_out_) {
+        // calibration stopped before the image folder was exhausted, the cache would be incomplete
+        fclose(cache_out_);
+        remove((tensor_cache_name_ + ".tmp").c_str());
+    }
+    if (cache_data_) munmap((void*)(cache_data_ - sizeof(TensorCacheHeader)), cache_map_len_);
     CUDA_CHECK(cudaFree(device_input_));
+    CUDA_CHECK(cudaFree(device_hwc_));
 }
 
 int Int8EntropyCalibrator2::getBatchSize() const
@@ -31,27 +116,155 @@ int Int8EntropyCalibrator2::getBatchSize() const
     return batchsize_;
 }
 
-bool Int8EntropyCalibrator2::getBatch(void* bindings[], const char* names[], int nbBindings)
+bool Int8EntropyCalibrator2::open_tensor_cache()
 {
-    if (img_idx_ + batchsize_ > (int)img_files_.size()) {
+    if (tensor_cache_name_.empty()) return false;
+    int fd = open(tensor_cache_name_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    TensorCacheHeader hdr;
+    bool valid = fstat(fd, &st) == 0 && read(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr)
+        && !memcmp(hdr.magic, "YCTC", 4) && hdr.version == 2 && hdr.input_w == input_w_ && hdr.input_h == input_h_
+        && hdr.folder_hash == folder_hash_ && (size_t)st.st_size == sizeof(hdr) + hdr.count * image_bytes_;
+    if (!valid) {
+        std::cout << "tensor cache " << tensor_cache_name_ << " does not match " << input_w_ << "x" << input_h_ << " and the images in " << img_dir_ << ", rebuilding it" << std::endl;
+        close(fd);
         return false;
     }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    cache_map_len_ = st.st_size;
+    cache_data_ = (const unsigned char*)p + sizeof(hdr);
+    cache_count_ = hdr.count;
+    std::cout << "reading " << cache_count_ << " calibration images from tensor cache " << tensor_cache_name_ << std::endl;
+    return true;
+}
+
+// publishes the cache under its final name once every image has been written
+void Int8EntropyCalibrator2::finish_tensor_cache()
+{
+    if (!cache_out_) return;
+    TensorCacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, "YCTC", 4);
+    hdr.version = 2;
+    hdr.input_w = input_w_;
+    hdr.input_h = input_h_;
+    hdr.count = cache_written_;
+    hdr.folder_hash = folder_hash_;
+    fseek(cache_out_, 0, SEEK_SET);
+    fwrite(&hdr, sizeof(hdr), 1, cache_out_);
+    bool ok = fflush(cache_out_) == 0;
+    fclose(cache_out_);
+    cache_out_ = nullptr;
+    std::string tmp = tensor_cache_name_ + ".tmp";
+    if (ok && rename(tmp.c_str(), tensor_cache_name_.c_str()) == 0) {
+        std::cout << "wrote " << cache_written_ << " calibration images to tensor cache " << tensor_cache_name_ << std::endl;
+    } else {
+        std::cerr << "could not write tensor cache " << tensor_cache_name_ << std::endl;
+        remove(tmp.c_str());
+    }
+}
 
-    std::vector<cv::Mat> input_imgs_;
-    for (int i = img_idx_; i < img_idx_ + batchsize_; i++) {
-        std::cout << img_files_[i] << "  " << i << std::endl;
-        cv::Mat temp = cv::imread(img_dir_ + img_files_[i]);
-        if (temp.empty()){
-            std::cerr << "Fatal error: image cannot open!" << std::endl;
+void Int8EntropyCalibrator2::start_workers()
+{
+    if (!tensor_cache_name_.empty()) {
+        cache_out_ = fopen((tensor_cache_name_ + ".tmp").c_str(), "wb");
+        if (cache_out_) {
+            // header is filled in by finish_tensor_cache()
+            TensorCacheHeader hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            fwrite(&hdr, sizeof(hdr), 1, cache_out_);
+        }
+    }
+    int threads = std::max(1, (int)std::thread::hardware_concurrency());
+    std::cout << "decoding calibration images with " << threads << " threads" << std::endl;
+    for (int i = 0; i < threads; i++)
+        workers_.push_back(std::thread(&Int8EntropyCalibrator2::decode_worker, this));
+}
+
+void Int8EntropyCalibrator2::decode_worker()
+{
+    std::unique_lock<std::mutex> lk(mutex_);
+    while (true) {
+        space_.wait(lk, [this] { return stop_ || next_index_ < consumed_ + prefetch_depth_; });
+        if (stop_ || scan_done_) return;
+        std::string img_file;
+        if (!img_scanner_.next(img_file)) {
+            scan_done_ = true;
+            ready_.notify_all();
+            return;
+        }
+        int index = next_index_++;
+        lk.unlock();
+        cv::Mat pr_img;
+        cv::Mat temp = cv::imread(img_dir_ + img_file);
+        if (temp.empty()) {
+            std::cerr << "calibration image " << img_file << " cannot open, skipped" << std::endl;
+        } else {
+            pr_img = preprocess_img(temp, input_w_, input_h_);
+        }
+        lk.lock();
+        decoded_[index] = pr_img;
+        ready_.notify_all();
+    }
+}
+
+// next decoded image in folder order, false once the folder is exhausted
+bool Int8EntropyCalibrator2::next_image(cv::Mat& img)
+{
+    std::unique_lock<std::mutex> lk(mutex_);
+    while (true) {
+        ready_.wait(lk, [this] { return decoded_.count(consumed_) || (scan_done_ && consumed_ >= next_index_); });
+        auto it = decoded_.find(consumed_);
+        if (it == decoded_.end()) return false;
+        img = it->second;
+        decoded_.erase(it);
+        consumed_++;
+        space_.notify_all();
+        if (!img.empty()) return true;
+    }
+}
+
+bool Int8EntropyCalibrator2::getBatch(void* bindings[], const char* names[], int nbBindings)
+{
+    const unsigned char* batch;
+    if (cache_data_) {
+        if (img_idx_ + batchsize_ > (int)cache_count_) {
             return false;
         }
-        cv::Mat pr_img = preprocess_img(temp, input_w_, input_h_);
-        input_imgs_.push_back(pr_img);
+        batch = cache_data_ + img_idx_ * image_bytes_;
+    } else {
+        if (workers_.empty()) start_workers();
+        for (int i = 0; i < batchsize_; i++) {
+            cv::Mat pr_img;
+            if (!next_image(pr_img)) {
+                finish_tensor_cache();
+                return false;
+            }
+            memcpy(host_batch_.data() + i * image_bytes_, pr_img.data, image_bytes_);
+            if (cache_out_) {
+                fwrite(pr_img.data, 1, image_bytes_, cache_out_);
+                cache_written_++;
+            }
+        }
+        batch = host_batch_.data();
     }
     img_idx_ += batchsize_;
-    cv::Mat blob = cv::dnn::blobFromImages(input_imgs_, 1.0 / 255.0, cv::Size(input_w_, input_h_), cv::Scalar(0, 0, 0), true, false);
+    if (img_idx_ % 100 < batchsize_) {
+        std::cout << "calibration images: " << img_idx_ << std::endl;
+    }
 
-    CUDA_CHECK(cudaMemcpy(device_input_, blob.ptr<float>(0), input_count_ * sizeof(float), cudaMemcpyHostToDevice));
+    if (packed_u8_) {
+        // packed uint8 engines take the letterboxed pixels as they are
+        CUDA_CHECK(cudaMemcpy(device_input_, batch, image_bytes_ * batchsize_, cudaMemcpyHostToDevice));
+    } else {
+        CUDA_CHECK(cudaMemcpy(device_hwc_, batch, image_bytes_ * batchsize_, cudaMemcpyHostToDevice));
+        Yolo::hwc2chwGpu((const uint8_t*)device_hwc_, (float*)device_input_, batchsize_, input_w_, input_h_, 0);
+        CUDA_CHECK(cudaStreamSynchronize(0));
+    }
     assert(!strcmp(names[0], input_blob_name_));
     bindings[0] = device_input_;
     return true;
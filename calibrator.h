@@ -2,18 +2,30 @@
 #define ENTROPY_CALIBRATOR_H
 
 #include "NvInfer.h"
+#include <condition_variable>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
+#include <opencv2/opencv.hpp>
+#include "dir_scanner.hpp"
 
 //! \class Int8EntropyCalibrator2
 //!
 //! \brief Implements Entropy calibrator 2.
 //!  CalibrationAlgoType is kENTROPY_CALIBRATION_2.
 //!
+//!  Images are decoded and letterboxed ahead of getBatch() by a pool of worker threads.
+//!  The letterboxed set is also written to tensor_cache_name as one file of uint8 BGR
+//!  images, which later calibrations with the same input size mmap instead of decoding
+//!  the image folder again. The cache is rebuilt once the names, sizes or modification
+//!  times of the images differ from those it was built from.
+//!
 class Int8EntropyCalibrator2 : public nvinfer1::IInt8EntropyCalibrator2
 {
 public:
-    Int8EntropyCalibrator2(int batchsize, int input_w, int input_h, const char* img_dir, const char* calib_table_name, const char* input_blob_name, bool read_cache = true);
+    Int8EntropyCalibrator2(int batchsize, int input_w, int input_h, const char* img_dir, const char* calib_table_name, const char* input_blob_name, bool read_cache = true, int shard_id = 0, int num_shards = 1, bool packed_u8 = false, const char* tensor_cache_name = "");
 
     virtual ~Int8EntropyCalibrator2();
     int getBatchSize() const override;
@@ -22,18 +34,49 @@ public:
     void writeCalibrationCache(const void* cache, size_t length) override;
 
 private:
+    bool open_tensor_cache();
+    void finish_tensor_cache();
+    void start_workers();
+    void decode_worker();
+    bool next_image(cv::Mat& img);
+
     int batchsize_;
     int input_w_;
     int input_h_;
     int img_idx_;
     std::string img_dir_;
-    std::vector<std::string> img_files_;
+    DirScanner img_scanner_;
+    uint64_t folder_hash_;  // of the images the tensor cache must have been built from
     size_t input_count_;
     std::string calib_table_name_;
     const char* input_blob_name_;
     bool read_cache_;
+    bool packed_u8_;
     void* device_input_;
+    void* device_hwc_;
     std::vector<char> calib_cache_;
+
+    // letterboxed uint8 BGR images, read from or written to the tensor cache file
+    size_t image_bytes_;
+    std::vector<unsigned char> host_batch_;
+    std::string tensor_cache_name_;
+    const unsigned char* cache_data_;
+    size_t cache_count_;
+    size_t cache_map_len_;
+    FILE* cache_out_;
+    size_t cache_written_;
+
+    // prefetch state, shared with the decode workers
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::condition_variable space_;
+    std::map<int, cv::Mat> decoded_;
+    int next_index_;
+    int consumed_;
+    int prefetch_depth_;
+    bool scan_done_;
+    bool stop_;
 };
 
 #endif // ENTROPY_CALIBRATOR_H
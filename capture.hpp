@@ -0,0 +1,188 @@
+#ifndef YOLOV5_CAPTURE_H_
+#define YOLOV5_CAPTURE_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Decoded frames of one source in a file (-cap), so a benchmark input can be
+// replayed exactly with replay://<file> instead of depending on a live
+// camera or on decoding a video.
+//
+// After a 64-byte file header, every frame is one chunk: a 64-byte chunk
+// header and the pixels, each at a 64-byte aligned offset. The reader maps
+// the file and hands out views of the pixels without a copy. Frames are only
+// appended, so a capture that was cut short is still read up to its last
+// complete chunk. The time of a frame is its position in the stream in us,
+// relative to the first frame.
+namespace capture {
+
+struct FileHeader {
+    char magic[8];          // "Y5CAP\0\0\0"
+    uint32_t version;
+    uint32_t flags;         // kLetterboxed
+    int32_t input_w;        // letterbox size, 0 for full frames
+    int32_t input_h;
+    char reserved[40];
+};
+
+struct ChunkHeader {
+    char magic[4];          // "FRM\0"
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+    uint64_t frame;         // frame number within the capture
+    int64_t t_us;
+    uint64_t bytes;         // pixel bytes that follow, rows * cols * elemSize
+    char reserved[24];
+};
+
+static_assert(sizeof(FileHeader) == 64 && sizeof(ChunkHeader) == 64, "headers must keep the pixels 64-byte aligned");
+
+static const uint32_t kVersion = 1;
+static const uint32_t kLetterboxed = 1;  // frames are the letterboxed input_w x input_h network input, uint8 BGR
+
+inline uint64_t align64(uint64_t n) { return (n + 63) & ~(uint64_t)63; }
+
+class Writer {
+public:
+    Writer() : f_(nullptr), frames_(0), bytes_(0) {}
+    ~Writer() { close(); }
+
+    // letterbox is the network input size the frames are letterboxed to, empty for full frames
+    bool open(const std::string& path, cv::Size letterbox) {
+        f_ = fopen(path.c_str(), "wb");
+        if (!f_) return false;
+        FileHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, "Y5CAP", 5);
+        h.version = kVersion;
+        h.flags = letterbox.area() ? kLetterboxed : 0;
+        h.input_w = letterbox.width;
+        h.input_h = letterbox.height;
+        return write(&h, sizeof(h));
+    }
+
+    // frame is written as it is, a letterboxed capture gets the letterboxed image
+    bool append(const cv::Mat& frame, int64_t t_us) {
+        if (!f_) return false;
+        ChunkHeader c;
+        memset(&c, 0, sizeof(c));
+        memcpy(c.magic, "FRM", 3);
+        c.rows = frame.rows;
+        c.cols = frame.cols;
+        c.type = frame.type();
+        c.frame = frames_;
+        c.t_us = t_us;
+        c.bytes = (uint64_t)frame.total() * frame.elemSize();
+        if (!write(&c, sizeof(c))) return false;
+        size_t row = frame.cols * frame.elemSize();
+        for (int y = 0; y < frame.rows; y++)
+            if (!write(frame.ptr(y), row)) return false;
+        static const char zeros[64] = {0};
+        if (!write(zeros, align64(c.bytes) - c.bytes)) return false;
+        frames_++;
+        return true;
+    }
+
+    bool close() {
+        if (!f_) return true;
+        bool ok = fclose(f_) == 0;
+        f_ = nullptr;
+        return ok;
+    }
+
+    uint64_t frames() const { return frames_; }
+    uint64_t bytes() const { return bytes_; }
+
+private:
+    bool write(const void* p, size_t n) {
+        if (n && fwrite(p, 1, n, f_) != n) return false;
+        bytes_ += n;
+        return true;
+    }
+
+    FILE* f_;
+    uint64_t frames_;
+    uint64_t bytes_;
+};
+
+class Reader {
+public:
+    Reader() : base_(nullptr), size_(0) {}
+
+    ~Reader() {
+        if (base_) munmap(base_, size_);
+    }
+
+    bool open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FileHeader)) {
+            ::close(fd);
+            return false;
+        }
+        size_ = st.st_size;
+        void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        base_ = (uchar*)p;
+        madvise(base_, size_, MADV_SEQUENTIAL);
+        memcpy(&header_, base_, sizeof(header_));
+        if (memcmp(header_.magic, "Y5CAP", 5) != 0 || header_.version != kVersion) return false;
+        // index the complete chunks
+        uint64_t off = sizeof(FileHeader);
+        while (off + sizeof(ChunkHeader) <= size_) {
+            const ChunkHeader* c = (const ChunkHeader*)(base_ + off);
+            if (memcmp(c->magic, "FRM", 3) != 0 || c->rows <= 0 || c->cols <= 0) break;
+            if (c->bytes != (uint64_t)c->rows * c->cols * CV_ELEM_SIZE(c->type)) break;
+            if (off + sizeof(ChunkHeader) + c->bytes > size_) break;
+            chunks_.push_back(c);
+            off += sizeof(ChunkHeader) + align64(c->bytes);
+        }
+        return true;
+    }
+
+    size_t frames() const { return chunks_.size(); }
+    bool letterboxed() const { return header_.flags & kLetterboxed; }
+    cv::Size input_size() const { return cv::Size(header_.input_w, header_.input_h); }
+    int64_t t_us(size_t i) const { return chunks_[i]->t_us; }
+
+    // a view of the pixels in the mapping, valid while the reader is
+    cv::Mat frame(size_t i) const {
+        const ChunkHeader* c = chunks_[i];
+        return cv::Mat(c->rows, c->cols, c->type, (void*)(c + 1));
+    }
+
+private:
+    uchar* base_;
+    size_t size_;
+    FileHeader header_;
+    std::vector<const ChunkHeader*> chunks_;
+};
+
+// FNV-1a over the detections of one frame, chained over the frames of a source, so two runs
+// over the same capture can be compared bit for bit
+inline uint64_t hash_detections(uint64_t h, const void* dets, size_t bytes) {
+    const uchar* p = (const uchar*)dets;
+    for (size_t i = 0; i < bytes; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    // the frame boundary, so boxes moving between frames change the hash
+    return (h ^ 0xFF) * 1099511628211ULL;
+}
+
+static const uint64_t kHashSeed = 14695981039346656037ULL;
+
+}  // namespace capture
+
+#endif  // YOLOV5_CAPTURE_H_
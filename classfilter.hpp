@@ -0,0 +1,101 @@
+#ifndef YOLOV5_CLASSFILTER_H_
+#define YOLOV5_CLASSFILTER_H_
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "yololayer.h"
+
+// The classes a source cares about, each with the score it needs, e.g.
+// persons, cars above 0.6 and trucks: "0,2:0.6,7". Boxes of other classes
+// are dropped before NMS, so they cost no NMS time, drawing or output. A
+// source asks for its filter with a suffix, rtsp://cam1#classes=0,2:0.6,7,
+// which the reader strips before opening the url. CLASSES in yolov5.cpp
+// applies to the sources without one. The same filter can be built into an
+// engine (-s ... -classes), which drops the boxes in the decode so that they
+// take no output slot and no transfer.
+namespace classfilter {
+
+static const char* const kSuffix = "#classes=";
+
+// the url of a source, without its filter
+inline std::string url_of(const std::string& source) {
+    return source.substr(0, source.rfind(kSuffix));
+}
+
+// the filter spec of a source, "" if it has none
+inline std::string spec_of(const std::string& source) {
+    size_t at = source.rfind(kSuffix);
+    return at == std::string::npos ? "" : source.substr(at + strlen(kSuffix));
+}
+
+class Filter {
+public:
+    // class ids, each optionally with the score it needs, e.g. "0,2:0.6,7". the classes that are not
+    // listed are dropped. false on a malformed spec or a class outside [0, classes).
+    bool parse(const std::string& spec, int classes = Yolo::CLASS_NUM) {
+        min_.assign(classes, Yolo::CLASS_OFF);
+        std::stringstream ss(spec);
+        std::string item;
+        int listed = 0;
+        while (std::getline(ss, item, ',')) {
+            int id, used = -1;
+            float score = Yolo::CLASS_ANY;
+            // the whole item must be consumed, "2x" or "2:0.5x" are malformed
+            int n = sscanf(item.c_str(), "%d%n", &id, &used);
+            if (n == 1 && item[used] == ':') {
+                int at = used + 1;
+                used = -1;
+                n += sscanf(item.c_str() + at, "%f%n", &score, &used) == 1;
+                if (used >= 0) used += at;
+            }
+            if (n < 1 || used != (int)item.size() || id < 0 || id >= classes || (n == 2 && (score < 0 || score >= 1)))
+                return false;
+            min_[id] = score;
+            listed++;
+        }
+        return listed > 0;
+    }
+
+    // per class: Yolo::CLASS_ANY, the score a box must be above, or Yolo::CLASS_OFF
+    const std::vector<float>& min_scores() const { return min_; }
+
+    bool keeps(const Yolo::Detection& det) const {
+        int c = (int)det.class_id;
+        return c >= 0 && c < (int)min_.size() && det.conf > min_[c];
+    }
+
+    std::string str() const {
+        std::ostringstream ss;
+        for (size_t c = 0; c < min_.size(); c++) {
+            if (min_[c] == Yolo::CLASS_OFF) continue;
+            if (ss.tellp() > 0) ss << ",";
+            ss << c;
+            if (min_[c] != Yolo::CLASS_ANY) ss << ":" << min_[c];
+        }
+        return ss.str();
+    }
+
+private:
+    std::vector<float> min_;
+};
+
+// the filter of a source: its own #classes=, else default_spec, nullptr if there is neither.
+// false if the spec that applies is malformed.
+inline bool for_source(const std::string& source, const std::string& default_spec, std::shared_ptr<const Filter>& out) {
+    std::string spec = spec_of(source);
+    if (spec.empty()) spec = default_spec;
+    out.reset();
+    if (spec.empty()) return true;
+    std::shared_ptr<Filter> f(new Filter());
+    if (!f->parse(spec)) return false;
+    out = f;
+    return true;
+}
+
+}  // namespace classfilter
+
+#endif  // YOLOV5_CLASSFILTER_H_
@@ -0,0 +1,375 @@
+#ifndef YOLOV5_CLUSTER_H_
+#define YOLOV5_CLUSTER_H_
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "async_logger.hpp"
+
+// Spreads video sources over worker processes. Workers connect to the
+// coordinator over TCP ("host:port") or a Unix socket ("unix:/path") and talk
+// in newline-terminated text lines:
+//
+//   worker -> coordinator   HELLO <name> <capacity>        capacity = sources it can take
+//                           LOAD <utilization>             every second, busy fraction of its workers
+//                           DET <source> <frame> <n> [<class> <conf> <x> <y> <w> <h>]...
+//                           EOS <source>                   the source ended
+//                           REFUSE <source>                no memory left for an assigned source
+//   coordinator -> worker   ASSIGN <source> <url>
+//                           REVOKE <source>
+//
+// A source goes to the worker with the most free capacity. A worker that
+// reports overload for several seconds in a row hands one source to the
+// least loaded worker with room, and keeps the lower capacity afterwards, as
+// does a worker that refuses a source. A worker that disconnects or goes
+// silent loses its sources to the others.
+// DET lines are merged to the output prefixed with the worker name.
+namespace cluster {
+
+// "unix:/path" or "[host]:port", returns a listening or connected socket, -1 on error
+inline int open_socket(const std::string& addr, bool listening) {
+    if (addr.compare(0, 5, "unix:") == 0) {
+        std::string path = addr.substr(5);
+        sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        if (path.empty() || path.size() >= sizeof(sa.sun_path)) return -1;
+        sa.sun_family = AF_UNIX;
+        strcpy(sa.sun_path, path.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        if (listening) unlink(path.c_str());
+        int rc = listening ? bind(fd, (sockaddr*)&sa, sizeof(sa)) : connect(fd, (sockaddr*)&sa, sizeof(sa));
+        if (rc != 0 || (listening && listen(fd, 16) != 0)) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    size_t colon = addr.rfind(':');
+    if (colon == std::string::npos) return -1;
+    std::string host = addr.substr(0, colon), port = addr.substr(colon + 1);
+    addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (listening ? (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 16) == 0)
+                      : connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// true for a Unix socket or a host that only resolves to loopback addresses. an empty host
+// listens on every interface and is not local.
+inline bool is_local(const std::string& addr) {
+    if (addr.compare(0, 5, "unix:") == 0) return true;
+    size_t colon = addr.rfind(':');
+    if (colon == std::string::npos || colon == 0) return false;
+    addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(addr.substr(0, colon).c_str(), nullptr, &hints, &res) != 0) return false;
+    bool local = true;
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+        if (ai->ai_family == AF_INET)
+            local = local && (ntohl(((sockaddr_in*)ai->ai_addr)->sin_addr.s_addr) >> 24) == 127;
+        else if (ai->ai_family == AF_INET6)
+            local = local && IN6_IS_ADDR_LOOPBACK(&((sockaddr_in6*)ai->ai_addr)->sin6_addr);
+        else
+            local = false;
+    }
+    freeaddrinfo(res);
+    return local;
+}
+
+// a socket that is read in lines and written from any thread
+class LineConn {
+public:
+    explicit LineConn(int fd = -1) : fd_(fd) {}
+    ~LineConn() { close_fd(); }
+
+    int fd() const { return fd_; }
+
+    // reads what arrived and appends the complete lines, false on EOF or error.
+    // only call when poll() reports the socket readable.
+    bool read_lines(std::vector<std::string>& lines) {
+        char buf[4096];
+        ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+        if (n < 0) return errno == EINTR || errno == EAGAIN;
+        if (n == 0) return false;
+        in_.append(buf, n);
+        size_t start = 0, pos;
+        while ((pos = in_.find('\n', start)) != std::string::npos) {
+            lines.push_back(in_.substr(start, pos - start));
+            start = pos + 1;
+        }
+        in_.erase(0, start);
+        return in_.size() < kMaxLine;
+    }
+
+    bool send_line(const std::string& line) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        std::string s = line + '\n';
+        size_t off = 0;
+        while (off < s.size()) {
+            ssize_t n = send(fd_, s.data() + off, s.size() - off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            off += n;
+        }
+        return true;
+    }
+
+    void close_fd() {
+        if (fd_ >= 0) close(fd_);
+        fd_ = -1;
+    }
+
+private:
+    static const size_t kMaxLine = 1 << 20;
+
+    int fd_;
+    std::string in_;
+    std::mutex mutex_;
+};
+
+class Coordinator {
+public:
+    Coordinator(const std::string& addr, const std::vector<std::string>& sources, FILE* out = stdout)
+        : addr_(addr), out_(out), listen_fd_(-1), next_worker_(0) {
+        for (auto& url : sources) {
+            Source s;
+            s.url = url;
+            sources_.push_back(s);
+        }
+    }
+
+    ~Coordinator() {
+        if (listen_fd_ >= 0) close(listen_fd_);
+    }
+
+    // serves workers until every source has ended or stop is set, -1 if the address cannot be bound
+    int run(const std::atomic<bool>& stop) {
+        listen_fd_ = open_socket(addr_, true);
+        if (listen_fd_ < 0) {
+            ALOG_ERROR("coordinator: cannot listen on {}", addr_);
+            return -1;
+        }
+        ALOG_INFO("coordinator: listening on {} with {} sources", addr_, (int)sources_.size());
+        auto last_tick = std::chrono::steady_clock::now();
+        while (!stop.load() && !all_ended()) {
+            std::vector<pollfd> fds(1);
+            std::vector<int> ids(1, -1);
+            fds[0].fd = listen_fd_;
+            fds[0].events = POLLIN;
+            for (auto& kv : workers_) {
+                pollfd p;
+                p.fd = kv.second->conn.fd();
+                p.events = POLLIN;
+                fds.push_back(p);
+                ids.push_back(kv.first);
+            }
+            if (poll(fds.data(), fds.size(), 200) < 0 && errno != EINTR) return -1;
+            if (fds[0].revents & POLLIN) accept_worker();
+            for (size_t i = 1; i < fds.size(); i++) {
+                if (!fds[i].revents) continue;
+                auto it = workers_.find(ids[i]);
+                if (it == workers_.end()) continue;
+                std::vector<std::string> lines;
+                bool alive = it->second->conn.read_lines(lines);
+                for (auto& line : lines) handle(*it->second, line);
+                if (!alive) drop_worker(ids[i], "disconnected");
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_tick >= std::chrono::seconds(1)) {
+                last_tick = now;
+                tick(now);
+            }
+        }
+        fflush(out_);
+        return 0;
+    }
+
+private:
+    static constexpr double kOverload = 0.9;    // utilization a worker is overloaded at
+    static constexpr double kTarget = 0.7;      // a moved source only goes to workers below this
+    static const int kOverloadReports = 3;      // consecutive reports before a source moves
+    static const int kTimeoutSec = 5;           // silence before a worker is considered dead
+
+    struct Source {
+        std::string url;
+        int worker = -1;
+        bool ended = false;
+    };
+
+    struct Worker {
+        int id;
+        std::string name;
+        int capacity = 0;       // 0 until HELLO
+        double load = 0;
+        int overload_reports = 0;
+        std::set<int> sources;
+        std::chrono::steady_clock::time_point last_seen;
+        LineConn conn;
+        explicit Worker(int fd) : conn(fd) {}
+    };
+
+    bool all_ended() const {
+        for (auto& s : sources_)
+            if (!s.ended) return false;
+        return true;
+    }
+
+    void accept_worker() {
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) return;
+        std::unique_ptr<Worker> w(new Worker(fd));
+        w->id = next_worker_++;
+        w->name = "worker" + std::to_string(w->id);
+        w->last_seen = std::chrono::steady_clock::now();
+        workers_[w->id] = std::move(w);
+    }
+
+    void handle(Worker& w, const std::string& line) {
+        w.last_seen = std::chrono::steady_clock::now();
+        std::istringstream ss(line);
+        std::string cmd;
+        ss >> cmd;
+        if (cmd == "HELLO") {
+            ss >> w.name >> w.capacity;
+            ALOG_INFO("coordinator: {} joined with capacity {}", w.name, w.capacity);
+            place();
+        } else if (cmd == "LOAD") {
+            ss >> w.load;
+            w.overload_reports = w.load > kOverload ? w.overload_reports + 1 : 0;
+        } else if (cmd == "DET") {
+            fprintf(out_, "%s %s\n", w.name.c_str(), line.c_str() + 4);
+        } else if (cmd == "REFUSE") {
+            int s = -1;
+            ss >> s;
+            if (s < 0 || s >= (int)sources_.size() || sources_[s].worker != w.id) return;
+            ALOG_WARN("coordinator: {} refused source {}", w.name, s);
+            sources_[s].worker = -1;
+            w.sources.erase(s);
+            w.capacity = (int)w.sources.size();
+            place();
+        } else if (cmd == "EOS") {
+            int s = -1;
+            ss >> s;
+            if (s < 0 || s >= (int)sources_.size() || sources_[s].worker != w.id) return;
+            ALOG_INFO("coordinator: source {} ended on {}", s, w.name);
+            sources_[s].ended = true;
+            sources_[s].worker = -1;
+            w.sources.erase(s);
+        }
+    }
+
+    void tick(std::chrono::steady_clock::time_point now) {
+        // copied first: seconds() takes a reference, which would need a definition of the static member
+        const int timeout_sec = kTimeoutSec;
+        std::vector<int> silent;
+        for (auto& kv : workers_)
+            if (now - kv.second->last_seen > std::chrono::seconds(timeout_sec)) silent.push_back(kv.first);
+        for (int id : silent) drop_worker(id, "timed out");
+        rebalance();
+        place();
+        fflush(out_);
+    }
+
+    void assign(int s, Worker& w) {
+        sources_[s].worker = w.id;
+        w.sources.insert(s);
+        ALOG_INFO("coordinator: source {} -> {}", s, w.name);
+        w.conn.send_line("ASSIGN " + std::to_string(s) + " " + sources_[s].url);
+    }
+
+    // unplaced sources go to the worker with the most free capacity
+    void place() {
+        for (int s = 0; s < (int)sources_.size(); s++) {
+            if (sources_[s].ended || sources_[s].worker >= 0) continue;
+            Worker* best = nullptr;
+            for (auto& kv : workers_) {
+                Worker& w = *kv.second;
+                int free_slots = w.capacity - (int)w.sources.size();
+                if (free_slots <= 0) continue;
+                if (!best || free_slots > best->capacity - (int)best->sources.size() ||
+                    (free_slots == best->capacity - (int)best->sources.size() && w.load < best->load))
+                    best = &w;
+            }
+            if (!best) {
+                ALOG_EVERY_MS(alog::Severity::kWARNING, 10000, "coordinator: no worker has room for source {}", s);
+                return;
+            }
+            assign(s, *best);
+        }
+    }
+
+    void rebalance() {
+        for (auto& kv : workers_) {
+            Worker& w = *kv.second;
+            if (w.overload_reports < kOverloadReports || w.sources.size() < 2) continue;
+            Worker* target = nullptr;
+            for (auto& other : workers_) {
+                Worker& o = *other.second;
+                if (&o == &w || o.capacity <= (int)o.sources.size() || o.load >= kTarget) continue;
+                if (!target || o.load < target->load) target = &o;
+            }
+            if (!target) continue;
+            int s = *w.sources.rbegin();
+            ALOG_WARN("coordinator: {} overloaded ({}), moving source {} to {}", w.name, w.load, s, target->name);
+            w.conn.send_line("REVOKE " + std::to_string(s));
+            w.sources.erase(s);
+            // what it could not keep up with becomes its capacity
+            w.capacity = (int)w.sources.size();
+            w.overload_reports = 0;
+            assign(s, *target);
+        }
+    }
+
+    void drop_worker(int id, const char* why) {
+        auto it = workers_.find(id);
+        if (it == workers_.end()) return;
+        ALOG_WARN("coordinator: {} {}, reassigning {} sources", it->second->name, why, (int)it->second->sources.size());
+        for (int s : it->second->sources) sources_[s].worker = -1;
+        workers_.erase(it);
+        place();
+    }
+
+    std::string addr_;
+    FILE* out_;
+    int listen_fd_;
+    int next_worker_;
+    std::vector<Source> sources_;
+    std::map<int, std::unique_ptr<Worker>> workers_;
+};
+
+}  // namespace cluster
+
+#endif  // YOLOV5_CLUSTER_H_
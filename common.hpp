@@ -8,25 +8,27 @@
 #include <opencv2/opencv.hpp>
 #include "NvInfer.h"
 #include "yololayer.h"
+#include "preprocesslayer.h"
 
 using namespace nvinfer1;
 
-cv::Rect get_rect(cv::Mat& img, float bbox[4]) {
+// maps a box from the input_w x input_h letterboxed network input back to img
+cv::Rect get_rect(cv::Mat& img, float bbox[4], int input_w, int input_h) {
     int l, r, t, b;
-    float r_w = Yolo::INPUT_W / (img.cols * 1.0);
-    float r_h = Yolo::INPUT_H / (img.rows * 1.0);
+    float r_w = input_w / (img.cols * 1.0);
+    float r_h = input_h / (img.rows * 1.0);
     if (r_h > r_w) {
         l = bbox[0] - bbox[2] / 2.f;
         r = bbox[0] + bbox[2] / 2.f;
-        t = bbox[1] - bbox[3] / 2.f - (Yolo::INPUT_H - r_w * img.rows) / 2;
-        b = bbox[1] + bbox[3] / 2.f - (Yolo::INPUT_H - r_w * img.rows) / 2;
+        t = bbox[1] - bbox[3] / 2.f - (input_h - r_w * img.rows) / 2;
+        b = bbox[1] + bbox[3] / 2.f - (input_h - r_w * img.rows) / 2;
         l = l / r_w;
         r = r / r_w;
         t = t / r_w;
         b = b / r_w;
     } else {
-        l = bbox[0] - bbox[2] / 2.f - (Yolo::INPUT_W - r_h * img.cols) / 2;
-        r = bbox[0] + bbox[2] / 2.f - (Yolo::INPUT_W - r_h * img.cols) / 2;
+        l = bbox[0] - bbox[2] / 2.f - (input_w - r_h * img.cols) / 2;
+        r = bbox[0] + bbox[2] / 2.f - (input_w - r_h * img.cols) / 2;
         t = bbox[1] - bbox[3] / 2.f;
         b = bbox[1] + bbox[3] / 2.f;
         l = l / r_h;
@@ -56,13 +58,15 @@ bool cmp(const Yolo::Detection& a, const Yolo::Detection& b) {
     return a.conf > b.conf;
 }
 
-void nms(std::vector<Yolo::Detection>& res, float *output, float conf_thresh, float nms_thresh = 0.5) {
+// class_min, one score floor per class (see classfilter.hpp), drops boxes before they are grouped and suppressed
+void nms(std::vector<Yolo::Detection>& res, float *output, float conf_thresh, float nms_thresh = 0.5, const float* class_min = nullptr) {
     int det_size = sizeof(Yolo::Detection) / sizeof(float);
     std::map<float, std::vector<Yolo::Detection>> m;
     for (int i = 0; i < output[0] && i < Yolo::MAX_OUTPUT_BBOX_COUNT; i++) {
         if (output[1 + det_size * i + 4] <= conf_thresh) continue;
         Yolo::Detection det;
         memcpy(&det, &output[1 + det_size * i], det_size * sizeof(float));
+        if (class_min && !(det.conf > class_min[(int)det.class_id])) continue;
         if (m.count(det.class_id) == 0) m.emplace(det.class_id, std::vector<Yolo::Detection>());
         m[det.class_id].push_back(det);
     }
@@ -175,10 +179,14 @@ ILayer* convBlock(INetworkDefinition *network, std::map<std::string, Weights>& w
 }
 
 ILayer* focus(INetworkDefinition *network, std::map<std::string, Weights>& weightMap, ITensor& input, int inch, int outch, int ksize, std::string lname) {
-    ISliceLayer *s1 = network->addSlice(input, Dims3{ 0, 0, 0 }, Dims3{ inch, Yolo::INPUT_H / 2, Yolo::INPUT_W / 2 }, Dims3{ 1, 2, 2 });
-    ISliceLayer *s2 = network->addSlice(input, Dims3{ 0, 1, 0 }, Dims3{ inch, Yolo::INPUT_H / 2, Yolo::INPUT_W / 2 }, Dims3{ 1, 2, 2 });
-    ISliceLayer *s3 = network->addSlice(input, Dims3{ 0, 0, 1 }, Dims3{ inch, Yolo::INPUT_H / 2, Yolo::INPUT_W / 2 }, Dims3{ 1, 2, 2 });
-    ISliceLayer *s4 = network->addSlice(input, Dims3{ 0, 1, 1 }, Dims3{ inch, Yolo::INPUT_H / 2, Yolo::INPUT_W / 2 }, Dims3{ 1, 2, 2 });
+    // slice sizes follow the input tensor so that non-square engines work as well
+    Dims in_dims = input.getDimensions();
+    int half_h = in_dims.d[1] / 2;
+    int half_w = in_dims.d[2] / 2;
+    ISliceLayer *s1 = network->addSlice(input, Dims3{ 0, 0, 0 }, Dims3{ inch, half_h, half_w }, Dims3{ 1, 2, 2 });
+    ISliceLayer *s2 = network->addSlice(input, Dims3{ 0, 1, 0 }, Dims3{ inch, half_h, half_w }, Dims3{ 1, 2, 2 });
+    ISliceLayer *s3 = network->addSlice(input, Dims3{ 0, 0, 1 }, Dims3{ inch, half_h, half_w }, Dims3{ 1, 2, 2 });
+    ISliceLayer *s4 = network->addSlice(input, Dims3{ 0, 1, 1 }, Dims3{ inch, half_h, half_w }, Dims3{ 1, 2, 2 });
     ITensor* inputTensors[] = { s1->getOutput(0), s2->getOutput(0), s3->getOutput(0), s4->getOutput(0) };
     auto cat = network->addConcatenation(inputTensors, 4);
     auto conv = convBlock(network, weightMap, *cat->getOutput(0), outch, ksize, 1, 1, lname + ".conv");
@@ -256,6 +264,21 @@ ILayer* SPP(INetworkDefinition *network, std::map<std::string, Weights>& weightM
     return cv2;
 }
 
+// unpacks the packed uint8 BGR HWC input binding of shape {input_h, input_w * 3 / 4} into the float RGB CHW network input
+IPluginV2Layer* addPreprocessLayer(INetworkDefinition *network, ITensor& input, int input_w, int input_h)
+{
+    auto creator = getPluginRegistry()->getPluginCreator("PreprocessLayer_TRT", "1");
+    int netsize[2] = { input_w, input_h };
+    PluginField field("netsize", netsize, PluginFieldType::kINT32, 2);
+    PluginFieldCollection pluginData;
+    pluginData.nbFields = 1;
+    pluginData.fields = &field;
+    IPluginV2 *pluginObj = creator->createPlugin("preprocess", &pluginData);
+    ITensor* inputTensors[] = { &input };
+    auto preprocess = network->addPluginV2(inputTensors, 1, *pluginObj);
+    return preprocess;
+}
+
 std::vector<float> getAnchors(std::map<std::string, Weights>& weightMap)
 {
     std::vector<float> anchors_yolo;
@@ -281,15 +304,15 @@ std::vector<float> getAnchors(std::map<std::string, Weights>& weightMap)
     return anchors_yolo;
 }
 
-IPluginV2Layer* addYoLoLayer(INetworkDefinition *network, std::map<std::string, Weights>& weightMap, IConvolutionLayer* det0, IConvolutionLayer* det1, IConvolutionLayer* det2)
+IPluginV2Layer* addYoLoLayer(INetworkDefinition *network, std::map<std::string, Weights>& weightMap, IConvolutionLayer* det0, IConvolutionLayer* det1, IConvolutionLayer* det2, int input_w, int input_h, int top_k = 0, float conf_thresh = 0, float nms_thresh = 0, const std::vector<float>& class_min = std::vector<float>())
 {
     auto creator = getPluginRegistry()->getPluginCreator("YoloLayer_TRT", "1");
     std::vector<float> anchors_yolo = getAnchors(weightMap);
-    PluginField pluginMultidata[4];
+    PluginField pluginMultidata[6];
     int NetData[4];
     NetData[0] = Yolo::CLASS_NUM;
-    NetData[1] = Yolo::INPUT_W;
-    NetData[2] = Yolo::INPUT_H;
+    NetData[1] = input_w;
+    NetData[2] = input_h;
     NetData[3] = Yolo::MAX_OUTPUT_BBOX_COUNT;
     pluginMultidata[0].data = NetData;
     pluginMultidata[0].length = 3;
@@ -300,8 +323,8 @@ IPluginV2Layer* addYoLoLayer(INetworkDefinition *network, std::map<std::string,
     std::string names[3];
     for (int k = 1; k < 4; k++)
     {
-        plugindata[k - 1][0] = Yolo::INPUT_W / scale[k - 1];
-        plugindata[k - 1][1] = Yolo::INPUT_H / scale[k - 1];
+        plugindata[k - 1][0] = input_w / scale[k - 1];
+        plugindata[k - 1][1] = input_h / scale[k - 1];
         for (int i = 2; i < 8; i++)
         {
             plugindata[k - 1][i] = int(anchors_yolo[(k - 1) * 6 + i - 2]);
@@ -312,8 +335,19 @@ IPluginV2Layer* addYoLoLayer(INetworkDefinition *network, std::map<std::string,
         pluginMultidata[k].name = names[k - 1].c_str();
         pluginMultidata[k].type = PluginFieldType::kFLOAT32;
     }
+    // a top-K makes the layer run NMS on the device and output only the kept boxes
+    float NmsData[3] = { (float)top_k, conf_thresh, nms_thresh };
+    pluginMultidata[4].data = NmsData;
+    pluginMultidata[4].length = 3;
+    pluginMultidata[4].name = "nmsdata";
+    pluginMultidata[4].type = PluginFieldType::kFLOAT32;
+    // a class filter makes the decode drop the boxes of classes below their score floor
+    pluginMultidata[5].data = class_min.data();
+    pluginMultidata[5].length = class_min.size();
+    pluginMultidata[5].name = "classdata";
+    pluginMultidata[5].type = PluginFieldType::kFLOAT32;
     PluginFieldCollection pluginData;
-    pluginData.nbFields = 4;
+    pluginData.nbFields = !class_min.empty() ? 6 : top_k > 0 ? 5 : 4;
     pluginData.fields = pluginMultidata;
     IPluginV2 *pluginObj = creator->createPlugin("yololayer", &pluginData);
     ITensor* inputTensors_yolo[] = { det2->getOutput(0), det1->getOutput(0), det0->getOutput(0) };
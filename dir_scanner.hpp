@@ -0,0 +1,207 @@
+#ifndef YOLOV5_DIR_SCANNER_H_
+#define YOLOV5_DIR_SCANNER_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Streams the entries of a directory in getdents64 batches instead of loading
+// every name up front. Work can be split across processes with
+// (shard_id, num_shards): an entry belongs to the shard selected by the FNV-1a
+// hash of its name, so every process computes the same split without talking
+// to the others. Finished entries are recorded with mark_done() and appended
+// to a checkpoint file as 64-bit name hashes, so a restarted run skips them.
+class DirScanner {
+public:
+    DirScanner(const std::string& dir, int shard_id = 0, int num_shards = 1,
+               const std::string& checkpoint = "", int checkpoint_every = 64)
+        : dir_(dir)
+        , shard_id_(shard_id)
+        , num_shards_(num_shards > 0 ? num_shards : 1)
+        , checkpoint_(checkpoint)
+        , checkpoint_every_(checkpoint_every > 0 ? checkpoint_every : 1)
+        , fd_(-1)
+        , buf_(kBatchBytes)
+        , buf_pos_(0)
+        , buf_len_(0)
+        , eof_(false)
+        , skipped_(0)
+    {
+    }
+
+    ~DirScanner() {
+        flush_checkpoint();
+        if (fd_ >= 0) close(fd_);
+    }
+
+    // opens the directory and loads the checkpoint, returns false if the directory cannot be read
+    // or the checkpoint belongs to another shard layout; the checkpoint is then left as it is
+    bool open() {
+        fd_ = ::open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd_ < 0) {
+            std::cerr << "could not open image folder " << dir_ << std::endl;
+            return false;
+        }
+        return load_checkpoint();
+    }
+
+    // next entry of this shard that is not checkpointed yet, false at the end of the directory
+    bool next(std::string& name) {
+        while (true) {
+            if (buf_pos_ >= buf_len_) {
+                if (eof_ || !refill()) return false;
+            }
+            const linux_dirent64* ent = reinterpret_cast<const linux_dirent64*>(&buf_[buf_pos_]);
+            buf_pos_ += ent->d_reclen;
+            if (ent->d_type == DT_DIR) continue;  // also covers "." and ".."
+            if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) continue;
+            uint64_t h = hash_name(ent->d_name);
+            if ((int)(h % num_shards_) != shard_id_) continue;
+            if (done_.count(h)) {
+                skipped_++;
+                continue;
+            }
+            name = ent->d_name;
+            return true;
+        }
+    }
+
+    // records an entry as finished, the checkpoint is persisted every checkpoint_every entries
+    void mark_done(const std::string& name) {
+        uint64_t h = hash_name(name.c_str());
+        done_.insert(h);
+        if (checkpoint_.empty()) return;
+        pending_.push_back(h);
+        if ((int)pending_.size() >= checkpoint_every_) flush_checkpoint();
+    }
+
+    void flush_checkpoint() {
+        if (checkpoint_.empty() || pending_.empty()) return;
+        FILE* fp = fopen(checkpoint_.c_str(), "ab");
+        if (!fp) {
+            std::cerr << "could not write checkpoint " << checkpoint_ << std::endl;
+            return;
+        }
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) == 0) {
+            CheckpointHeader hdr = make_header();
+            fwrite(&hdr, sizeof(hdr), 1, fp);
+        }
+        fwrite(pending_.data(), sizeof(uint64_t), pending_.size(), fp);
+        fflush(fp);
+        fsync(fileno(fp));
+        fclose(fp);
+        pending_.clear();
+    }
+
+    // number of entries of this shard skipped because the checkpoint had them
+    size_t skipped() const { return skipped_; }
+
+    static uint64_t hash_name(const char* s) {
+        uint64_t h = 1469598103934665603ULL;
+        for (; *s; ++s) {
+            h ^= (unsigned char)*s;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+private:
+    static const size_t kBatchBytes = 32 * 1024;
+
+    struct linux_dirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    struct CheckpointHeader {
+        char magic[4];
+        int32_t version;
+        int32_t shard_id;
+        int32_t num_shards;
+    };
+
+    CheckpointHeader make_header() const {
+        CheckpointHeader hdr;
+        memcpy(hdr.magic, "YDCK", 4);
+        hdr.version = 1;
+        hdr.shard_id = shard_id_;
+        hdr.num_shards = num_shards_;
+        return hdr;
+    }
+
+    bool refill() {
+        long n = syscall(SYS_getdents64, fd_, buf_.data(), buf_.size());
+        if (n <= 0) {
+            eof_ = true;
+            return false;
+        }
+        buf_pos_ = 0;
+        buf_len_ = (size_t)n;
+        return true;
+    }
+
+    bool load_checkpoint() {
+        if (checkpoint_.empty()) return true;
+        FILE* fp = fopen(checkpoint_.c_str(), "rb");
+        if (!fp) return true;
+        CheckpointHeader hdr, expect = make_header();
+        size_t got = fread(&hdr, 1, sizeof(hdr), fp);
+        if (got == 0) {
+            // created but nothing flushed yet
+            fclose(fp);
+            return true;
+        }
+        if (got != sizeof(hdr) || memcmp(&hdr, &expect, sizeof(hdr)) != 0) {
+            // the progress recorded in it is kept: a wrong shard argument must not erase it
+            if (got == sizeof(hdr) && memcmp(hdr.magic, expect.magic, 4) == 0)
+                std::cerr << "checkpoint " << checkpoint_ << " was written for shard " << hdr.shard_id << "/" << hdr.num_shards
+                          << ", not " << shard_id_ << "/" << num_shards_ << "; give the same shard or another checkpoint file" << std::endl;
+            else
+                std::cerr << "checkpoint " << checkpoint_ << " is not a checkpoint of this version" << std::endl;
+            fclose(fp);
+            return false;
+        }
+        // a crash can leave a partial trailing record, fread only returns whole ones
+        uint64_t h[512];
+        size_t n, records = 0;
+        while ((n = fread(h, sizeof(uint64_t), 512, fp)) > 0) {
+            done_.insert(h, h + n);
+            records += n;
+        }
+        fclose(fp);
+        // cut a partial record off so that new appends stay aligned
+        size_t valid = sizeof(hdr) + records * sizeof(uint64_t);
+        if (truncate(checkpoint_.c_str(), valid) != 0) {
+            std::cerr << "could not trim checkpoint " << checkpoint_ << std::endl;
+        }
+        return true;
+    }
+
+    std::string dir_;
+    int shard_id_;
+    int num_shards_;
+    std::string checkpoint_;
+    int checkpoint_every_;
+    int fd_;
+    std::vector<char> buf_;
+    size_t buf_pos_;
+    size_t buf_len_;
+    bool eof_;
+    size_t skipped_;
+    std::unordered_set<uint64_t> done_;
+    std::vector<uint64_t> pending_;
+};
+
+#endif  // YOLOV5_DIR_SCANNER_H_
@@ -0,0 +1,466 @@
+#ifndef YOLOV5_EVALUATE_H_
+#define YOLOV5_EVALUATE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "taskpool.hpp"
+
+// COCO box accuracy (-e): AP per class at IoU 0.5 and averaged over IoU 0.5 to
+// 0.95, and their means over the classes, as pycocotools computes them for
+// bounding boxes over all areas with at most 100 detections per image and
+// class. Ground truth comes from an instances_*.json, detections from a COCO
+// results file ([{"image_id", "category_id", "bbox": [x, y, w, h], "score"}]).
+// Boxes are matched per image and class, best score first, to the unmatched
+// ground truth box they overlap most; crowd regions can be matched by any
+// number of detections, which are then neither true nor false positives.
+// Every class is evaluated on a task of its own on the pool.
+namespace evaluate {
+
+struct Box {
+    float x, y, w, h;   // top left corner and size, in pixels of the image
+};
+
+struct Image {
+    int id;
+    std::string file_name;
+};
+
+struct Category {
+    int id;
+    std::string name;
+};
+
+struct Object {
+    int image;
+    int category;
+    Box box;
+    float score;        // 1 for ground truth
+    bool crowd;
+};
+
+struct Dataset {
+    std::vector<Image> images;
+    std::vector<Category> categories;   // by id, so that model class k is categories[k]
+    std::vector<Object> objects;
+};
+
+// Just enough JSON to read COCO files: values the caller does not ask for,
+// like the segmentation polygons, are skipped without being stored.
+class JsonReader {
+public:
+    JsonReader(const char* begin, const char* end) : p_(begin), end_(end), ok_(true) {}
+
+    bool ok() const { return ok_; }
+
+    bool string(std::string& out) {
+        ws();
+        if (!expect('"')) return false;
+        out.clear();
+        while (p_ < end_ && *p_ != '"') {
+            if (*p_ == '\\' && p_ + 1 < end_) {
+                p_++;
+                switch (*p_) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u': out += '?'; p_ += std::min<long>(4, end_ - p_ - 1); break;  // names only, the code point is not needed
+                default: out += *p_;
+                }
+                p_++;
+            } else {
+                out += *p_++;
+            }
+        }
+        return expect('"');
+    }
+
+    bool number(double& out) {
+        ws();
+        char* stop;
+        out = strtod(p_, &stop);
+        if (stop == p_) return fail();
+        p_ = stop;
+        return true;
+    }
+
+    // fn(key) reads or skips the value of every member
+    template <class F>
+    bool object(F fn) {
+        ws();
+        if (!expect('{')) return false;
+        ws();
+        if (p_ < end_ && *p_ == '}') return ++p_, true;
+        std::string key;
+        do {
+            if (!string(key)) return false;
+            ws();
+            if (!expect(':') || !fn(key)) return false;
+            ws();
+        } while (p_ < end_ && *p_ == ',' && ++p_);
+        return expect('}');
+    }
+
+    // fn() reads or skips every element
+    template <class F>
+    bool array(F fn) {
+        ws();
+        if (!expect('[')) return false;
+        ws();
+        if (p_ < end_ && *p_ == ']') return ++p_, true;
+        do {
+            if (!fn()) return false;
+            ws();
+        } while (p_ < end_ && *p_ == ',' && ++p_);
+        return expect(']');
+    }
+
+    bool skip() {
+        ws();
+        if (p_ >= end_) return fail();
+        std::string s;
+        double d;
+        switch (*p_) {
+        case '{': return object([&](const std::string&) { return skip(); });
+        case '[': return array([&] { return skip(); });
+        case '"': return string(s);
+        case 't': return word("true");
+        case 'f': return word("false");
+        case 'n': return word("null");
+        default: return number(d);
+        }
+    }
+
+    // [x, y, w, h]
+    bool box(Box& b) {
+        double v[4];
+        int n = 0;
+        if (!array([&] { return n < 4 ? number(v[n++]) : fail(); }) || n != 4) return fail();
+        b.x = (float)v[0];
+        b.y = (float)v[1];
+        b.w = (float)v[2];
+        b.h = (float)v[3];
+        return true;
+    }
+
+private:
+    void ws() {
+        while (p_ < end_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t')) p_++;
+    }
+
+    bool expect(char c) {
+        if (p_ < end_ && *p_ == c) return ++p_, true;
+        return fail();
+    }
+
+    bool word(const char* w) {
+        size_t n = strlen(w);
+        if ((size_t)(end_ - p_) < n || strncmp(p_, w, n) != 0) return fail();
+        p_ += n;
+        return true;
+    }
+
+    bool fail() {
+        ok_ = false;
+        return false;
+    }
+
+    const char* p_;
+    const char* end_;
+    bool ok_;
+};
+
+// a box of the network output (center, size) in pixels of the cols x rows image it was letterboxed from, as get_rect()
+// but without rounding
+inline Box from_letterbox(const float bbox[4], int cols, int rows, int input_w, int input_h) {
+    float r_w = input_w / (cols * 1.0f);
+    float r_h = input_h / (rows * 1.0f);
+    float r = std::min(r_w, r_h);
+    float pad_x = r_h > r_w ? 0 : (input_w - r_h * cols) / 2;
+    float pad_y = r_h > r_w ? (input_h - r_w * rows) / 2 : 0;
+    Box b;
+    b.x = (bbox[0] - bbox[2] / 2.f - pad_x) / r;
+    b.y = (bbox[1] - bbox[3] / 2.f - pad_y) / r;
+    b.w = bbox[2] / r;
+    b.h = bbox[3] / r;
+    return b;
+}
+
+inline bool read_file(const std::string& path, std::string& text) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) return false;
+    std::ostringstream ss;
+    ss << f.rdbuf();
+    text = ss.str();
+    return true;
+}
+
+// the images, categories and boxes of an instances_*.json
+inline bool load_annotations(const std::string& path, Dataset& data) {
+    std::string text;
+    if (!read_file(path, text)) return false;
+    JsonReader json(text.data(), text.data() + text.size());
+    data = Dataset();
+    bool ok = json.object([&](const std::string& key) {
+        if (key == "images") {
+            return json.array([&] {
+                Image img = {-1, ""};
+                double id = -1;
+                bool r = json.object([&](const std::string& k) {
+                    if (k == "id") return json.number(id);
+                    if (k == "file_name") return json.string(img.file_name);
+                    return json.skip();
+                });
+                img.id = (int)id;
+                data.images.push_back(img);
+                return r;
+            });
+        }
+        if (key == "categories") {
+            return json.array([&] {
+                Category cat = {-1, ""};
+                double id = -1;
+                bool r = json.object([&](const std::string& k) {
+                    if (k == "id") return json.number(id);
+                    if (k == "name") return json.string(cat.name);
+                    return json.skip();
+                });
+                cat.id = (int)id;
+                data.categories.push_back(cat);
+                return r;
+            });
+        }
+        if (key == "annotations") {
+            return json.array([&] {
+                Object o = {-1, -1, {0, 0, 0, 0}, 1.0f, false};
+                double image = -1, category = -1, crowd = 0;
+                bool r = json.object([&](const std::string& k) {
+                    if (k == "image_id") return json.number(image);
+                    if (k == "category_id") return json.number(category);
+                    if (k == "iscrowd") return json.number(crowd);
+                    if (k == "bbox") return json.box(o.box);
+                    return json.skip();
+                });
+                o.image = (int)image;
+                o.category = (int)category;
+                o.crowd = crowd != 0;
+                data.objects.push_back(o);
+                return r;
+            });
+        }
+        return json.skip();
+    });
+    std::sort(data.categories.begin(), data.categories.end(), [](const Category& a, const Category& b) { return a.id < b.id; });
+    return ok && json.ok();
+}
+
+// the detections of a COCO results file
+inline bool load_detections(const std::string& path, std::vector<Object>& dets) {
+    std::string text;
+    if (!read_file(path, text)) return false;
+    JsonReader json(text.data(), text.data() + text.size());
+    dets.clear();
+    bool ok = json.array([&] {
+        Object o = {-1, -1, {0, 0, 0, 0}, 0.0f, false};
+        double image = -1, category = -1, score = 0;
+        bool r = json.object([&](const std::string& k) {
+            if (k == "image_id") return json.number(image);
+            if (k == "category_id") return json.number(category);
+            if (k == "score") return json.number(score);
+            if (k == "bbox") return json.box(o.box);
+            return json.skip();
+        });
+        o.image = (int)image;
+        o.category = (int)category;
+        o.score = (float)score;
+        dets.push_back(o);
+        return r;
+    });
+    return ok && json.ok();
+}
+
+inline bool save_detections(const std::string& path, const std::vector<Object>& dets) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "[");
+    for (size_t i = 0; i < dets.size(); i++) {
+        const Object& d = dets[i];
+        fprintf(f, "%s\n{\"image_id\": %d, \"category_id\": %d, \"bbox\": [%.2f, %.2f, %.2f, %.2f], \"score\": %.5f}",
+                i ? "," : "", d.image, d.category, d.box.x, d.box.y, d.box.w, d.box.h, d.score);
+    }
+    fprintf(f, "\n]\n");
+    return fclose(f) == 0;
+}
+
+struct ClassResult {
+    int category;
+    std::string name;
+    int objects;        // ground truth boxes that are not crowd regions
+    int detections;
+    double ap50;        // -1 without ground truth
+    double ap;          // over IoU 0.5:0.05:0.95
+};
+
+struct Result {
+    std::vector<ClassResult> classes;
+    double map50;
+    double map;
+};
+
+static const int kThresholds = 10;      // IoU 0.5, 0.55 ... 0.95
+static const int kRecallPoints = 101;
+
+// pycocotools' bbox IoU: a crowd region is covered by the part of the detection inside it
+inline double iou(const Box& d, const Box& g, bool crowd) {
+    double w = std::min(d.x + d.w, g.x + g.w) - std::max(d.x, g.x);
+    double h = std::min(d.y + d.h, g.y + g.h) - std::max(d.y, g.y);
+    if (w <= 0 || h <= 0) return 0;
+    double inter = w * h;
+    double u = crowd ? (double)d.w * d.h : (double)d.w * d.h + (double)g.w * g.h - inter;
+    return u > 0 ? inter / u : 0;
+}
+
+// AP of one class over all images. dets and gts are its boxes, grouped by image.
+inline void evaluate_class(std::vector<const Object*>& dets, std::vector<const Object*>& gts, int max_dets, double ap[kThresholds], int& objects) {
+    auto by_image = [](const Object* a, const Object* b) { return a->image < b->image; };
+    std::stable_sort(gts.begin(), gts.end(), by_image);
+    std::stable_sort(dets.begin(), dets.end(), [](const Object* a, const Object* b) {
+        return a->image != b->image ? a->image < b->image : a->score > b->score;
+    });
+    objects = 0;
+    for (auto g : gts) objects += !g->crowd;
+
+    // every kept detection: its score, and per threshold whether it matched and whether it is ignored
+    struct Scored {
+        float score;
+        unsigned short matched;
+        unsigned short ignored;
+    };
+    std::vector<Scored> scored;
+    scored.reserve(dets.size());
+    std::vector<const Object*> g_img;
+    std::vector<double> ious;
+    size_t d0 = 0, g0 = 0;
+    while (d0 < dets.size()) {
+        int image = dets[d0]->image;
+        size_t d1 = d0;
+        while (d1 < dets.size() && dets[d1]->image == image) d1++;
+        while (g0 < gts.size() && gts[g0]->image < image) g0++;
+        g_img.clear();
+        for (size_t g = g0; g < gts.size() && gts[g]->image == image; g++) g_img.push_back(gts[g]);
+        // crowd regions last, a detection only falls back to one without a regular match
+        std::stable_sort(g_img.begin(), g_img.end(), [](const Object* a, const Object* b) { return a->crowd < b->crowd; });
+        size_t nd = std::min(d1 - d0, (size_t)max_dets), ng = g_img.size();
+        ious.resize(nd * ng);
+        for (size_t d = 0; d < nd; d++)
+            for (size_t g = 0; g < ng; g++)
+                ious[d * ng + g] = iou(dets[d0 + d]->box, g_img[g]->box, g_img[g]->crowd);
+        std::vector<unsigned short> taken(ng, 0);     // bit t: matched at threshold t
+        for (size_t d = 0; d < nd; d++) {
+            Scored s = {dets[d0 + d]->score, 0, 0};
+            for (int t = 0; t < kThresholds; t++) {
+                double best = std::min(0.5 + 0.05 * t, 1 - 1e-10);
+                int m = -1;
+                for (size_t g = 0; g < ng; g++) {
+                    if ((taken[g] >> t & 1) && !g_img[g]->crowd) continue;
+                    if (m >= 0 && !g_img[m]->crowd && g_img[g]->crowd) break;
+                    if (ious[d * ng + g] < best) continue;
+                    best = ious[d * ng + g];
+                    m = (int)g;
+                }
+                if (m < 0) continue;
+                s.matched |= 1 << t;
+                if (g_img[m]->crowd) s.ignored |= 1 << t;
+                taken[m] |= 1 << t;
+            }
+            scored.push_back(s);
+        }
+        d0 = d1;
+    }
+
+    for (int t = 0; t < kThresholds; t++) ap[t] = -1;
+    if (objects == 0) return;
+    std::stable_sort(scored.begin(), scored.end(), [](const Scored& a, const Scored& b) { return a.score > b.score; });
+    std::vector<double> precision, recall;
+    for (int t = 0; t < kThresholds; t++) {
+        precision.clear();
+        recall.clear();
+        double tp = 0, fp = 0;
+        for (auto& s : scored) {
+            if (s.ignored >> t & 1) continue;
+            if (s.matched >> t & 1) tp++;
+            else fp++;
+            recall.push_back(tp / objects);
+            precision.push_back(tp / (tp + fp + 2.2204460492503131e-16));
+        }
+        // the precision envelope, then its value at each recall point
+        for (size_t i = precision.size(); i-- > 1;)
+            precision[i - 1] = std::max(precision[i - 1], precision[i]);
+        double sum = 0;
+        for (int r = 0; r < kRecallPoints; r++) {
+            size_t i = std::lower_bound(recall.begin(), recall.end(), r / (kRecallPoints - 1.0)) - recall.begin();
+            if (i < precision.size()) sum += precision[i];
+        }
+        ap[t] = sum / kRecallPoints;
+    }
+}
+
+// AP of every category of the dataset on a task of the pool
+inline Result evaluate(const Dataset& data, const std::vector<Object>& dets, TaskPool& pool, int max_dets = 100) {
+    std::map<int, int> index;
+    for (size_t c = 0; c < data.categories.size(); c++) index[data.categories[c].id] = (int)c;
+    int n = (int)data.categories.size();
+    std::unordered_set<int> images;
+    for (auto& img : data.images) images.insert(img.id);
+    std::vector<std::vector<const Object*>> c_dets(n), c_gts(n);
+    for (auto& o : data.objects)
+        if (index.count(o.category)) c_gts[index[o.category]].push_back(&o);
+    // like pycocotools, only the images of the dataset count
+    for (auto& d : dets)
+        if (index.count(d.category) && images.count(d.image)) c_dets[index[d.category]].push_back(&d);
+
+    Result result;
+    result.classes.resize(n);
+    pool.for_each(n, [&](int c) {
+        double ap[kThresholds];
+        ClassResult& r = result.classes[c];
+        r.category = data.categories[c].id;
+        r.name = data.categories[c].name;
+        r.detections = (int)c_dets[c].size();
+        evaluate_class(c_dets[c], c_gts[c], max_dets, ap, r.objects);
+        r.ap50 = ap[0];
+        r.ap = -1;
+        if (ap[0] < 0) return;
+        r.ap = 0;
+        for (int t = 0; t < kThresholds; t++) r.ap += ap[t] / kThresholds;
+    });
+    int counted = 0;
+    result.map50 = result.map = 0;
+    for (auto& r : result.classes) {
+        if (r.ap50 < 0) continue;
+        counted++;
+        result.map50 += r.ap50;
+        result.map += r.ap;
+    }
+    if (counted) {
+        result.map50 /= counted;
+        result.map /= counted;
+    } else {
+        result.map50 = result.map = -1;
+    }
+    return result;
+}
+
+}  // namespace evaluate
+
+#endif  // YOLOV5_EVALUATE_H_
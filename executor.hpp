@@ -0,0 +1,241 @@
+#ifndef YOLOV5_EXECUTOR_H_
+#define YOLOV5_EXECUTOR_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "classfilter.hpp"
+#include "membudget.hpp"
+#include "placement.hpp"
+#include "trace.hpp"
+#include "yololayer.h"
+
+// one frame on its way through the executor
+struct InferJob {
+    int source;
+    uint64_t seq;       // frame number within the source
+    cv::Mat frame;
+    std::shared_ptr<const classfilter::Filter> classes;  // the classes the source keeps, null for all
+    std::vector<Yolo::Detection> dets;
+};
+
+// what a worker runs batches on. The executor gives every worker its own
+// backend, so a backend needs no locking (an execution context with its own
+// stream and buffers, or a mock).
+class InferBackend {
+public:
+    virtual ~InferBackend() {}
+
+    // called once on the worker thread before the first batch
+    virtual void start() {}
+
+    // called after start(), runs whatever makes the first real batch as fast as the others
+    virtual void warm_up() {}
+
+    virtual int max_batch() const = 0;
+
+    // fills in the detections of every job of the batch
+    virtual void infer(std::vector<InferJob>& batch) = 0;
+};
+
+// stand-in for an engine: takes batch_ms + image_ms per image and tags every
+// job with its source and frame number, so that scheduling and reordering can
+// be exercised without a GPU. The box has the source as its class, so a class
+// filter of the source can drop it.
+class MockBackend : public InferBackend {
+public:
+    MockBackend(int max_batch, double batch_ms, double image_ms)
+        : max_batch_(max_batch), batch_ms_(batch_ms), image_ms_(image_ms) {}
+
+    int max_batch() const override { return max_batch_; }
+
+    void infer(std::vector<InferJob>& batch) override {
+        double ms = batch_ms_ + image_ms_ * batch.size();
+        std::this_thread::sleep_for(std::chrono::microseconds((long)(ms * 1000)));
+        for (auto& job : batch) {
+            Yolo::Detection det = {};
+            det.bbox[0] = (float)job.seq;
+            det.conf = 1.0f;
+            det.class_id = (float)job.source;
+            job.dets.assign(1, det);
+            if (job.classes && !job.classes->keeps(det)) job.dets.clear();
+        }
+    }
+
+private:
+    int max_batch_;
+    double batch_ms_;
+    double image_ms_;
+};
+
+// Runs frames of several sources on K workers. Workers pull up to
+// max_batch() jobs at a time from one shared queue, so a batch can mix
+// sources and K batches are in flight at once. Finished jobs are held back
+// per source until all earlier frames of that source are done, so next()
+// returns each source's frames in the order they were submitted. submit()
+// blocks while capacity jobs are queued, running or waiting to be collected.
+class InferExecutor {
+public:
+    InferExecutor(std::vector<std::unique_ptr<InferBackend>> workers, int num_sources, size_t capacity)
+        : backends_(std::move(workers))
+        , capacity_(capacity > 0 ? capacity : 1)
+        , outstanding_(0)
+        , closed_(false)
+        , busy_ns_(0)
+        , last_busy_ns_(0)
+        , last_util_(std::chrono::steady_clock::now())
+        , submitted_(num_sources, 0)
+        , collected_(num_sources, 0)
+        , done_(num_sources)
+    {
+        for (size_t k = 0; k < backends_.size(); k++)
+            threads_.emplace_back(&InferExecutor::run, this, backends_[k].get(), (int)k);
+    }
+
+    ~InferExecutor() {
+        close();
+        for (auto& t : threads_) t.join();
+    }
+
+    int workers() const { return (int)backends_.size(); }
+
+    // lowers or raises how many jobs can be outstanding, submit() waits until it is below again
+    void set_capacity(size_t capacity) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        capacity_ = capacity > 0 ? capacity : 1;
+        space_.notify_all();
+    }
+
+    // fraction of the time the workers spent inferring since the previous call
+    double utilization() {
+        auto now = std::chrono::steady_clock::now();
+        int64_t busy = busy_ns_.load();
+        double wall = std::chrono::duration<double, std::nano>(now - last_util_).count() * backends_.size();
+        double util = wall > 0 ? (busy - last_busy_ns_) / wall : 0;
+        last_busy_ns_ = busy;
+        last_util_ = now;
+        return util;
+    }
+
+    // queues a frame of a source, false once the executor is closed
+    bool submit(int source, const cv::Mat& frame, std::shared_ptr<const classfilter::Filter> classes = nullptr) {
+        std::unique_lock<std::mutex> lk(mutex_);
+        space_.wait(lk, [&] { return closed_ || outstanding_ < capacity_; });
+        if (closed_) return false;
+        InferJob job;
+        job.source = source;
+        job.seq = submitted_[source]++;
+        job.frame = frame;
+        job.classes = std::move(classes);
+        membudget::budget().add(membudget::kFrames, frame.total() * frame.elemSize());
+        queue_.push_back(std::move(job));
+        outstanding_++;
+        work_.notify_one();
+        return true;
+    }
+
+    // next result of a source in submission order, blocks until it is done.
+    // false once the executor is closed and the source has nothing left.
+    bool next(int source, InferJob& job) {
+        std::unique_lock<std::mutex> lk(mutex_);
+        auto& pending = done_[source];
+        done_cv_.wait(lk, [&] {
+            return (!pending.empty() && pending.begin()->first == collected_[source]) ||
+                   (closed_ && collected_[source] == submitted_[source]);
+        });
+        return take(source, job);
+    }
+
+    // the next result of a source if it is done already, without waiting
+    bool try_next(int source, InferJob& job) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return take(source, job);
+    }
+
+    // stops accepting frames, the workers finish what is queued
+    void close() {
+        std::lock_guard<std::mutex> lk(mutex_);
+        closed_ = true;
+        work_.notify_all();
+        space_.notify_all();
+        done_cv_.notify_all();
+    }
+
+private:
+    // the next result of a source in order, if it is done. with mutex_ held
+    bool take(int source, InferJob& job) {
+        auto& pending = done_[source];
+        if (pending.empty() || pending.begin()->first != collected_[source]) return false;
+        job = std::move(pending.begin()->second);
+        pending.erase(pending.begin());
+        membudget::budget().add(membudget::kFrames, -(int64_t)(job.frame.total() * job.frame.elemSize()));
+        collected_[source]++;
+        outstanding_--;
+        space_.notify_one();
+        return true;
+    }
+
+    void run(InferBackend* backend, int index) {
+        trace::tracer().set_thread_name("infer worker " + std::to_string(index));
+        placement::placement().pin(placement::kInfer, index);
+        backend->start();
+        backend->warm_up();
+        std::vector<InferJob> batch;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lk(mutex_);
+                work_.wait(lk, [&] { return closed_ || !queue_.empty(); });
+                if (queue_.empty()) return;  // closed and drained
+                while (!queue_.empty() && (int)batch.size() < backend->max_batch()) {
+                    batch.push_back(std::move(queue_.front()));
+                    queue_.pop_front();
+                }
+            }
+            auto t0 = std::chrono::steady_clock::now();
+            {
+                // a batch of one frame is traced as that frame
+                bool single = batch.size() == 1;
+                trace::Span span("batch", single ? batch[0].source : -1, single ? (int64_t)batch[0].seq : -1);
+                backend->infer(batch);
+            }
+            busy_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+            {
+                std::lock_guard<std::mutex> lk(mutex_);
+                for (auto& job : batch) {
+                    uint64_t seq = job.seq;
+                    done_[job.source].emplace(seq, std::move(job));
+                }
+            }
+            // consumers of different sources wait on the same condition
+            done_cv_.notify_all();
+            batch.clear();
+        }
+    }
+
+    std::vector<std::unique_ptr<InferBackend>> backends_;
+    std::vector<std::thread> threads_;
+    size_t capacity_;
+    size_t outstanding_;
+    bool closed_;
+    std::atomic<int64_t> busy_ns_;
+    int64_t last_busy_ns_;
+    std::chrono::steady_clock::time_point last_util_;
+    std::mutex mutex_;
+    std::condition_variable work_;      // queue_ got a job or closed_
+    std::condition_variable space_;     // outstanding_ went down
+    std::condition_variable done_cv_;   // a job finished
+    std::deque<InferJob> queue_;
+    std::vector<uint64_t> submitted_;
+    std::vector<uint64_t> collected_;
+    std::vector<std::map<uint64_t, InferJob>> done_;
+};
+
+#endif  // YOLOV5_EXECUTOR_H_
@@ -18,6 +18,7 @@
 #define TENSORRT_LOGGING_H
 
 #include "NvInferRuntimeCommon.h"
+#include "async_logger.hpp"
 #include <cassert>
 #include <ctime>
 #include <iomanip>
@@ -236,9 +237,14 @@ public:
     //! Note samples should not be calling this function directly; it will eventually go away once we eliminate the
     //! inheritance from nvinfer1::ILogger
     //!
+    //! Messages go through the asynchronous logger (see async_logger.hpp), so TensorRT never waits on the terminal.
+    //!
     void log(Severity severity, const char* msg) override
     {
-        LogStreamConsumer(mReportableSeverity, severity) << "[TRT] " << std::string(msg) << std::endl;
+        if (severity > mReportableSeverity)
+            return;
+        static alog::Site site("[TRT] {}", __FILE__, __LINE__);
+        alog::logger().write(static_cast<alog::Severity>(severity), site, msg);
     }
 
     //!
@@ -0,0 +1,152 @@
+#ifndef YOLOV5_MEMBUDGET_H_
+#define YOLOV5_MEMBUDGET_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include "async_logger.hpp"
+
+// Accounts the memory the pipeline holds per subsystem against one global
+// budget. Each holder charges what it keeps (a frame in a passing slot or in
+// the executor, a pre-roll, an open encoder, inference buffers). The budget
+// does not allocate anything itself. The pipeline checks level() and applies
+// the policies in order as usage grows: shallower queues, frames scaled down
+// right after decoding, and no new sources.
+namespace membudget {
+
+enum Subsystem { kFrames = 0, kPreroll, kEncoders, kInference, kSubsystems };
+
+// rough memory of an open video encoder, in frames of its size
+static const int kEncoderFrames = 4;
+
+enum Level {
+    kNormal = 0,
+    kShrinkQueues,      // from 70% of the budget
+    kReduceResolution,  // from 85%
+    kRefuseSources,     // from 95%
+};
+
+inline const char* subsystem_name(int s) {
+    static const char* names[] = {"frames", "preroll", "encoders", "inference"};
+    return names[s];
+}
+
+inline const char* level_name(Level l) {
+    static const char* names[] = {"normal", "shrink_queues", "reduce_resolution", "refuse_sources"};
+    return names[l];
+}
+
+class Budget {
+public:
+    Budget() : limit_(0), level_(kNormal) {
+        for (auto& u : used_) u.store(0);
+    }
+
+    // 0 means no budget, the usage is still accounted
+    void set_limit(int64_t bytes) {
+        limit_.store(bytes);
+        update();
+    }
+
+    int64_t limit() const { return limit_.load(); }
+
+    void add(Subsystem s, int64_t bytes) {
+        used_[s] += bytes;
+        update();
+    }
+
+    int64_t used(Subsystem s) const { return used_[s].load(); }
+
+    int64_t total() const {
+        int64_t t = 0;
+        for (auto& u : used_) t += u.load();
+        return t;
+    }
+
+    Level level() const { return (Level)level_.load(); }
+
+    // one line for the log
+    std::string summary() const {
+        std::ostringstream ss;
+        ss << "memory " << total() / (1 << 20) << "MB";
+        if (limit()) ss << " of " << limit() / (1 << 20) << "MB";
+        ss << " (" << level_name(level()) << "):";
+        for (int s = 0; s < kSubsystems; s++) ss << " " << subsystem_name(s) << " " << used_[s].load() / (1 << 20) << "MB";
+        return ss.str();
+    }
+
+    // Prometheus text format, for the node exporter textfile collector
+    std::string metrics() const {
+        std::ostringstream ss;
+        ss << "# TYPE yolov5_memory_bytes gauge\n";
+        for (int s = 0; s < kSubsystems; s++)
+            ss << "yolov5_memory_bytes{subsystem=\"" << subsystem_name(s) << "\"} " << used_[s].load() << "\n";
+        ss << "# TYPE yolov5_memory_budget_bytes gauge\nyolov5_memory_budget_bytes " << limit() << "\n";
+        ss << "# TYPE yolov5_memory_pressure_level gauge\nyolov5_memory_pressure_level " << (int)level() << "\n";
+        return ss.str();
+    }
+
+    // writes metrics() to path through a rename, so a collector never reads half a file
+    bool export_metrics(const std::string& path) const {
+        std::string tmp = path + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "w");
+        if (!f) return false;
+        std::string m = metrics();
+        bool ok = fwrite(m.data(), 1, m.size(), f) == m.size();
+        ok = fclose(f) == 0 && ok;
+        return ok && rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+private:
+    static Level level_for(int64_t used, int64_t limit) {
+        if (limit <= 0) return kNormal;
+        if (used >= limit * 95 / 100) return kRefuseSources;
+        if (used >= limit * 85 / 100) return kReduceResolution;
+        if (used >= limit * 70 / 100) return kShrinkQueues;
+        return kNormal;
+    }
+
+    // a level is left only 5% of the budget below where it was entered, so usage around a threshold does not flap
+    void update() {
+        int64_t limit = limit_.load(), t = total();
+        int old = level_.load();
+        int l = level_for(t, limit);
+        if (l < old) l = std::min(old, (int)level_for(t + limit * 5 / 100, limit));
+        if (l != old && level_.compare_exchange_strong(old, l))
+            ALOG_WARN("memory pressure {} -> {}: {}", level_name((Level)old), level_name((Level)l), summary());
+    }
+
+    std::atomic<int64_t> limit_;
+    std::atomic<int64_t> used_[kSubsystems];
+    std::atomic<int> level_;
+};
+
+inline Budget& budget() {
+    static Budget instance;
+    return instance;
+}
+
+// what one holder has charged, released with it. set() replaces the amount.
+class Charge {
+public:
+    explicit Charge(Subsystem s, int64_t bytes = 0) : s_(s), bytes_(0) { set(bytes); }
+    ~Charge() { set(0); }
+    Charge(const Charge&) = delete;
+    Charge& operator=(const Charge&) = delete;
+
+    void set(int64_t bytes) {
+        if (bytes != bytes_) budget().add(s_, bytes - bytes_);
+        bytes_ = bytes;
+    }
+
+private:
+    Subsystem s_;
+    int64_t bytes_;
+};
+
+}  // namespace membudget
+
+#endif  // YOLOV5_MEMBUDGET_H_
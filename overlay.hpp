@@ -0,0 +1,86 @@
+#ifndef YOLOV5_OVERLAY_H_
+#define YOLOV5_OVERLAY_H_
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "yololayer.h"
+
+// Draws the detections of a frame on its mosaic tile. The frame is scaled into
+// the tile first and the boxes are drawn in tile coordinates, so the cost no
+// longer grows with the camera resolution. Class labels are rendered once into
+// an atlas and copied through a mask instead of rasterizing text per box.
+namespace overlay {
+
+// a box of the input_w x input_h letterboxed network input in the coordinates of a cols x rows frame,
+// the same mapping as get_rect() without rounding
+inline cv::Rect2f map_box(const float bbox[4], int cols, int rows, int input_w, int input_h) {
+    float r_w = input_w / (cols * 1.0f);
+    float r_h = input_h / (rows * 1.0f);
+    float l = bbox[0] - bbox[2] / 2.f, t = bbox[1] - bbox[3] / 2.f;
+    float r, pad_x = 0, pad_y = 0;
+    if (r_h > r_w) {
+        r = r_w;
+        pad_y = (input_h - r_w * rows) / 2;
+    } else {
+        r = r_h;
+        pad_x = (input_w - r_h * cols) / 2;
+    }
+    return cv::Rect2f((l - pad_x) / r, (t - pad_y) / r, bbox[2] / r, bbox[3] / r);
+}
+
+class Renderer {
+public:
+    explicit Renderer(int classes = Yolo::CLASS_NUM, double font_scale = 0.8) {
+        // all labels side by side in one image, white on black, the mask marks the text pixels
+        std::vector<cv::Size> sizes;
+        std::vector<int> ascent;
+        int width = 0, height = 0;
+        for (int c = 0; c < classes; c++) {
+            int baseline = 0;
+            cv::Size s = cv::getTextSize(std::to_string(c), cv::FONT_HERSHEY_PLAIN, font_scale, 1, &baseline);
+            ascent.push_back(s.height);
+            s.height += baseline;
+            sizes.push_back(s);
+            width += s.width;
+            height = std::max(height, s.height);
+        }
+        atlas_ = cv::Mat(std::max(height, 1), std::max(width, 1), CV_8UC3, cv::Scalar(0, 0, 0));
+        int x = 0;
+        for (int c = 0; c < classes; c++) {
+            cv::putText(atlas_, std::to_string(c), cv::Point(x, ascent[c]), cv::FONT_HERSHEY_PLAIN, font_scale, cv::Scalar(0xFF, 0xFF, 0xFF), 1);
+            labels_.push_back(cv::Rect(x, 0, sizes[c].width, sizes[c].height));
+            x += sizes[c].width;
+        }
+        cv::cvtColor(atlas_, mask_, cv::COLOR_BGR2GRAY);
+    }
+
+    // scales frame into tile (which keeps its size, e.g. an ROI of the mosaic) and draws the detections on it
+    void render(const cv::Mat& frame, const std::vector<Yolo::Detection>& dets, int input_w, int input_h, cv::Mat& tile) const {
+        cv::resize(frame, tile, tile.size(), 0, 0, cv::INTER_AREA);
+        float sx = tile.cols / (float)frame.cols, sy = tile.rows / (float)frame.rows;
+        cv::Rect bounds(0, 0, tile.cols, tile.rows);
+        for (auto& det : dets) {
+            cv::Rect2f b = map_box(det.bbox, frame.cols, frame.rows, input_w, input_h);
+            cv::Rect r(cvRound(b.x * sx), cvRound(b.y * sy), cvRound(b.width * sx), cvRound(b.height * sy));
+            cv::rectangle(tile, r, cv::Scalar(0x27, 0xC1, 0x36), 1);
+            int c = (int)det.class_id;
+            if (c < 0 || c >= (int)labels_.size()) continue;
+            // the label sits on top of the box, clipped to the tile
+            const cv::Rect& cell = labels_[c];
+            cv::Rect dst = cv::Rect(r.x, r.y - cell.height, cell.width, cell.height) & bounds;
+            if (dst.empty()) continue;
+            cv::Rect src(cell.x + dst.x - r.x, dst.y - (r.y - cell.height), dst.width, dst.height);
+            atlas_(src).copyTo(tile(dst), mask_(src));
+        }
+    }
+
+private:
+    cv::Mat atlas_;
+    cv::Mat mask_;
+    std::vector<cv::Rect> labels_;
+};
+
+}  // namespace overlay
+
+#endif  // YOLOV5_OVERLAY_H_
@@ -1,3 +1,6 @@
+#ifndef YOLOV5_PASSING_ONE_OBJ_H_
+#define YOLOV5_PASSING_ONE_OBJ_H_
+
 #include <atomic>
 #include <chrono>
 #include <thread>
@@ -31,6 +34,12 @@ public:
         return (a_ptr.load() != NULL);
     }
 
+    bool is_sync() const {
+        return sync;
+    }
+
     passing_one_obj(bool _sync) : sync(_sync), a_ptr(NULL)
     {}
-};
\ No newline at end of file
+};
+
+#endif  // YOLOV5_PASSING_ONE_OBJ_H_
@@ -0,0 +1,248 @@
+#ifndef YOLOV5_PASSTHROUGH_H_
+#define YOLOV5_PASSTHROUGH_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "async_logger.hpp"
+#include "overlay.hpp"
+#include "placement.hpp"
+#include "trace.hpp"
+#include "utils.h"
+#include "yololayer.h"
+
+// Recording without re-encoding. A camera stream is copied to disk as the
+// compressed packets it arrives in (<name>.h264 or .h265, an elementary
+// stream with the arrival time of every packet in <name>.idx). A video file is
+// kept as it is. The detections go to a <name>.det sidecar and are only drawn
+// when the recording is played back with -play.
+//
+// OpenCV hands out either decoded frames or raw packets per capture, so a
+// camera can only be copied by reading it twice: the inference reader decodes
+// one RTSP session and the recorder copies the packets of a second one. That
+// doubles the bandwidth and the connections to the camera, so it is only done
+// with PASSTHROUGH_CAMERAS (yolov5.cpp). The two sessions share no timestamps,
+// so camera detections are matched to packets by arrival time only. That is
+// approximate: a box can be drawn a frame or two early or late, more so under
+// network jitter. Files are matched exactly by frame number.
+//
+// Sidecar lines use the DET format of the workers; the frame field is the
+// frame number for files and the arrival time in us for cameras:
+//   # yolov5 detections key=<frame|wall_us> input=<W>x<H>
+//   DET 0 <key> <n> [<class> <conf> <cx> <cy> <w> <h>]...      boxes in network input coordinates
+
+inline int64_t wall_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// one line per frame: DET <source> <frame> <n> followed by class conf x y w h of every box
+inline std::string format_detections(int source, uint64_t frame, const std::vector<Yolo::Detection>& dets) {
+    std::ostringstream ss;
+    ss << "DET " << source << " " << frame << " " << dets.size();
+    ss.setf(std::ios::fixed);
+    ss.precision(1);
+    for (auto& d : dets)
+        ss << " " << (int)d.class_id << " " << std::setprecision(3) << d.conf << std::setprecision(1)
+           << " " << d.bbox[0] << " " << d.bbox[1] << " " << d.bbox[2] << " " << d.bbox[3];
+    return ss.str();
+}
+
+// the reverse of format_detections, false if the line is not a DET line
+inline bool parse_detections(const std::string& line, int& source, int64_t& frame, std::vector<Yolo::Detection>& dets) {
+    std::istringstream ss(line);
+    std::string cmd;
+    int n = 0;
+    if (!(ss >> cmd >> source >> frame >> n) || cmd != "DET") return false;
+    dets.resize(n);
+    for (auto& d : dets)
+        if (!(ss >> d.class_id >> d.conf >> d.bbox[0] >> d.bbox[1] >> d.bbox[2] >> d.bbox[3])) return false;
+    return true;
+}
+
+// arrival time of the frames a reader handed out, looked up by their pixel buffer
+// since cv::Mat carries no timestamp through the passing and the executor
+class FrameClock {
+public:
+    void stamp(const cv::Mat& frame, int64_t us) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        entries_.push_back(std::make_pair(frame.data, us));
+        if (entries_.size() > 16) entries_.pop_front();
+    }
+
+    // -1 if the frame is unknown. a freed buffer can come back, so the newest entry wins
+    int64_t take(const cv::Mat& frame) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        for (auto it = entries_.rbegin(); it != entries_.rend(); ++it)
+            if (it->first == frame.data) return it->second;
+        return -1;
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<std::pair<const uchar*, int64_t>> entries_;
+};
+
+class DetectionSidecar {
+public:
+    DetectionSidecar(const std::string& path, bool wall_clock, int input_w, int input_h) : path_(path), lines_(0) {
+        f_ = fopen(path.c_str(), "w");
+        if (!f_) {
+            ALOG_ERROR("cannot write detections to {}", path);
+            return;
+        }
+        fprintf(f_, "# yolov5 detections key=%s input=%dx%d\n", wall_clock ? "wall_us" : "frame", input_w, input_h);
+    }
+
+    ~DetectionSidecar() {
+        if (f_) fclose(f_);
+    }
+
+    void write(int64_t key, const std::vector<Yolo::Detection>& dets) {
+        if (!f_ || key < 0) return;
+        fprintf(f_, "%s\n", format_detections(0, key, dets).c_str());
+        if (++lines_ % 250 == 0) fflush(f_);
+    }
+
+private:
+    std::string path_;
+    FILE* f_;
+    uint64_t lines_;
+};
+
+// copies the compressed packets of a stream to <prefix>.<codec> on its own connection, starting at a key frame
+class StreamRecorder {
+public:
+    StreamRecorder(const std::string& url, const std::string& prefix) : url_(url), prefix_(prefix), stop_(false) {
+        thread_ = std::thread(&StreamRecorder::run, this);
+    }
+
+    ~StreamRecorder() {
+        stop_.store(true);
+        thread_.join();
+    }
+
+private:
+    static std::string extension(int fourcc) {
+        std::string tag;
+        for (int i = 0; i < 4; i++) tag += (char)((fourcc >> (8 * i)) & 0xFF);
+        if (tag == "avc1" || tag == "H264" || tag == "h264") return ".h264";
+        if (tag == "hev1" || tag == "hvc1" || tag == "HEVC" || tag == "H265" || tag == "h265") return ".h265";
+        return ".es";
+    }
+
+    void run() {
+        trace::tracer().set_thread_name("recorder " + url_);
+        placement::placement().pin(placement::kEncode);
+        cv::VideoCapture cap(url_, cv::CAP_FFMPEG);
+        // raw packets instead of decoded frames, h264/h265 come out in Annex B with the parameter sets at key frames
+        if (!cap.isOpened() || !cap.set(cv::CAP_PROP_FORMAT, -1)) {
+            ALOG_ERROR("recorder: cannot read the packets of {}", url_);
+            return;
+        }
+        std::string path = prefix_ + extension((int)cap.get(cv::CAP_PROP_FOURCC));
+        FILE* out = fopen(path.c_str(), "wb");
+        FILE* idx = fopen((prefix_ + ".idx").c_str(), "w");
+        if (!out || !idx) {
+            ALOG_ERROR("recorder: cannot write {}", path);
+            if (out) fclose(out);
+            if (idx) fclose(idx);
+            return;
+        }
+        ALOG_INFO("recorder: {} -> {}", url_, path);
+        int64_t cpu0 = thread_cpu_ns();
+        uint64_t packets = 0, bytes = 0;
+        cv::Mat packet;
+        while (!stop_.load() && cap.grab()) {
+            int64_t t = wall_us();
+            // CAP_PROP_LRF_HAS_KEY_FRAME needs OpenCV 4.5 or newer
+            bool key = cap.get(cv::CAP_PROP_LRF_HAS_KEY_FRAME) != 0;
+            if ((!packets && !key) || !cap.retrieve(packet) || packet.empty()) continue;
+            size_t n = packet.total() * packet.elemSize();
+            trace::Span span("write packet", -1, packets);
+            fwrite(packet.data, 1, n, out);
+            fprintf(idx, "%llu %lld %llu %zu %d\n", (unsigned long long)packets, (long long)t, (unsigned long long)bytes, n, key ? 1 : 0);
+            packets++;
+            bytes += n;
+        }
+        fclose(out);
+        fclose(idx);
+        ALOG_INFO("recorder: {} packets, {} bytes of {} written in {}ms of CPU", packets, bytes, url_, (thread_cpu_ns() - cpu0) / 1e6);
+    }
+
+    std::string url_;
+    std::string prefix_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+};
+
+// plays a recording with the detections of its sidecar drawn in, until it ends or Esc
+inline int play_recording(const std::string& path, cv::Size show) {
+    std::string prefix = path.substr(0, path.find_last_of('.'));
+    std::ifstream det(prefix + ".det");
+    std::string line;
+    int input_w = 0, input_h = 0;
+    char key[16] = {0};
+    if (!std::getline(det, line) || sscanf(line.c_str(), "# yolov5 detections key=%15s input=%dx%d", key, &input_w, &input_h) != 3) {
+        std::cerr << "no detections for " << path << " in " << prefix << ".det" << std::endl;
+        return -1;
+    }
+    bool wall_clock = std::string(key) == "wall_us";
+    std::map<int64_t, std::vector<Yolo::Detection>> frames;
+    while (std::getline(det, line)) {
+        int source;
+        int64_t k;
+        std::vector<Yolo::Detection> dets;
+        if (parse_detections(line, source, k, dets)) frames[k] = dets;
+    }
+    // the arrival time of every packet, one packet per frame
+    std::vector<int64_t> arrival;
+    if (wall_clock) {
+        std::ifstream idx(prefix + ".idx");
+        while (std::getline(idx, line)) {
+            unsigned long long n;
+            long long t;
+            if (sscanf(line.c_str(), "%llu %lld", &n, &t) == 2) arrival.push_back(t);
+        }
+    }
+
+    cv::VideoCapture cap(path);
+    if (!cap.isOpened()) {
+        std::cerr << "cannot open " << path << std::endl;
+        return -1;
+    }
+    double fps = cap.get(cv::CAP_PROP_FPS);
+    int delay = fps > 0 ? (int)(1000 / fps) : 40;
+    // a camera frame that was not inferred shows the boxes of the frame before, for up to this long. it also absorbs
+    // the arrival time difference of the two sessions, see the top of this file
+    const int64_t hold_us = 200000;
+    overlay::Renderer renderer;
+    cv::Mat frame, tile;
+    for (int64_t n = 0; cap.read(frame); n++) {
+        if (wall_clock && n >= (int64_t)arrival.size()) break;
+        int64_t k = wall_clock ? arrival[n] : n;
+        float r = std::min(show.width / (float)frame.cols, show.height / (float)frame.rows);
+        tile.create((int)(frame.rows * r), (int)(frame.cols * r), CV_8UC3);
+        auto it = frames.upper_bound(k);
+        static const std::vector<Yolo::Detection> none;
+        const std::vector<Yolo::Detection>* dets = &none;
+        if (it != frames.begin() && k - (--it)->first <= (wall_clock ? hold_us : 0)) dets = &it->second;
+        renderer.render(frame, *dets, input_w, input_h, tile);
+        cv::imshow(path, tile);
+        if (cv::waitKey(delay) == 27) break;
+    }
+    return 0;
+}
+
+#endif  // YOLOV5_PASSTHROUGH_H_
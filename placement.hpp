@@ -0,0 +1,304 @@
+#ifndef YOLOV5_PLACEMENT_H_
+#define YOLOV5_PLACEMENT_H_
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "async_logger.hpp"
+
+// Which cores the threads of the pipeline run on, and which NUMA node their
+// memory comes from (PLACEMENT in yolov5.cpp).
+//
+// Every thread pins itself once, when it starts, by its role. The driver
+// loop (main), the executor workers (infer) and the CPU pool threads (pool)
+// get a core each. Decoders (decode) and packet recorders (encode) share a
+// set of cores. With "auto" the plan comes from the topology in /sys: only
+// cores of one node are used, the node the GPU is attached to unless another
+// is given. Of those, the first hardware thread of every core is given out
+// before any second one, the fast cores of big.LITTLE or hybrid CPUs first.
+// Decoders and recorders share what is left. If too few cores are left, no thread gets a core of
+// its own and all threads only stay on the node. A spec like
+// "main=0 infer=1,2 pool=3-6 decode=8-15" places roles by hand, threads of
+// roles it leaves out run on all cores.
+//
+// On a machine with several nodes, the memory of a pinned thread comes from
+// the node of its cores. The thread that configures the placement and the
+// threads it starts allocate on the chosen node, so decoded frames are local
+// to the GPU's node.
+namespace placement {
+
+enum Role { kMain, kInfer, kPool, kDecode, kEncode, kRoles };
+
+static const char* const kRoleNames[kRoles] = {"main", "infer", "pool", "decode", "encode"};
+
+struct Cpu {
+    int id;
+    int core;       // core_id, hardware threads of a core share it
+    int package;
+    int node;
+    int capacity;   // cpu_capacity on big.LITTLE, else the maximum frequency, 0 if unknown
+    int thread;     // 0 for the first hardware thread of its core, 1 for the second...
+};
+
+inline int read_int(const std::string& path, int fallback) {
+    std::ifstream f(path);
+    int v;
+    return (f >> v) ? v : fallback;
+}
+
+// "0-3,8,10-11" as in /sys and taskset -c
+inline std::vector<int> parse_cpulist(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        int a, b;
+        if (sscanf(range.c_str(), "%d-%d", &a, &b) == 2) {
+            for (int c = a; c <= b; c++) cpus.push_back(c);
+        } else if (sscanf(range.c_str(), "%d", &a) == 1) {
+            cpus.push_back(a);
+        }
+    }
+    return cpus;
+}
+
+inline std::string format_cpulist(const std::vector<int>& cpus) {
+    std::string out;
+    for (size_t i = 0; i < cpus.size(); i++) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) j++;
+        if (!out.empty()) out += ",";
+        out += std::to_string(cpus[i]);
+        if (j > i) out += "-" + std::to_string(cpus[j]);
+        i = j;
+    }
+    return out.empty() ? "-" : out;
+}
+
+// the online cpus, with the node of each and in id order
+inline std::vector<Cpu> read_topology(const std::string& sys = "/sys/devices/system") {
+    std::string online;
+    std::ifstream f(sys + "/cpu/online");
+    std::getline(f, online);
+    std::vector<Cpu> cpus;
+    for (int id : parse_cpulist(online)) {
+        std::string dir = sys + "/cpu/cpu" + std::to_string(id);
+        Cpu c;
+        c.id = id;
+        c.core = read_int(dir + "/topology/core_id", id);
+        c.package = read_int(dir + "/topology/physical_package_id", 0);
+        c.node = 0;
+        c.capacity = read_int(dir + "/cpu_capacity", read_int(dir + "/cpufreq/cpuinfo_max_freq", 0));
+        c.thread = 0;
+        cpus.push_back(c);
+    }
+    if (DIR* d = opendir((sys + "/node").c_str())) {
+        while (dirent* e = readdir(d)) {
+            int node;
+            if (sscanf(e->d_name, "node%d", &node) != 1) continue;
+            std::ifstream l(sys + "/node/" + e->d_name + "/cpulist");
+            std::string list;
+            std::getline(l, list);
+            for (int id : parse_cpulist(list))
+                for (auto& c : cpus)
+                    if (c.id == id) c.node = node;
+        }
+        closedir(d);
+    }
+    for (size_t i = 0; i < cpus.size(); i++)
+        for (size_t j = 0; j < i; j++)
+            if (cpus[j].package == cpus[i].package && cpus[j].core == cpus[i].core) cpus[i].thread++;
+    return cpus;
+}
+
+// the NUMA node of the device-th NVIDIA GPU on the PCI bus, in bus order as with
+// CUDA_DEVICE_ORDER=PCI_BUS_ID. 0 for an integrated GPU (Jetson) or if unknown.
+inline int gpu_node(int device) {
+    std::vector<std::string> gpus;
+    const std::string bus = "/sys/bus/pci/devices/";
+    if (DIR* d = opendir(bus.c_str())) {
+        while (dirent* e = readdir(d)) {
+            if (e->d_name[0] == '.') continue;
+            std::string dev = bus + e->d_name;
+            std::ifstream vendor(dev + "/vendor"), cls(dev + "/class");
+            std::string v, c;
+            if ((vendor >> v) && (cls >> c) && v == "0x10de" && c.compare(0, 4, "0x03") == 0)
+                gpus.push_back(dev);
+        }
+        closedir(d);
+    }
+    std::sort(gpus.begin(), gpus.end());
+    if (device < 0 || device >= (int)gpus.size()) return 0;
+    return std::max(read_int(gpus[device] + "/numa_node", 0), 0);
+}
+
+class Placement {
+public:
+    Placement() : enabled_(false), dedicated_(true), node_(-1), nodes_(1) {
+        CPU_ZERO(&initial_);
+        sched_getaffinity(0, sizeof(initial_), &initial_);
+    }
+
+    // spec is "off", "auto" or role=cpulist pairs. node is the node to keep "auto" on, infer and
+    // pool the threads that get a core each. call it before the threads it places are started.
+    bool configure(const std::string& spec, int node, int infer_threads, int pool_threads) {
+        for (auto& r : cpus_) r.clear();
+        enabled_ = false;
+        dedicated_ = true;
+        topo_.clear();
+        for (auto& c : read_topology())
+            if (CPU_ISSET(c.id, &initial_)) topo_.push_back(c);
+        const std::vector<Cpu>& topo = topo_;
+        nodes_ = 1;
+        for (auto& c : topo) nodes_ = std::max(nodes_, c.node + 1);
+        node_ = node;
+        if (spec.empty() || spec == "off") return true;
+        if (spec == "auto") {
+            plan(topo, infer_threads, pool_threads);
+        } else {
+            std::stringstream ss(spec);
+            std::string item;
+            while (ss >> item) {
+                size_t eq = item.find('=');
+                int role = eq == std::string::npos ? kRoles : find_role(item.substr(0, eq));
+                if (role == kRoles) {
+                    ALOG_ERROR("placement: cannot parse {} in {}", item, spec);
+                    return false;
+                }
+                cpus_[role] = parse_cpulist(item.substr(eq + 1));
+            }
+            // memory from the node of the driver's core, or of the first core given
+            for (int r = 0; r < kRoles && node_ < 0; r++)
+                if (!cpus_[r].empty()) node_ = node_of(topo, cpus_[r][0]);
+        }
+        enabled_ = true;
+        if (node_ < 0) node_ = 0;
+        prefer_node(node_);
+        ALOG_INFO("placement: {}", summary());
+        return true;
+    }
+
+    bool enabled() const { return enabled_; }
+
+    // pins the calling thread to the cores of its role. main, infer and pool threads get
+    // core index % n of their role, decode and encode threads all cores of theirs, and
+    // so does every thread if there were too few cores for a core per thread.
+    void pin(Role role, int index = 0) {
+        if (!enabled_) return;
+        const std::vector<int>& cpus = cpus_[role];
+        if (cpus.empty()) {
+            // not placed, and not stuck on the core of the thread that started it either
+            unpin();
+            return;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        int first = cpus[0];
+        if (role == kDecode || role == kEncode || !dedicated_) {
+            for (int c : cpus) CPU_SET(c, &set);
+        } else {
+            first = cpus[index % cpus.size()];
+            CPU_SET(first, &set);
+        }
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            ALOG_EVERY_MS(alog::Severity::kWARNING, 60000, "placement: cannot pin a {} thread to {}", kRoleNames[role], format_cpulist(cpus));
+        int node = node_of(topo_, first);
+        prefer_node(node >= 0 ? node : node_);
+    }
+
+    // back to the cores and memory policy the process started with
+    void unpin() {
+        pthread_setaffinity_np(pthread_self(), sizeof(initial_), &initial_);
+        if (nodes_ > 1) syscall(SYS_set_mempolicy, 0 /* MPOL_DEFAULT */, nullptr, 0);
+    }
+
+    std::string summary() const {
+        if (!enabled_) return "off";
+        std::string out = dedicated_ ? "" : "too few cores for a core per thread, ";
+        for (int r = 0; r < kRoles; r++)
+            out += std::string(r ? ", " : "") + kRoleNames[r] + " " + format_cpulist(cpus_[r]);
+        return out + ", memory on node " + std::to_string(node_) + " of " + std::to_string(nodes_);
+    }
+
+private:
+    static int find_role(const std::string& name) {
+        for (int r = 0; r < kRoles; r++)
+            if (name == kRoleNames[r]) return r;
+        return kRoles;
+    }
+
+    static int node_of(const std::vector<Cpu>& topo, int id) {
+        for (auto& c : topo)
+            if (c.id == id) return c.node;
+        return -1;
+    }
+
+    void plan(const std::vector<Cpu>& topo, int infer_threads, int pool_threads) {
+        std::vector<Cpu> local;
+        for (auto& c : topo)
+            if (c.node == node_) local.push_back(c);
+        if (local.empty()) {
+            // no such node, or none of its cores is allowed: the first node that has one
+            node_ = topo.empty() ? 0 : topo[0].node;
+            for (auto& c : topo)
+                if (c.node == node_) local.push_back(c);
+        }
+        std::stable_sort(local.begin(), local.end(), [](const Cpu& a, const Cpu& b) {
+            return a.thread != b.thread ? a.thread < b.thread : a.capacity > b.capacity;
+        });
+        std::vector<int> all;
+        for (auto& c : local) all.push_back(c.id);
+        std::sort(all.begin(), all.end());
+        int dedicated = 1 + infer_threads + pool_threads;
+        if ((int)local.size() <= dedicated) {
+            // every thread only stays on the node
+            for (auto& r : cpus_) r = all;
+            dedicated_ = false;
+            return;
+        }
+        size_t next = 0;
+        cpus_[kMain].push_back(local[next++].id);
+        for (int i = 0; i < infer_threads; i++) cpus_[kInfer].push_back(local[next++].id);
+        for (int i = 0; i < pool_threads; i++) cpus_[kPool].push_back(local[next++].id);
+        std::vector<int> rest;
+        for (; next < local.size(); next++) rest.push_back(local[next].id);
+        std::sort(rest.begin(), rest.end());
+        cpus_[kDecode] = cpus_[kEncode] = rest;
+    }
+
+    // later allocations of the calling thread and of threads it starts come from node
+    void prefer_node(int node) {
+        if (nodes_ <= 1 || node < 0 || node >= 1024) return;
+        unsigned long mask[1024 / (8 * sizeof(unsigned long))] = {0};
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        // MPOL_PREFERRED falls back to other nodes when this one is full
+        syscall(SYS_set_mempolicy, 1 /* MPOL_PREFERRED */, mask, 1024 + 1);
+    }
+
+    bool enabled_;
+    bool dedicated_;    // main, infer and pool threads get a core each
+    int node_;
+    int nodes_;
+    cpu_set_t initial_;
+    std::vector<Cpu> topo_;     // the cores the process may run on
+    std::vector<int> cpus_[kRoles];
+};
+
+inline Placement& placement() {
+    static Placement instance;
+    return instance;
+}
+
+}  // namespace placement
+
+#endif  // YOLOV5_PLACEMENT_H_
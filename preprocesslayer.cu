@@ -0,0 +1,216 @@
+#include <assert.h>
+#include <string.h>
+#include <iostream>
+#include "preprocesslayer.h"
+#include "cuda_utils.h"
+
+namespace Tn
+{
+    template<typename T>
+    void write(char*& buffer, const T& val)
+    {
+        *reinterpret_cast<T*>(buffer) = val;
+        buffer += sizeof(T);
+    }
+
+    template<typename T>
+    void read(const char*& buffer, T& val)
+    {
+        val = *reinterpret_cast<const T*>(buffer);
+        buffer += sizeof(T);
+    }
+}
+
+namespace Yolo
+{
+    // one thread per pixel: swap BGR to RGB, scale to [0, 1] and scatter into the three planes
+    __global__ void Hwc2Chw(const uint8_t* src, float* dst, int pixels, int noElements)
+    {
+        int idx = threadIdx.x + blockDim.x * blockIdx.x;
+        if (idx >= noElements) return;
+
+        int bnIdx = idx / pixels;
+        int pix = idx - bnIdx * pixels;
+        const uint8_t* bgr = src + (size_t)idx * 3;
+        float* out = dst + (size_t)bnIdx * 3 * pixels + pix;
+        out[0] = bgr[2] / 255.0f;
+        out[pixels] = bgr[1] / 255.0f;
+        out[2 * pixels] = bgr[0] / 255.0f;
+    }
+
+    void hwc2chwGpu(const uint8_t* src, float* dst, int batchSize, int width, int height, cudaStream_t stream)
+    {
+        const int threadCount = 256;
+        int pixels = width * height;
+        int numElem = pixels * batchSize;
+        Hwc2Chw << < (numElem + threadCount - 1) / threadCount, threadCount, 0, stream >> > (src, dst, pixels, numElem);
+    }
+}
+
+namespace nvinfer1
+{
+    PreprocessPlugin::PreprocessPlugin(int netWidth, int netHeight)
+    {
+        mNetWidth = netWidth;
+        mNetHeight = netHeight;
+    }
+
+    // create the plugin at runtime from a byte stream
+    PreprocessPlugin::PreprocessPlugin(const void* data, size_t length)
+    {
+        using namespace Tn;
+        const char *d = reinterpret_cast<const char *>(data), *a = d;
+        read(d, mNetWidth);
+        read(d, mNetHeight);
+        assert(d == a + length);
+    }
+
+    void PreprocessPlugin::serialize(void* buffer) const
+    {
+        using namespace Tn;
+        char* d = static_cast<char*>(buffer), *a = d;
+        write(d, mNetWidth);
+        write(d, mNetHeight);
+        assert(d == a + getSerializationSize());
+    }
+
+    size_t PreprocessPlugin::getSerializationSize() const
+    {
+        return sizeof(mNetWidth) + sizeof(mNetHeight);
+    }
+
+    int PreprocessPlugin::initialize()
+    {
+        return 0;
+    }
+
+    Dims PreprocessPlugin::getOutputDimensions(int index, const Dims* inputs, int nbInputDims)
+    {
+        return Dims3(3, mNetHeight, mNetWidth);
+    }
+
+    // Set plugin namespace
+    void PreprocessPlugin::setPluginNamespace(const char* pluginNamespace)
+    {
+        mPluginNamespace = pluginNamespace;
+    }
+
+    const char* PreprocessPlugin::getPluginNamespace() const
+    {
+        return mPluginNamespace;
+    }
+
+    // Return the DataType of the plugin output at the requested index
+    DataType PreprocessPlugin::getOutputDataType(int index, const nvinfer1::DataType* inputTypes, int nbInputs) const
+    {
+        return DataType::kFLOAT;
+    }
+
+    // Return true if output tensor is broadcast across a batch.
+    bool PreprocessPlugin::isOutputBroadcastAcrossBatch(int outputIndex, const bool* inputIsBroadcasted, int nbInputs) const
+    {
+        return false;
+    }
+
+    // Return true if plugin can use input that is broadcast across batch without replication.
+    bool PreprocessPlugin::canBroadcastInputAcrossBatch(int inputIndex) const
+    {
+        return false;
+    }
+
+    void PreprocessPlugin::configurePlugin(const PluginTensorDesc* in, int nbInput, const PluginTensorDesc* out, int nbOutput)
+    {
+    }
+
+    // Attach the plugin object to an execution context and grant the plugin the access to some context resource.
+    void PreprocessPlugin::attachToContext(cudnnContext* cudnnContext, cublasContext* cublasContext, IGpuAllocator* gpuAllocator)
+    {
+    }
+
+    // Detach the plugin object from its execution context.
+    void PreprocessPlugin::detachFromContext() {}
+
+    const char* PreprocessPlugin::getPluginType() const
+    {
+        return "PreprocessLayer_TRT";
+    }
+
+    const char* PreprocessPlugin::getPluginVersion() const
+    {
+        return "1";
+    }
+
+    void PreprocessPlugin::destroy()
+    {
+        delete this;
+    }
+
+    // Clone the plugin
+    IPluginV2IOExt* PreprocessPlugin::clone() const
+    {
+        PreprocessPlugin* p = new PreprocessPlugin(mNetWidth, mNetHeight);
+        p->setPluginNamespace(mPluginNamespace);
+        return p;
+    }
+
+    int PreprocessPlugin::enqueue(int batchSize, const void*const * inputs, void** outputs, void* workspace, cudaStream_t stream)
+    {
+        Yolo::hwc2chwGpu((const uint8_t*)inputs[0], (float*)outputs[0], batchSize, mNetWidth, mNetHeight, stream);
+        return 0;
+    }
+
+    PluginFieldCollection PreprocessPluginCreator::mFC{};
+    std::vector<PluginField> PreprocessPluginCreator::mPluginAttributes;
+
+    PreprocessPluginCreator::PreprocessPluginCreator()
+    {
+        mPluginAttributes.clear();
+
+        mFC.nbFields = mPluginAttributes.size();
+        mFC.fields = mPluginAttributes.data();
+    }
+
+    const char* PreprocessPluginCreator::getPluginName() const
+    {
+        return "PreprocessLayer_TRT";
+    }
+
+    const char* PreprocessPluginCreator::getPluginVersion() const
+    {
+        return "1";
+    }
+
+    const PluginFieldCollection* PreprocessPluginCreator::getFieldNames()
+    {
+        return &mFC;
+    }
+
+    IPluginV2IOExt* PreprocessPluginCreator::createPlugin(const char* name, const PluginFieldCollection* fc)
+    {
+        int input_w = -1;
+        int input_h = -1;
+
+        const PluginField* fields = fc->fields;
+        for (int i = 0; i < fc->nbFields; i++) {
+            if (strcmp(fields[i].name, "netsize") == 0) {
+                assert(fields[i].type == PluginFieldType::kINT32);
+                const int *tmp = (const int*)(fields[i].data);
+                input_w = tmp[0];
+                input_h = tmp[1];
+            }
+        }
+        assert(input_w > 0 && input_h > 0);
+        PreprocessPlugin* obj = new PreprocessPlugin(input_w, input_h);
+        obj->setPluginNamespace(mNamespace.c_str());
+        return obj;
+    }
+
+    IPluginV2IOExt* PreprocessPluginCreator::deserializePlugin(const char* name, const void* serialData, size_t serialLength)
+    {
+        // This object will be deleted when the network is destroyed, which will
+        // call PreprocessPlugin::destroy()
+        PreprocessPlugin* obj = new PreprocessPlugin(serialData, serialLength);
+        obj->setPluginNamespace(mNamespace.c_str());
+        return obj;
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef _PREPROCESS_LAYER_H
+#define _PREPROCESS_LAYER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "NvInfer.h"
+
+namespace Yolo
+{
+    // Converts a batch of letterboxed uint8 BGR HWC images into the float RGB CHW
+    // tensor the network expects, scaled to [0, 1]. This is what the preprocess
+    // layer runs on the device; hwc_bgr_to_chw_rgb() in utils.h is the CPU reference.
+    void hwc2chwGpu(const uint8_t* src, float* dst, int batchSize, int width, int height, cudaStream_t stream);
+}
+
+namespace nvinfer1
+{
+    // Network input layer for engines whose input binding is packed uint8 BGR HWC.
+    // TensorRT has no uint8 bindings, so the bytes travel in a kINT32 tensor of
+    // shape {H, W * 3 / 4}; the layer unpacks them into a float {3, H, W} tensor.
+    class PreprocessPlugin : public IPluginV2IOExt
+    {
+    public:
+        PreprocessPlugin(int netWidth, int netHeight);
+        PreprocessPlugin(const void* data, size_t length);
+        ~PreprocessPlugin() = default;
+
+        int getNbOutputs() const override
+        {
+            return 1;
+        }
+
+        Dims getOutputDimensions(int index, const Dims* inputs, int nbInputDims) override;
+
+        int initialize() override;
+
+        virtual void terminate() override {};
+
+        virtual size_t getWorkspaceSize(int maxBatchSize) const override { return 0; }
+
+        virtual int enqueue(int batchSize, const void*const * inputs, void** outputs, void* workspace, cudaStream_t stream) override;
+
+        virtual size_t getSerializationSize() const override;
+
+        virtual void serialize(void* buffer) const override;
+
+        bool supportsFormatCombination(int pos, const PluginTensorDesc* inOut, int nbInputs, int nbOutputs) const override {
+            return inOut[pos].format == TensorFormat::kLINEAR && inOut[pos].type == (pos == 0 ? DataType::kINT32 : DataType::kFLOAT);
+        }
+
+        const char* getPluginType() const override;
+
+        const char* getPluginVersion() const override;
+
+        void destroy() override;
+
+        IPluginV2IOExt* clone() const override;
+
+        void setPluginNamespace(const char* pluginNamespace) override;
+
+        const char* getPluginNamespace() const override;
+
+        DataType getOutputDataType(int index, const nvinfer1::DataType* inputTypes, int nbInputs) const override;
+
+        bool isOutputBroadcastAcrossBatch(int outputIndex, const bool* inputIsBroadcasted, int nbInputs) const override;
+
+        bool canBroadcastInputAcrossBatch(int inputIndex) const override;
+
+        void attachToContext(
+            cudnnContext* cudnnContext, cublasContext* cublasContext, IGpuAllocator* gpuAllocator) override;
+
+        void configurePlugin(const PluginTensorDesc* in, int nbInput, const PluginTensorDesc* out, int nbOutput) override;
+
+        void detachFromContext() override;
+
+    private:
+        const char* mPluginNamespace;
+        int mNetWidth;
+        int mNetHeight;
+    };
+
+    class PreprocessPluginCreator : public IPluginCreator
+    {
+    public:
+        PreprocessPluginCreator();
+
+        ~PreprocessPluginCreator() override = default;
+
+        const char* getPluginName() const override;
+
+        const char* getPluginVersion() const override;
+
+        const PluginFieldCollection* getFieldNames() override;
+
+        IPluginV2IOExt* createPlugin(const char* name, const PluginFieldCollection* fc) override;
+
+        IPluginV2IOExt* deserializePlugin(const char* name, const void* serialData, size_t serialLength) override;
+
+        void setPluginNamespace(const char* libNamespace) override
+        {
+            mNamespace = libNamespace;
+        }
+
+        const char* getPluginNamespace() const override
+        {
+            return mNamespace.c_str();
+        }
+
+    private:
+        std::string mNamespace;
+        static PluginFieldCollection mFC;
+        static std::vector<PluginField> mPluginAttributes;
+    };
+    REGISTER_TENSORRT_PLUGIN(PreprocessPluginCreator);
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef YOLOV5_RECORDER_H_
+#define YOLOV5_RECORDER_H_
+
+#include <sys/stat.h>
+#include <cstdint>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "async_logger.hpp"
+#include "membudget.hpp"
+#include "utils.h"
+#include "yololayer.h"
+
+// Records the tiles of one source only around events. An event starts when a
+// detection of one of the trigger classes shows up and ends hold-off seconds
+// after the last one; each event goes to its own <prefix>-event<n>.avi. While
+// idle, the last pre-roll seconds of tiles are kept as JPEG (capped at
+// preroll_bytes, a quarter of it under memory pressure) and written at the
+// start of the next clip.
+class EventRecorder {
+public:
+    EventRecorder(const std::string& prefix, const std::set<int>& classes, double fps, cv::Size size,
+                  double holdoff_sec, double preroll_sec, size_t preroll_bytes)
+        : prefix_(prefix), classes_(classes), fps_(fps), size_(size)
+        , holdoff_ns_((int64_t)(holdoff_sec * 1e9)), preroll_ns_((int64_t)(preroll_sec * 1e9)), preroll_cap_(preroll_bytes)
+        , preroll_bytes_(0), preroll_charge_(membudget::kPreroll), encoder_charge_(membudget::kEncoders)
+        , last_trigger_ns_(0), events_(0), seen_(0), written_(0), encode_ns_(0), jpeg_ns_(0), file_bytes_(0) {}
+
+    ~EventRecorder() {
+        finish();
+        report();
+    }
+
+    // takes the tile of a frame at steady clock time t_ns
+    void push(const cv::Mat& tile, const std::vector<Yolo::Detection>& dets, int64_t t_ns) {
+        seen_++;
+        bool trigger = false;
+        for (auto& det : dets)
+            trigger = trigger || classes_.count((int)det.class_id);
+        if (trigger) last_trigger_ns_ = t_ns;
+
+        int64_t cpu0 = thread_cpu_ns();
+        if (!writer_.isOpened() && trigger) {
+            start();
+        } else if (writer_.isOpened() && t_ns - last_trigger_ns_ > holdoff_ns_) {
+            finish();
+        }
+        if (writer_.isOpened()) {
+            writer_.write(tile);
+            written_++;
+            encode_ns_ += thread_cpu_ns() - cpu0;
+            return;
+        }
+        encode_ns_ += thread_cpu_ns() - cpu0;
+
+        // idle: keep the tile compressed for the pre-roll of the next event
+        cpu0 = thread_cpu_ns();
+        Compressed c;
+        c.t_ns = t_ns;
+        cv::imencode(".jpg", tile, c.jpeg, std::vector<int>{cv::IMWRITE_JPEG_QUALITY, 85});
+        preroll_bytes_ += c.jpeg.size();
+        preroll_.push_back(std::move(c));
+        size_t cap = membudget::budget().level() >= membudget::kShrinkQueues ? preroll_cap_ / 4 : preroll_cap_;
+        while (!preroll_.empty() && (t_ns - preroll_.front().t_ns > preroll_ns_ || preroll_bytes_ > cap)) {
+            preroll_bytes_ -= preroll_.front().jpeg.size();
+            preroll_.pop_front();
+        }
+        preroll_charge_.set(preroll_bytes_);
+        jpeg_ns_ += thread_cpu_ns() - cpu0;
+    }
+
+    // encode CPU time and file size against what recording every frame would have cost
+    void report() const {
+        double encode_ms = (encode_ns_ + jpeg_ns_) / 1e6;
+        if (!written_) {
+            ALOG_INFO("recorder {}: no events in {} frames, {}ms of CPU on the pre-roll", prefix_, seen_, encode_ms);
+            return;
+        }
+        double ms_per_frame = encode_ns_ / 1e6 / written_, bytes_per_frame = (double)file_bytes_ / written_;
+        ALOG_INFO("recorder {}: {} events, {}/{} frames written, {} bytes, {}ms of encode CPU; ~{}ms and ~{} bytes saved against continuous recording",
+                  prefix_, events_, written_, seen_, file_bytes_, encode_ms,
+                  ms_per_frame * seen_ - encode_ms, (uint64_t)(bytes_per_frame * (seen_ - written_)));
+    }
+
+private:
+    struct Compressed {
+        int64_t t_ns;
+        std::vector<uchar> jpeg;
+    };
+
+    void start() {
+        path_ = prefix_ + "-event" + std::to_string(events_) + ".avi";
+        if (!writer_.open(path_, cv::VideoWriter::fourcc('X', 'V', 'I', 'D'), fps_, size_, true)) {
+            // retried on every triggering frame, the event number is kept for the next attempt
+            ALOG_EVERY_MS(alog::Severity::kERROR, 5000, "recorder: cannot open {}", path_);
+            return;
+        }
+        events_++;
+        ALOG_INFO("recorder: event in {}, {} pre-roll frames", path_, (int)preroll_.size());
+        for (auto& c : preroll_) {
+            cv::Mat tile = cv::imdecode(c.jpeg, cv::IMREAD_COLOR);
+            writer_.write(tile);
+            written_++;
+        }
+        preroll_.clear();
+        preroll_bytes_ = 0;
+        preroll_charge_.set(0);
+        encoder_charge_.set(membudget::kEncoderFrames * size_.area() * 3);
+    }
+
+    void finish() {
+        if (!writer_.isOpened()) return;
+        writer_.release();
+        encoder_charge_.set(0);
+        struct stat st;
+        if (stat(path_.c_str(), &st) == 0) file_bytes_ += st.st_size;
+    }
+
+    std::string prefix_;
+    std::set<int> classes_;
+    double fps_;
+    cv::Size size_;
+    int64_t holdoff_ns_;
+    int64_t preroll_ns_;
+    size_t preroll_cap_;
+    std::deque<Compressed> preroll_;
+    size_t preroll_bytes_;
+    membudget::Charge preroll_charge_;
+    membudget::Charge encoder_charge_;
+    cv::VideoWriter writer_;
+    std::string path_;
+    int64_t last_trigger_ns_;
+    int events_;
+    uint64_t seen_;
+    uint64_t written_;
+    int64_t encode_ns_;     // clip writing, pre-roll decoding included
+    int64_t jpeg_ns_;       // compressing the pre-roll
+    uint64_t file_bytes_;
+};
+
+#endif  // YOLOV5_RECORDER_H_
@@ -0,0 +1,284 @@
+#ifndef YOLOV5_SHM_RING_H_
+#define YOLOV5_SHM_RING_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <opencv2/opencv.hpp>
+
+// Frames of one source in a POSIX shared-memory ring, so decoders can run in
+// their own processes (-p) and a crashing stream cannot take inference down.
+//
+// The segment is a header followed by a fixed number of slots, each sized for
+// the first frame the writer published. A larger frame (the camera changed its
+// resolution) makes the writer replace the ring with one of bigger slots; the
+// readers see the old one marked replaced and attach to the new one. Frame n
+// goes to slot n % slots under a seqlock: the slot sequence is 2n+1 while the
+// writer copies the pixels and 2n+2 once the frame is complete. There is one
+// writer and any number of readers, and neither ever waits for the other. A
+// reader gets a view of the slot (no copy) and must check valid() after it is
+// done with the pixels. A false result means the writer came around and reused
+// the slot, and the result has to be dropped. The shape of the view is checked
+// against the slot before it is handed out, so a slot reused while the reader
+// looked at it never makes the view reach past the slot.
+namespace shm {
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the ring needs lock-free 64-bit atomics across processes");
+
+struct RingHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t slot_count;
+    int32_t writer_pid;
+    uint64_t slot_bytes;                // pixel bytes per slot
+    uint64_t slot_stride;               // bytes from one slot header to the next
+    std::atomic<uint64_t> write_seq;    // frames published so far
+    std::atomic<int64_t> heartbeat_ns;  // steady clock of the last publish
+    std::atomic<uint32_t> replaced;     // a ring with bigger slots took over the name
+};
+
+struct SlotHeader {
+    std::atomic<uint64_t> seq;
+    uint64_t frame;
+    int64_t capture_ns;     // steady clock when the writer got the frame
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+    int32_t step;
+};
+
+static const size_t kHeaderBytes = 128;
+static const size_t kSlotHeaderBytes = 64;
+
+inline int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// "shm://cam0" and "cam0" both name the segment "/cam0"
+inline std::string segment_name(const std::string& url) {
+    std::string name = url.compare(0, 6, "shm://") == 0 ? url.substr(6) : url;
+    return name[0] == '/' ? name : "/" + name;
+}
+
+struct Frame {
+    cv::Mat view;           // points into the slot
+    uint64_t frame;
+    int64_t capture_ns;
+    const SlotHeader* slot;
+    uint64_t seq;
+};
+
+class FrameWriter {
+public:
+    explicit FrameWriter(const std::string& name, int slots = 8)
+        : name_(segment_name(name)), slots_(slots > 1 ? slots : 2), base_(nullptr), bytes_(0), frames_(0) {}
+
+    ~FrameWriter() {
+        if (base_) {
+            munmap(base_, bytes_);
+            shm_unlink(name_.c_str());
+        }
+    }
+
+    // copies a frame into the next slot. the ring is created on the first call and replaced by
+    // one with bigger slots when a frame does not fit. false for a frame that is not 8-bit BGR
+    bool publish(const cv::Mat& frame) {
+        if (frame.type() != CV_8UC3) return false;
+        size_t row_bytes = frame.cols * frame.elemSize();
+        if (base_ && row_bytes * frame.rows > ((RingHeader*)base_)->slot_bytes) {
+            ((RingHeader*)base_)->replaced.store(1, std::memory_order_release);
+            munmap(base_, bytes_);
+            base_ = nullptr;
+        }
+        if (!base_ && !create(row_bytes * frame.rows)) return false;
+        RingHeader* hdr = (RingHeader*)base_;
+
+        uint64_t n = frames_++;
+        SlotHeader* slot = (SlotHeader*)(base_ + kHeaderBytes + (n % slots_) * hdr->slot_stride);
+        slot->seq.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->frame = n;
+        slot->capture_ns = now_ns();
+        slot->rows = frame.rows;
+        slot->cols = frame.cols;
+        slot->type = frame.type();
+        slot->step = (int32_t)row_bytes;
+        uchar* dst = (uchar*)slot + kSlotHeaderBytes;
+        if (frame.isContinuous()) {
+            memcpy(dst, frame.data, row_bytes * frame.rows);
+        } else {
+            for (int r = 0; r < frame.rows; r++)
+                memcpy(dst + r * row_bytes, frame.ptr(r), row_bytes);
+        }
+        slot->seq.store(2 * n + 2, std::memory_order_release);
+        hdr->write_seq.store(n + 1, std::memory_order_release);
+        hdr->heartbeat_ns.store(slot->capture_ns, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    bool create(size_t slot_bytes) {
+        // a ring left by a crashed writer is replaced, readers notice the missing heartbeat and reopen
+        shm_unlink(name_.c_str());
+        int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) return false;
+        size_t stride = kSlotHeaderBytes + ((slot_bytes + 63) & ~(size_t)63);
+        bytes_ = kHeaderBytes + stride * slots_;
+        void* p = ftruncate(fd, bytes_) == 0 ? mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (p == MAP_FAILED) {
+            shm_unlink(name_.c_str());
+            return false;
+        }
+        base_ = (uchar*)p;
+        frames_ = 0;
+        RingHeader* hdr = new (base_) RingHeader();
+        hdr->version = 1;
+        hdr->slot_count = slots_;
+        hdr->writer_pid = getpid();
+        hdr->slot_bytes = slot_bytes;
+        hdr->slot_stride = stride;
+        hdr->write_seq.store(0);
+        hdr->heartbeat_ns.store(now_ns());
+        hdr->replaced.store(0);
+        for (int i = 0; i < slots_; i++)
+            new (base_ + kHeaderBytes + i * stride) SlotHeader();
+        // readers check the magic last
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(hdr->magic, "YSHM", 4);
+        return true;
+    }
+
+    std::string name_;
+    int slots_;
+    uchar* base_;
+    size_t bytes_;
+    uint64_t frames_;
+};
+
+class FrameReader {
+public:
+    explicit FrameReader(const std::string& name)
+        : name_(segment_name(name)), base_(nullptr), bytes_(0), last_(0), missed_(0), torn_(0), opened_ns_(0) {}
+
+    ~FrameReader() { unmap(); }
+
+    // false while no writer has published yet
+    bool open() {
+        unmap();
+        int fd = shm_open(name_.c_str(), O_RDONLY, 0);
+        if (fd < 0) return false;
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= kHeaderBytes)
+            p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) return false;
+        base_ = (uchar*)p;
+        bytes_ = st.st_size;
+        const RingHeader* hdr = (const RingHeader*)base_;
+        bool ready = memcmp(hdr->magic, "YSHM", 4) == 0;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!ready || hdr->version != 1 || hdr->slot_count == 0 || hdr->slot_bytes + kSlotHeaderBytes > hdr->slot_stride ||
+            kHeaderBytes + hdr->slot_stride * hdr->slot_count > bytes_) {
+            unmap();
+            return false;
+        }
+        // frames published before the reader arrived are stale already
+        last_ = hdr->write_seq.load(std::memory_order_acquire);
+        opened_ns_ = now_ns();
+        return true;
+    }
+
+    // waits up to timeout_ms for a frame newer than the last one returned, skipping to the latest.
+    // a writer that stopped publishing for a while is assumed restarted and the ring is reopened.
+    bool next(Frame& f, int timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (true) {
+            if (base_ && ((const RingHeader*)base_)->replaced.load(std::memory_order_acquire)) unmap();
+            if (base_ || open()) {
+                const RingHeader* hdr = (const RingHeader*)base_;
+                uint64_t w = hdr->write_seq.load(std::memory_order_acquire);
+                if (w > last_) {
+                    uint64_t n = w - 1;
+                    const SlotHeader* slot = (const SlotHeader*)(base_ + kHeaderBytes + (n % hdr->slot_count) * hdr->slot_stride);
+                    uint64_t seq = slot->seq.load(std::memory_order_acquire);
+                    if (seq == 2 * n + 2) {
+                        // the fields are only used once the sequence shows that the writer did not touch them meanwhile
+                        SlotHeader copy;
+                        copy.frame = slot->frame;
+                        copy.capture_ns = slot->capture_ns;
+                        copy.rows = slot->rows;
+                        copy.cols = slot->cols;
+                        copy.type = slot->type;
+                        copy.step = slot->step;
+                        std::atomic_thread_fence(std::memory_order_acquire);
+                        bool same = slot->seq.load(std::memory_order_relaxed) == seq;
+                        if (same && fits(copy, hdr->slot_bytes)) {
+                            missed_ += n - last_;
+                            last_ = w;
+                            f.frame = copy.frame;
+                            f.capture_ns = copy.capture_ns;
+                            f.slot = slot;
+                            f.seq = seq;
+                            f.view = cv::Mat(copy.rows, copy.cols, copy.type, (void*)((const uchar*)slot + kSlotHeaderBytes), copy.step);
+                            return true;
+                        }
+                        if (same) last_ = w;    // a broken header does not heal, skip the frame
+                        torn_++;
+                    }
+                    // the writer is already reusing the slot, wait for its next publish
+                }
+                int64_t now = now_ns();
+                if (now - hdr->heartbeat_ns.load(std::memory_order_relaxed) > kStaleNs && now - opened_ns_ > kStaleNs) unmap();
+            }
+            if (std::chrono::steady_clock::now() >= deadline) return false;
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+    }
+
+    // true if the pixels behind f were not touched by the writer while they were read
+    bool valid(const Frame& f) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (f.slot->seq.load(std::memory_order_relaxed) == f.seq) return true;
+        torn_++;
+        return false;
+    }
+
+    uint64_t missed() const { return missed_; }  // frames overwritten before the reader got to them
+    uint64_t torn() const { return torn_; }      // frames dropped because their slot was reused mid-read
+
+private:
+    static const int64_t kStaleNs = 2000000000LL;
+
+    // an 8-bit BGR frame whose rows lie within the pixel bytes of a slot
+    static bool fits(const SlotHeader& h, uint64_t slot_bytes) {
+        return h.type == CV_8UC3 && h.rows > 0 && h.cols > 0 && (int64_t)h.step >= 3 * (int64_t)h.cols &&
+               (uint64_t)h.rows * (uint64_t)h.step <= slot_bytes;
+    }
+
+    void unmap() {
+        if (base_) munmap(base_, bytes_);
+        base_ = nullptr;
+    }
+
+    std::string name_;
+    uchar* base_;
+    size_t bytes_;
+    uint64_t last_;
+    uint64_t missed_;
+    uint64_t torn_;
+    int64_t opened_ns_;
+};
+
+}  // namespace shm
+
+#endif  // YOLOV5_SHM_RING_H_
@@ -0,0 +1,206 @@
+#ifndef YOLOV5_TASKPOOL_H_
+#define YOLOV5_TASKPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "placement.hpp"
+#include "trace.hpp"
+
+// Work-stealing pool for the CPU stages of the pipeline: letterboxing, image
+// decoding, NMS, box mapping, drawing and scaling.
+//
+// Every worker has its own deque. A task goes to the deque its affinity hint
+// names (hint % threads), so with the source or batch index as the hint, the
+// work of one source keeps running on the same core. A worker takes from the
+// back of its own deque. Once that is empty, it steals from the front of the
+// others. for_each(n, fn) queues fn(0) .. fn(n - 1) as one batch, task i on
+// worker i % threads, and returns once all of them ran. Results written to
+// slot i of a vector therefore come back in batch order, and the calling
+// thread runs queued tasks while it waits. With 0 threads everything runs on
+// the caller. Any thread can submit, including the pool's own tasks, but only
+// for_each is safe to nest: the future of submit() blocks without running
+// queued tasks, so a pool task must not wait on one, or every worker can end
+// up waiting on a task that none of them runs. The threads of a pinned pool
+// take the pool cores of the placement.
+class TaskPool {
+public:
+    explicit TaskPool(int threads, bool pinned = false) : pinned_(pinned), pending_(0), stop_(false), next_(0) {
+        for (int i = 0; i < threads; i++)
+            workers_.emplace_back(new Worker());
+        for (int i = 0; i < threads; i++)
+            threads_.emplace_back(&TaskPool::run, this, i);
+    }
+
+    ~TaskPool() {
+        {
+            std::lock_guard<std::mutex> lk(sleep_mutex_);
+            stop_ = true;
+        }
+        sleep_cv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    int threads() const { return (int)workers_.size(); }
+
+    // one task on the deque of worker hint % threads. a negative hint keeps a task submitted
+    // from the pool on the submitting worker, other threads go round-robin. a pool task must
+    // not wait on the future.
+    std::future<void> submit(std::function<void()> fn, int hint = -1) {
+        auto task = std::make_shared<std::packaged_task<void()>>(std::move(fn));
+        std::future<void> done = task->get_future();
+        if (workers_.empty()) {
+            (*task)();
+            return done;
+        }
+        int w = hint >= 0 ? hint % threads() : self() >= 0 ? self() : (int)(next_++ % threads());
+        Task t;
+        t.group = nullptr;
+        t.index = 0;
+        t.fn = [task] { (*task)(); };
+        pending_++;
+        {
+            std::lock_guard<std::mutex> lk(workers_[w]->mutex);
+            workers_[w]->tasks.push_back(std::move(t));
+        }
+        wake(1);
+        return done;
+    }
+
+    void for_each(int n, const std::function<void(int)>& fn) {
+        if (n <= 1 || workers_.empty()) {
+            for (int i = 0; i < n; i++) fn(i);
+            return;
+        }
+        Group group(fn, n);
+        // one lock per deque and one wake-up for the whole batch
+        pending_ += n;
+        for (int w = 0; w < threads() && w < n; w++) {
+            std::lock_guard<std::mutex> lk(workers_[w]->mutex);
+            for (int i = w; i < n; i += threads())
+                workers_[w]->tasks.push_back(Task{&group, i, nullptr});
+        }
+        wake(n);
+        while (group.left.load() > 0) {
+            Task t;
+            if (take(self(), t)) {
+                execute(t);
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(done_mutex_);
+            done_cv_.wait(lk, [&] { return group.left.load() == 0; });
+        }
+    }
+
+private:
+    struct Group {
+        Group(const std::function<void(int)>& f, int n) : fn(f), left(n) {}
+        const std::function<void(int)>& fn;
+        std::atomic<int> left;
+    };
+
+    // a task of a for_each group, or a single task with its own function
+    struct Task {
+        Group* group;
+        int index;
+        std::function<void()> fn;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // index of the calling thread in this pool, -1 for other threads
+    int self() const {
+        return current_pool() == this ? current_index() : -1;
+    }
+
+    static const TaskPool*& current_pool() {
+        static thread_local const TaskPool* pool = nullptr;
+        return pool;
+    }
+
+    static int& current_index() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    void wake(int n) {
+        // taking the lock orders the new tasks before the check of a worker about to sleep
+        { std::lock_guard<std::mutex> lk(sleep_mutex_); }
+        if (n == 1) sleep_cv_.notify_one();
+        else sleep_cv_.notify_all();
+    }
+
+    // the back of the own deque first, then the front of the others
+    bool take(int self, Task& t) {
+        int n = threads();
+        for (int k = 0; k < n; k++) {
+            int w = self >= 0 ? (self + k) % n : k;
+            Worker& worker = *workers_[w];
+            std::lock_guard<std::mutex> lk(worker.mutex);
+            if (worker.tasks.empty()) continue;
+            if (w == self) {
+                t = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+            } else {
+                t = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+            }
+            pending_--;
+            return true;
+        }
+        return false;
+    }
+
+    void execute(Task& t) {
+        if (!t.group) {
+            t.fn();
+            return;
+        }
+        t.group->fn(t.index);
+        // the group lives on the caller's stack and is gone once left reaches 0
+        if (t.group->left.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lk(done_mutex_);
+            done_cv_.notify_all();
+        }
+    }
+
+    void run(int index) {
+        current_pool() = this;
+        current_index() = index;
+        trace::tracer().set_thread_name("cpu pool " + std::to_string(index));
+        if (pinned_) placement::placement().pin(placement::kPool, index);
+        while (true) {
+            Task t;
+            if (take(index, t)) {
+                execute(t);
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(sleep_mutex_);
+            sleep_cv_.wait(lk, [&] { return stop_ || pending_.load() > 0; });
+            if (stop_ && pending_.load() == 0) return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    bool pinned_;
+    std::atomic<int> pending_;          // tasks queued on all deques, counted before they are pushed
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;  // tasks were queued or stop_
+    bool stop_;
+    std::mutex done_mutex_;
+    std::condition_variable done_cv_;   // a group finished
+    std::atomic<unsigned> next_;
+};
+
+#endif  // YOLOV5_TASKPOOL_H_
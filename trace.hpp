@@ -0,0 +1,284 @@
+#ifndef YOLOV5_TRACE_H_
+#define YOLOV5_TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "async_logger.hpp"
+
+// Timeline of the pipeline for chrome://tracing or Perfetto. A span is one
+// stage of one frame (waiting for a frame, inference, drawing, writing...)
+// with its source and frame number, from begin to end on the thread it ran
+// on. Every thread appends to its own fixed buffer, which only that thread
+// writes, so recording takes no lock. The buffers are read when the trace is
+// written as Chrome trace JSON. A full buffer drops spans and counts them.
+// While tracing is off a span costs one relaxed atomic load.
+//
+// Independently of the timeline, the total time and count of the spans of
+// every name can be kept (set_totals), in a few counters per thread instead
+// of a growing buffer, for the stage report of long runs.
+namespace trace {
+
+inline int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// all spans of one name on all threads
+struct Total {
+    std::string name;
+    int64_t ns;
+    uint64_t count;
+};
+
+struct Event {
+    const char* name;   // a string literal
+    int32_t source;     // -1 if the span is not about one source
+    int64_t frame;      // -1 if not about one frame
+    int64_t begin_ns;
+    int64_t end_ns;
+};
+
+class Tracer {
+public:
+    Tracer() : flags_(0), start_ns_(0), capacity_(0) {}
+
+    // starts recording, every thread gets room for events_per_thread spans
+    void start(size_t events_per_thread = 1 << 17) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        if (!start_ns_) start_ns_ = now_ns();
+        capacity_.store(events_per_thread, std::memory_order_relaxed);
+        flags_.fetch_or(kEvents, std::memory_order_release);
+    }
+
+    void stop() { flags_.fetch_and(~kEvents, std::memory_order_release); }
+
+    // keeps the total time and count of the spans of every name, see totals()
+    void set_totals(bool on) {
+        if (on) flags_.fetch_or(kTotals, std::memory_order_release);
+        else flags_.fetch_and(~kTotals, std::memory_order_release);
+    }
+
+    // spans are timed, for the timeline or the totals
+    bool enabled() const { return flags_.load(std::memory_order_relaxed) != 0; }
+
+    // the name of the calling thread's track, e.g. "reader rtsp://cam1"
+    void set_thread_name(const std::string& name) {
+        if (!(flags_.load(std::memory_order_relaxed) & kEvents)) return;
+        Buffer* buf = local();
+        std::lock_guard<std::mutex> lk(mutex_);
+        buf->name = name;
+    }
+
+    void record(const char* name, int source, int64_t frame, int64_t begin_ns, int64_t end_ns) {
+        Buffer* buf = local();
+        int flags = flags_.load(std::memory_order_relaxed);
+        if (flags & kTotals) add_total(buf, name, end_ns - begin_ns);
+        if (!(flags & kEvents)) return;
+        size_t n = buf->count.load(std::memory_order_relaxed);
+        if (n == buf->events.size() && !grow(buf)) {
+            buf->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Event& e = buf->events[n];
+        e.name = name;
+        e.source = source;
+        e.frame = frame;
+        e.begin_ns = begin_ns;
+        e.end_ns = end_ns;
+        // the event is complete before a reader sees it counted
+        buf->count.store(n + 1, std::memory_order_release);
+    }
+
+    // spans recorded so far on all threads, as Chrome trace JSON. threads may keep recording meanwhile.
+    bool write_json(const std::string& path, uint64_t* spans = nullptr, uint64_t* dropped = nullptr) {
+        FILE* f = fopen(path.c_str(), "w");
+        if (!f) return false;
+        std::lock_guard<std::mutex> lk(mutex_);
+        uint64_t total = 0, lost = 0;
+        fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        const char* sep = "";
+        for (size_t t = 0; t < buffers_.size(); t++) {
+            Buffer& buf = *buffers_[t];
+            std::string name = buf.name.empty() ? "thread " + std::to_string(t) : buf.name;
+            fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+                    sep, t, escape(name).c_str());
+            sep = ",\n";
+            size_t n = buf.count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < n; i++) {
+                const Event& e = buf.events[i];
+                fprintf(f, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+                        e.name, t, (e.begin_ns - start_ns_) / 1e3, (e.end_ns - e.begin_ns) / 1e3);
+                if (e.source >= 0) fprintf(f, "\"source\":%d%s", e.source, e.frame >= 0 ? "," : "");
+                if (e.frame >= 0) fprintf(f, "\"frame\":%lld", (long long)e.frame);
+                fprintf(f, "}}");
+            }
+            total += n;
+            lost += buf.dropped.load(std::memory_order_relaxed);
+        }
+        fprintf(f, "\n]}\n");
+        bool ok = fclose(f) == 0;
+        if (spans) *spans = total;
+        if (dropped) *dropped = lost;
+        return ok;
+    }
+
+    // the spans of every name recorded while the totals were on, summed over the threads, by name
+    std::vector<Total> totals() {
+        std::lock_guard<std::mutex> lk(mutex_);
+        std::vector<Total> out;
+        for (auto& buf : buffers_) {
+            int n = buf->totals_used.load(std::memory_order_acquire);
+            for (int i = 0; i < n; i++) {
+                const Counter& c = buf->totals[i];
+                size_t k = 0;
+                while (k < out.size() && out[k].name != c.name) k++;
+                if (k == out.size()) out.push_back(Total{c.name, 0, 0});
+                out[k].ns += c.ns.load(std::memory_order_relaxed);
+                out[k].count += c.count.load(std::memory_order_relaxed);
+            }
+        }
+        return out;
+    }
+
+private:
+    enum { kEvents = 1, kTotals = 2 };
+    static const int kMaxTotals = 32;   // span names per thread, more are not counted
+
+    // only the owning thread writes a counter, so it adds without a read-modify-write
+    struct Counter {
+        const char* name;
+        std::atomic<int64_t> ns;
+        std::atomic<uint64_t> count;
+    };
+
+    struct Buffer {
+        explicit Buffer(size_t capacity) : events(capacity), count(0), dropped(0), totals_used(0) {}
+        std::string name;
+        std::vector<Event> events;
+        std::atomic<size_t> count;
+        std::atomic<uint64_t> dropped;
+        Counter totals[kMaxTotals];
+        std::atomic<int> totals_used;
+    };
+
+    static void add_total(Buffer* buf, const char* name, int64_t ns) {
+        int n = buf->totals_used.load(std::memory_order_relaxed);
+        int i = 0;
+        // names are literals, the same literal is mostly the same pointer
+        while (i < n && buf->totals[i].name != name && strcmp(buf->totals[i].name, name) != 0) i++;
+        if (i == n) {
+            if (n == kMaxTotals) return;
+            Counter& fresh = buf->totals[n];
+            fresh.name = name;
+            fresh.ns.store(0, std::memory_order_relaxed);
+            fresh.count.store(0, std::memory_order_relaxed);
+            // the counter is set up before totals() sees it
+            buf->totals_used.store(n + 1, std::memory_order_release);
+        }
+        Counter& c = buf->totals[i];
+        c.ns.store(c.ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        c.count.store(c.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // a buffer registered before start(), or before a start() with more room, gets the room
+    // of the last start(). only its own thread calls this, write_json() reads under the lock
+    bool grow(Buffer* buf) {
+        size_t capacity = capacity_.load(std::memory_order_relaxed);
+        if (buf->events.size() >= capacity) return false;
+        std::lock_guard<std::mutex> lk(mutex_);
+        buf->events.resize(capacity);
+        return true;
+    }
+
+    // the calling thread's buffer, registered on its first span. buffers outlive their
+    // threads, so spans of readers that ended are still written out.
+    Buffer* local() {
+        static thread_local Buffer* buf = nullptr;
+        if (!buf) {
+            std::lock_guard<std::mutex> lk(mutex_);
+            buffers_.emplace_back(new Buffer(capacity_.load(std::memory_order_relaxed)));
+            buf = buffers_.back().get();
+        }
+        return buf;
+    }
+
+    static std::string escape(const std::string& s) {
+        std::string out;
+        for (char c : s) {
+            if (c == '"' || c == '\\') out += '\\';
+            if ((unsigned char)c >= 0x20) out += c;
+        }
+        return out;
+    }
+
+    std::atomic<int> flags_;    // kEvents, kTotals
+    int64_t start_ns_;
+    std::atomic<size_t> capacity_;    // events per thread, set by start()
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+inline Tracer& tracer() {
+    static Tracer instance;
+    return instance;
+}
+
+// records its own lifetime as a span, if tracing was on when it began
+class Span {
+public:
+    explicit Span(const char* name, int source = -1, int64_t frame = -1)
+        : name_(name), source_(source), frame_(frame), begin_ns_(tracer().enabled() ? now_ns() : 0) {}
+
+    ~Span() {
+        if (begin_ns_) tracer().record(name_, source_, frame_, begin_ns_, now_ns());
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    // for spans that learn their frame number on the way, e.g. while waiting for it
+    void set_frame(int64_t frame) { frame_ = frame; }
+
+private:
+    const char* name_;
+    int source_;
+    int64_t frame_;
+    int64_t begin_ns_;
+};
+
+// traces from construction to destruction and writes the trace to path then, nothing if path is empty.
+// the constructing thread is named "main".
+class Session {
+public:
+    explicit Session(const std::string& path) : path_(path) {
+        if (path_.empty()) return;
+        tracer().start();
+        tracer().set_thread_name("main");
+    }
+
+    ~Session() {
+        if (path_.empty()) return;
+        tracer().stop();
+        uint64_t spans = 0, dropped = 0;
+        if (tracer().write_json(path_, &spans, &dropped))
+            ALOG_INFO("trace: {} spans written to {}, {} dropped on full buffers", spans, path_, dropped);
+        else
+            ALOG_ERROR("trace: cannot write {}", path_);
+    }
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+private:
+    std::string path_;
+};
+
+}  // namespace trace
+
+#endif  // YOLOV5_TRACE_H_
@@ -2,9 +2,18 @@
 #define TRTX_YOLOV5_UTILS_H_
 
 #include <dirent.h>
+#include <time.h>
 #include <opencv2/opencv.hpp>
 
-static inline cv::Mat preprocess_img(cv::Mat& img, int input_w, int input_h) {
+// CPU time of the calling thread in ns
+static inline int64_t thread_cpu_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// letterboxes img into the input_w x input_h BGR image at dst, which must hold input_w * input_h * 3 bytes
+static inline void preprocess_img(cv::Mat& img, int input_w, int input_h, uchar* dst) {
     int w, h, x, y;
     float r_w = input_w / (img.cols*1.0);
     float r_h = input_h / (img.rows*1.0);
@@ -19,13 +28,35 @@ static inline cv::Mat preprocess_img(cv::Mat& img, int input_w, int input_h) {
         x = (input_w - w) / 2;
         y = 0;
     }
-    cv::Mat re(h, w, CV_8UC3);
+    cv::Mat out(input_h, input_w, CV_8UC3, dst);
+    out.setTo(cv::Scalar(128, 128, 128));
+    cv::Mat re = out(cv::Rect(x, y, w, h));
     cv::resize(img, re, re.size(), 0, 0, cv::INTER_LINEAR);
-    cv::Mat out(input_h, input_w, CV_8UC3, cv::Scalar(128, 128, 128));
-    re.copyTo(out(cv::Rect(x, y, re.cols, re.rows)));
+}
+
+static inline cv::Mat preprocess_img(cv::Mat& img, int input_w, int input_h) {
+    cv::Mat out(input_h, input_w, CV_8UC3);
+    preprocess_img(img, input_w, input_h, out.data);
     return out;
 }
 
+// CPU reference of the network input conversion: BGR HWC uint8 (rows step bytes apart) to RGB CHW float in [0, 1],
+// divided in float like the device so that -b can compare the two bit for bit.
+// The preprocess layer of packed uint8 engines does the same on the device (see preprocesslayer.h).
+static inline void hwc_bgr_to_chw_rgb(const uchar* hwc, size_t step, int input_w, int input_h, float* chw) {
+    int i = 0;
+    for (int row = 0; row < input_h; ++row) {
+        const uchar* uc_pixel = hwc + row * step;
+        for (int col = 0; col < input_w; ++col) {
+            chw[i] = (float)uc_pixel[2] / 255.0f;
+            chw[i + input_h * input_w] = (float)uc_pixel[1] / 255.0f;
+            chw[i + 2 * input_h * input_w] = (float)uc_pixel[0] / 255.0f;
+            uc_pixel += 3;
+            ++i;
+        }
+    }
+}
+
 static inline int read_files_in_dir(const char *p_dir_name, std::vector<std::string> &file_names) {
     DIR *p_dir = opendir(p_dir_name);
     if (p_dir == nullptr) {
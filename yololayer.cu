@@ -1,5 +1,7 @@
 #include <assert.h>
+#include <string.h>
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include "yololayer.h"
 #include "cuda_utils.h"
@@ -23,9 +25,335 @@ namespace Tn
 
 using namespace Yolo;
 
+namespace Yolo
+{
+    static float LogistCpu(float data) { return 1.0f / (1.0f + expf(-data)); }
+
+    void decodeCpu(const float *const * inputs, float* output, const std::vector<YoloKernel>& kernels, int batchSize, int netWidth, int netHeight, int maxOut, int classes, const float* classMin)
+    {
+        int outputElem = 1 + maxOut * sizeof(Detection) / sizeof(float);
+        int info_len_i = 5 + classes;
+        for (int bnIdx = 0; bnIdx < batchSize; ++bnIdx) {
+            float* res_count = output + bnIdx * outputElem;
+            res_count[0] = 0;
+            for (size_t h = 0; h < kernels.size(); ++h) {
+                const YoloKernel& yolo = kernels[h];
+                int total_grid = yolo.width * yolo.height;
+                const float* curInput = inputs[h] + bnIdx * (info_len_i * total_grid * CHECK_COUNT);
+                for (int idx = 0; idx < total_grid; ++idx) {
+                    for (int k = 0; k < CHECK_COUNT; ++k) {
+                        const float* cell = curInput + idx + k * info_len_i * total_grid;
+                        float box_prob = LogistCpu(cell[4 * total_grid]);
+                        if (box_prob < IGNORE_THRESH) continue;
+                        int class_id = 0;
+                        float max_cls_prob = 0.0;
+                        for (int i = 5; i < info_len_i; ++i) {
+                            float p = LogistCpu(cell[i * total_grid]);
+                            if (p > max_cls_prob) {
+                                max_cls_prob = p;
+                                class_id = i - 5;
+                            }
+                        }
+                        float conf = box_prob * max_cls_prob;
+                        if (classMin && !(conf > classMin[class_id])) continue;
+                        int count = (int)res_count[0];
+                        res_count[0] += 1;
+                        if (count >= maxOut) continue;
+                        Detection* det = (Detection*)(res_count + 1) + count;
+                        int row = idx / yolo.width;
+                        int col = idx % yolo.width;
+                        det->bbox[0] = (col - 0.5f + 2.0f * LogistCpu(cell[0 * total_grid])) * netWidth / yolo.width;
+                        det->bbox[1] = (row - 0.5f + 2.0f * LogistCpu(cell[1 * total_grid])) * netHeight / yolo.height;
+                        det->bbox[2] = 2.0f * LogistCpu(cell[2 * total_grid]);
+                        det->bbox[2] = det->bbox[2] * det->bbox[2] * yolo.anchors[2 * k];
+                        det->bbox[3] = 2.0f * LogistCpu(cell[3 * total_grid]);
+                        det->bbox[3] = det->bbox[3] * det->bbox[3] * yolo.anchors[2 * k + 1];
+                        det->conf = conf;
+                        det->class_id = class_id;
+                    }
+                }
+            }
+        }
+    }
+
+    __device__ float Logist(float data) { return 1.0f / (1.0f + expf(-data)); };
+
+    // all heads of a batch item in one launch, the anchors travel with the launch parameters
+    struct DecodeParams
+    {
+        const float* input[MAX_KERNEL_COUNT];
+        int width[MAX_KERNEL_COUNT];
+        int height[MAX_KERNEL_COUNT];
+        int cellOffset[MAX_KERNEL_COUNT];  // first thread index of each head
+        float anchors[MAX_KERNEL_COUNT][CHECK_COUNT * 2];
+        int kernelCount;
+        int totalCells;
+        int filtered;  // classMin holds the score floor of every class
+        float classMin[MAX_FILTER_CLASSES];
+    };
+
+    // one thread per grid cell of any head, blockIdx.y is the batch item
+    __global__ void CalDetection(DecodeParams params, float *output, const int netwidth, const int netheight, int maxoutobject, int classes, int outputElem)
+    {
+        int gidx = threadIdx.x + blockDim.x * blockIdx.x;
+        int bnIdx = blockIdx.y;
+        // threads past the last cell stay alive for the warp vote below
+        bool valid = gidx < params.totalCells;
+        int head = 0;
+        while (head + 1 < params.kernelCount && gidx >= params.cellOffset[head + 1]) head++;
+        int yoloWidth = params.width[head];
+        int yoloHeight = params.height[head];
+        int idx = gidx - params.cellOffset[head];
+
+        int total_grid = yoloWidth * yoloHeight;
+        int info_len_i = 5 + classes;
+        const float* curInput = params.input[head] + bnIdx * (info_len_i * total_grid * CHECK_COUNT);
+        float *res_count = output + bnIdx * outputElem;
+        int lane = threadIdx.x & 31;
+
+        for (int k = 0; k < CHECK_COUNT; ++k) {
+            const float* cell = curInput + idx + k * info_len_i * total_grid;
+            float box_prob = valid ? Logist(cell[4 * total_grid]) : 0.0f;
+            bool emit = valid && box_prob >= IGNORE_THRESH;
+
+            // the class comes before the slot, so that boxes the class filter drops take none
+            int class_id = 0;
+            float max_cls_prob = 0.0f;
+            if (emit) {
+                // sigmoid is monotonic, so the arg max of the logits is the arg max of the class scores
+                const float* cls = cell + 5 * total_grid;
+                float max_logit = cls[0];
+                for (int i = 1; i < classes; ++i) {
+                    float v = cls[i * total_grid];
+                    if (v > max_logit) {
+                        max_logit = v;
+                        class_id = i;
+                    }
+                }
+                max_cls_prob = Logist(max_logit);
+                // in fp32 the sigmoid of a smaller logit can round to the same score, and the reference
+                // keeps the first class with the highest score. Such ties only exist within 2 of the
+                // max logit, or above 15 once the score has saturated to 1.
+                if (max_cls_prob == 0.0f) {
+                    class_id = 0;
+                } else {
+                    for (int i = 0; i < class_id; ++i) {
+                        float v = cls[i * total_grid];
+                        if ((max_logit - v < 2.0f || (max_cls_prob == 1.0f && v > 15.0f)) && Logist(v) == max_cls_prob) {
+                            class_id = i;
+                            break;
+                        }
+                    }
+                }
+            }
+            float conf = box_prob * max_cls_prob;
+            if (emit && params.filtered && !(conf > params.classMin[class_id])) emit = false;
+
+            // one atomicAdd per warp reserves the output slots of all its emitting lanes
+            unsigned int mask = __ballot_sync(0xffffffff, emit);
+            if (mask == 0) continue;
+            int leader = __ffs(mask) - 1;
+            int base = 0;
+            if (lane == leader) base = (int)atomicAdd(res_count, (float)__popc(mask));
+            base = __shfl_sync(0xffffffff, base, leader);
+            if (!emit) continue;
+            int count = base + __popc(mask & ((1u << lane) - 1));
+            if (count >= maxoutobject) continue;
+
+            char* data = (char *)res_count + sizeof(float) + count * sizeof(Detection);
+            Detection* det = (Detection*)(data);
+
+            int row = idx / yoloWidth;
+            int col = idx % yoloWidth;
+
+            //Location
+            // pytorch:
+            //  y = x[i].sigmoid()
+            //  y[..., 0:2] = (y[..., 0:2] * 2. - 0.5 + self.grid[i].to(x[i].device)) * self.stride[i]  # xy
+            //  y[..., 2:4] = (y[..., 2:4] * 2) ** 2 * self.anchor_grid[i]  # wh 
+            //  X: (sigmoid(tx) + cx)/FeaturemapW *  netwidth 
+            det->bbox[0] = (col - 0.5f + 2.0f * Logist(cell[0 * total_grid])) * netwidth / yoloWidth;
+            det->bbox[1] = (row - 0.5f + 2.0f * Logist(cell[1 * total_grid])) * netheight / yoloHeight;
+
+            // W: (Pw * e^tw) / FeaturemapW * netwidth  
+            // v5: https://github.com/ultralytics/yolov5/issues/471
+            det->bbox[2] = 2.0f * Logist(cell[2 * total_grid]);
+            det->bbox[2] = det->bbox[2] * det->bbox[2] * params.anchors[head][2 * k];
+            det->bbox[3] = 2.0f * Logist(cell[3 * total_grid]);
+            det->bbox[3] = det->bbox[3] * det->bbox[3] * params.anchors[head][2 * k + 1];
+            det->conf = conf;
+            det->class_id = class_id;
+        }
+    }
+
+    void decodeGpu(const float *const * inputs, float* output, const std::vector<YoloKernel>& kernels, int batchSize, int netWidth, int netHeight, int maxOut, int classes, cudaStream_t stream, const float* classMin)
+    {
+        const int threadCount = 256;
+        int outputElem = 1 + maxOut * sizeof(Detection) / sizeof(float);
+
+        DecodeParams params;
+        params.kernelCount = kernels.size();
+        params.totalCells = 0;
+        for (int i = 0; i < params.kernelCount; ++i) {
+            const auto& yolo = kernels[i];
+            params.input[i] = inputs[i];
+            params.width[i] = yolo.width;
+            params.height[i] = yolo.height;
+            params.cellOffset[i] = params.totalCells;
+            memcpy(params.anchors[i], yolo.anchors, sizeof(yolo.anchors));
+            params.totalCells += yolo.width * yolo.height;
+        }
+        params.filtered = classMin != nullptr;
+        if (classMin) {
+            assert(classes <= MAX_FILTER_CLASSES);
+            memcpy(params.classMin, classMin, classes * sizeof(float));
+        }
+
+        // only the detection count of each batch item needs clearing
+        CUDA_CHECK(cudaMemset2DAsync(output, outputElem * sizeof(float), 0, sizeof(float), batchSize, stream));
+        dim3 grid((params.totalCells + threadCount - 1) / threadCount, batchSize);
+        CalDetection << < grid, threadCount, 0, stream >> > (params, output, netWidth, netHeight, maxOut, classes, outputElem);
+    }
+
+    // products go through __fmul_rn on the device so that nvcc cannot contract them into
+    // fma, which keeps the overlap bit-identical to the host reference
+#ifdef __CUDA_ARCH__
+#define NMS_FMUL(a, b) __fmul_rn(a, b)
+#else
+#define NMS_FMUL(a, b) ((a) * (b))
+#endif
+
+    // same arithmetic as iou() in common.hpp
+    __host__ __device__ static float nmsIou(const float* lbox, const float* rbox)
+    {
+        float left = fmaxf(lbox[0] - NMS_FMUL(lbox[2], 0.5f), rbox[0] - NMS_FMUL(rbox[2], 0.5f));
+        float right = fminf(lbox[0] + NMS_FMUL(lbox[2], 0.5f), rbox[0] + NMS_FMUL(rbox[2], 0.5f));
+        float top = fmaxf(lbox[1] - NMS_FMUL(lbox[3], 0.5f), rbox[1] - NMS_FMUL(rbox[3], 0.5f));
+        float bottom = fminf(lbox[1] + NMS_FMUL(lbox[3], 0.5f), rbox[1] + NMS_FMUL(rbox[3], 0.5f));
+        if (top > bottom || left > right)
+            return 0.0f;
+        float interBoxS = NMS_FMUL(right - left, bottom - top);
+        return interBoxS / (NMS_FMUL(lbox[2], lbox[3]) + NMS_FMUL(rbox[2], rbox[3]) - interBoxS);
+    }
+
+    // total order on the candidates: score first, the rest only makes equal scores deterministic
+    __host__ __device__ static bool nmsBefore(const Detection& a, const Detection& b)
+    {
+        if (a.conf != b.conf) return a.conf > b.conf;
+        if (a.class_id != b.class_id) return a.class_id < b.class_id;
+        for (int k = 0; k < LOCATIONS; ++k) {
+            if (a.bbox[k] != b.bbox[k]) return a.bbox[k] < b.bbox[k];
+        }
+        return false;
+    }
+
+    void nmsCpu(const float* raw, float* output, int batchSize, int maxOut, int topK, float confThresh, float nmsThresh)
+    {
+        int rawElem = 1 + maxOut * sizeof(Detection) / sizeof(float);
+        int outElem = 1 + topK * sizeof(Detection) / sizeof(float);
+        for (int bnIdx = 0; bnIdx < batchSize; ++bnIdx) {
+            const float* in = raw + bnIdx * rawElem;
+            float* out = output + bnIdx * outElem;
+            int n = std::min((int)in[0], maxOut);
+            std::vector<Detection> dets;
+            for (int i = 0; i < n; ++i) {
+                const Detection& det = ((const Detection*)(in + 1))[i];
+                if (det.conf > confThresh) dets.push_back(det);
+            }
+            std::sort(dets.begin(), dets.end(), nmsBefore);
+            std::vector<bool> removed(dets.size(), false);
+            int kept = 0;
+            for (size_t i = 0; i < dets.size() && kept < topK; ++i) {
+                if (removed[i]) continue;
+                ((Detection*)(out + 1))[kept++] = dets[i];
+                for (size_t j = i + 1; j < dets.size(); ++j) {
+                    if (!removed[j] && dets[j].class_id == dets[i].class_id && nmsIou(dets[i].bbox, dets[j].bbox) > nmsThresh)
+                        removed[j] = true;
+                }
+            }
+            out[0] = kept;
+        }
+    }
+
+    // one block per batch item: bitonic sort of the decoded boxes in shared memory, then greedy
+    // suppression where the block tests the next kept box against all later ones in parallel
+    __global__ void NmsTopK(const float* raw, float* output, int maxOut, int rawElem, int outElem, int topK, float confThresh, float nmsThresh)
+    {
+        __shared__ Detection dets[NMS_MAX_BOX];
+        __shared__ int order[NMS_MAX_BOX];
+        __shared__ bool removed[NMS_MAX_BOX];
+        __shared__ int candidates;
+        const float* in = raw + blockIdx.x * rawElem;
+        float* out = output + blockIdx.x * outElem;
+        int n = min((int)in[0], maxOut);
+
+        if (threadIdx.x == 0) candidates = 0;
+        __syncthreads();
+        for (int i = threadIdx.x; i < NMS_MAX_BOX; i += blockDim.x) {
+            order[i] = i;
+            removed[i] = true;
+            if (i < n) {
+                dets[i] = ((const Detection*)(in + 1))[i];
+                removed[i] = !(dets[i].conf > confThresh);
+            }
+            if (removed[i]) {
+                // sorts behind every candidate
+                dets[i].conf = -1.0f;
+                dets[i].class_id = 0;
+                for (int k = 0; k < LOCATIONS; ++k) dets[i].bbox[k] = 0;
+            } else {
+                atomicAdd(&candidates, 1);
+            }
+        }
+        __syncthreads();
+
+        for (int k = 2; k <= NMS_MAX_BOX; k <<= 1) {
+            for (int j = k >> 1; j > 0; j >>= 1) {
+                for (int i = threadIdx.x; i < NMS_MAX_BOX; i += blockDim.x) {
+                    int ixj = i ^ j;
+                    if (ixj <= i) continue;
+                    const Detection& a = dets[order[i]];
+                    const Detection& b = dets[order[ixj]];
+                    if ((i & k) == 0 ? nmsBefore(b, a) : nmsBefore(a, b)) {
+                        int t = order[i];
+                        order[i] = order[ixj];
+                        order[ixj] = t;
+                    }
+                }
+                __syncthreads();
+            }
+        }
+
+        // every thread walks the same sequence, removed[] only changes before the barrier
+        int kept = 0;
+        for (int i = 0; i < candidates && kept < topK; ++i) {
+            int a = order[i];
+            if (removed[a]) continue;
+            if (threadIdx.x == 0) ((Detection*)(out + 1))[kept] = dets[a];
+            kept++;
+            for (int j = i + 1 + threadIdx.x; j < candidates; j += blockDim.x) {
+                int b = order[j];
+                if (!removed[b] && dets[b].class_id == dets[a].class_id && nmsIou(dets[a].bbox, dets[b].bbox) > nmsThresh)
+                    removed[b] = true;
+            }
+            __syncthreads();
+        }
+        if (threadIdx.x == 0) out[0] = kept;
+    }
+
+    void nmsGpu(const float* raw, float* output, int batchSize, int maxOut, int topK, float confThresh, float nmsThresh, cudaStream_t stream)
+    {
+        assert(maxOut <= NMS_MAX_BOX && topK <= maxOut);
+        const int threadCount = 256;
+        int rawElem = 1 + maxOut * sizeof(Detection) / sizeof(float);
+        int outElem = 1 + topK * sizeof(Detection) / sizeof(float);
+        NmsTopK << < batchSize, threadCount, 0, stream >> > (raw, output, maxOut, rawElem, outElem, topK, confThresh, nmsThresh);
+    }
+}
+
 namespace nvinfer1
 {
-    YoloLayerPlugin::YoloLayerPlugin(int classCount, int netWidth, int netHeight, int maxOut, const std::vector<Yolo::YoloKernel>& vYoloKernel)
+    YoloLayerPlugin::YoloLayerPlugin(int classCount, int netWidth, int netHeight, int maxOut, const std::vector<Yolo::YoloKernel>& vYoloKernel, int topK, float confThresh, float nmsThresh, const std::vector<float>& classMin)
     {
         mClassCount = classCount;
         mYoloV5NetWidth = netWidth;
@@ -33,23 +361,16 @@ namespace nvinfer1
         mMaxOutObject = maxOut;
         mYoloKernel = vYoloKernel;
         mKernelCount = vYoloKernel.size();
-
-        CUDA_CHECK(cudaMallocHost(&mAnchor, mKernelCount * sizeof(void*)));
-        size_t AnchorLen = sizeof(float)* CHECK_COUNT * 2;
-        for (int ii = 0; ii < mKernelCount; ii++)
-        {
-            CUDA_CHECK(cudaMalloc(&mAnchor[ii], AnchorLen));
-            const auto& yolo = mYoloKernel[ii];
-            CUDA_CHECK(cudaMemcpy(mAnchor[ii], yolo.anchors, AnchorLen, cudaMemcpyHostToDevice));
-        }
+        mTopK = topK;
+        mConfThresh = confThresh;
+        mNmsThresh = nmsThresh;
+        mClassMin = classMin;
+        assert(mKernelCount <= MAX_KERNEL_COUNT);
+        assert(mClassMin.empty() || ((int)mClassMin.size() == mClassCount && mClassCount <= MAX_FILTER_CLASSES));
+        assert(mTopK <= mMaxOutObject && (mTopK == 0 || mMaxOutObject <= NMS_MAX_BOX));
     }
     YoloLayerPlugin::~YoloLayerPlugin()
     {
-        for (int ii = 0; ii < mKernelCount; ii++)
-        {
-            CUDA_CHECK(cudaFree(mAnchor[ii]));
-        }
-        CUDA_CHECK(cudaFreeHost(mAnchor));
     }
 
     // create the plugin at runtime from a byte stream
@@ -67,14 +388,24 @@ namespace nvinfer1
         auto kernelSize = mKernelCount * sizeof(YoloKernel);
         memcpy(mYoloKernel.data(), d, kernelSize);
         d += kernelSize;
-        CUDA_CHECK(cudaMallocHost(&mAnchor, mKernelCount * sizeof(void*)));
-        size_t AnchorLen = sizeof(float)* CHECK_COUNT * 2;
-        for (int ii = 0; ii < mKernelCount; ii++)
-        {
-            CUDA_CHECK(cudaMalloc(&mAnchor[ii], AnchorLen));
-            const auto& yolo = mYoloKernel[ii];
-            CUDA_CHECK(cudaMemcpy(mAnchor[ii], yolo.anchors, AnchorLen, cudaMemcpyHostToDevice));
+        // engines serialized before the NMS stage existed end here
+        mTopK = 0;
+        mConfThresh = 0;
+        mNmsThresh = 0;
+        if (d < a + length) {
+            read(d, mTopK);
+            read(d, mConfThresh);
+            read(d, mNmsThresh);
         }
+        // and before the class filter
+        if (d < a + length) {
+            int classes;
+            read(d, classes);
+            mClassMin.resize(classes);
+            memcpy(mClassMin.data(), d, classes * sizeof(float));
+            d += classes * sizeof(float);
+        }
+        assert(mKernelCount <= MAX_KERNEL_COUNT);
         assert(d == a + length);
     }
 
@@ -91,13 +422,19 @@ namespace nvinfer1
         auto kernelSize = mKernelCount * sizeof(YoloKernel);
         memcpy(d, mYoloKernel.data(), kernelSize);
         d += kernelSize;
+        write(d, mTopK);
+        write(d, mConfThresh);
+        write(d, mNmsThresh);
+        write(d, (int)mClassMin.size());
+        memcpy(d, mClassMin.data(), mClassMin.size() * sizeof(float));
+        d += mClassMin.size() * sizeof(float);
 
         assert(d == a + getSerializationSize());
     }
 
     size_t YoloLayerPlugin::getSerializationSize() const
     {
-        return sizeof(mClassCount) + sizeof(mThreadCount) + sizeof(mKernelCount) + sizeof(Yolo::YoloKernel) * mYoloKernel.size() + sizeof(mYoloV5NetWidth) + sizeof(mYoloV5NetHeight) + sizeof(mMaxOutObject);
+        return sizeof(mClassCount) + sizeof(mThreadCount) + sizeof(mKernelCount) + sizeof(Yolo::YoloKernel) * mYoloKernel.size() + sizeof(mYoloV5NetWidth) + sizeof(mYoloV5NetHeight) + sizeof(mMaxOutObject) + sizeof(mTopK) + sizeof(mConfThresh) + sizeof(mNmsThresh) + sizeof(int) + sizeof(float) * mClassMin.size();
     }
 
     int YoloLayerPlugin::initialize()
@@ -107,8 +444,8 @@ namespace nvinfer1
 
     Dims YoloLayerPlugin::getOutputDimensions(int index, const Dims* inputs, int nbInputDims)
     {
-        //output the result to channel
-        int totalsize = mMaxOutObject * sizeof(Detection) / sizeof(float);
+        //output the result to channel, only the top-K boxes once they are suppressed on the device
+        int totalsize = (mTopK > 0 ? mTopK : mMaxOutObject) * sizeof(Detection) / sizeof(float);
 
         return Dims3(totalsize + 1, 1, 1);
     }
@@ -172,91 +509,26 @@ namespace nvinfer1
     // Clone the plugin
     IPluginV2IOExt* YoloLayerPlugin::clone() const
     {
-        YoloLayerPlugin* p = new YoloLayerPlugin(mClassCount, mYoloV5NetWidth, mYoloV5NetHeight, mMaxOutObject, mYoloKernel);
+        YoloLayerPlugin* p = new YoloLayerPlugin(mClassCount, mYoloV5NetWidth, mYoloV5NetHeight, mMaxOutObject, mYoloKernel, mTopK, mConfThresh, mNmsThresh, mClassMin);
         p->setPluginNamespace(mPluginNamespace);
         return p;
     }
 
-    __device__ float Logist(float data) { return 1.0f / (1.0f + expf(-data)); };
-
-    __global__ void CalDetection(const float *input, float *output, int noElements,
-        const int netwidth, const int netheight, int maxoutobject, int yoloWidth, int yoloHeight, const float anchors[CHECK_COUNT * 2], int classes, int outputElem)
-    {
-
-        int idx = threadIdx.x + blockDim.x * blockIdx.x;
-        if (idx >= noElements) return;
-
-        int total_grid = yoloWidth * yoloHeight;
-        int bnIdx = idx / total_grid;
-        idx = idx - total_grid * bnIdx;
-        int info_len_i = 5 + classes;
-        const float* curInput = input + bnIdx * (info_len_i * total_grid * CHECK_COUNT);
-
-        for (int k = 0; k < 3; ++k) {
-            float box_prob = Logist(curInput[idx + k * info_len_i * total_grid + 4 * total_grid]);
-            if (box_prob < IGNORE_THRESH) continue;
-            int class_id = 0;
-            float max_cls_prob = 0.0;
-            for (int i = 5; i < info_len_i; ++i) {
-                float p = Logist(curInput[idx + k * info_len_i * total_grid + i * total_grid]);
-                if (p > max_cls_prob) {
-                    max_cls_prob = p;
-                    class_id = i - 5;
-                }
-            }
-            float *res_count = output + bnIdx * outputElem;
-            int count = (int)atomicAdd(res_count, 1);
-            if (count >= maxoutobject) return;
-            char* data = (char *)res_count + sizeof(float) + count * sizeof(Detection);
-            Detection* det = (Detection*)(data);
-
-            int row = idx / yoloWidth;
-            int col = idx % yoloWidth;
-
-            //Location
-            // pytorch:
-            //  y = x[i].sigmoid()
-            //  y[..., 0:2] = (y[..., 0:2] * 2. - 0.5 + self.grid[i].to(x[i].device)) * self.stride[i]  # xy
-            //  y[..., 2:4] = (y[..., 2:4] * 2) ** 2 * self.anchor_grid[i]  # wh 
-            //  X: (sigmoid(tx) + cx)/FeaturemapW *  netwidth 
-            det->bbox[0] = (col - 0.5f + 2.0f * Logist(curInput[idx + k * info_len_i * total_grid + 0 * total_grid])) * netwidth / yoloWidth;
-            det->bbox[1] = (row - 0.5f + 2.0f * Logist(curInput[idx + k * info_len_i * total_grid + 1 * total_grid])) * netheight / yoloHeight;
-
-            // W: (Pw * e^tw) / FeaturemapW * netwidth  
-            // v5: https://github.com/ultralytics/yolov5/issues/471
-            det->bbox[2] = 2.0f * Logist(curInput[idx + k * info_len_i * total_grid + 2 * total_grid]);
-            det->bbox[2] = det->bbox[2] * det->bbox[2] * anchors[2 * k];
-            det->bbox[3] = 2.0f * Logist(curInput[idx + k * info_len_i * total_grid + 3 * total_grid]);
-            det->bbox[3] = det->bbox[3] * det->bbox[3] * anchors[2 * k + 1];
-            det->conf = box_prob * max_cls_prob;
-            det->class_id = class_id;
-        }
-    }
-
     void YoloLayerPlugin::forwardGpu(const float *const * inputs, float* output, cudaStream_t stream, int batchSize)
     {
-        int outputElem = 1 + mMaxOutObject * sizeof(Detection) / sizeof(float);
-        for (int idx = 0; idx < batchSize; ++idx) {
-            CUDA_CHECK(cudaMemset(output + idx * outputElem, 0, sizeof(float)));
-        }
-        int numElem = 0;
-        for (unsigned int i = 0; i < mYoloKernel.size(); ++i)
-        {
-            const auto& yolo = mYoloKernel[i];
-            numElem = yolo.width*yolo.height*batchSize; 
-            if (numElem < mThreadCount)
-                mThreadCount = numElem;
-
-            //printf("Net: %d  %d \n", mYoloV5NetWidth, mYoloV5NetHeight);
-            CalDetection << < (yolo.width*yolo.height*batchSize + mThreadCount - 1) / mThreadCount, mThreadCount >> >
-                (inputs[i], output, numElem, mYoloV5NetWidth, mYoloV5NetHeight, mMaxOutObject, yolo.width, yolo.height, (float *)mAnchor[i], mClassCount, outputElem);
-        }
+        decodeGpu(inputs, output, mYoloKernel, batchSize, mYoloV5NetWidth, mYoloV5NetHeight, mMaxOutObject, mClassCount, stream, mClassMin.empty() ? nullptr : mClassMin.data());
     }
 
-
     int YoloLayerPlugin::enqueue(int batchSize, const void*const * inputs, void** outputs, void* workspace, cudaStream_t stream)
     {
-        forwardGpu((const float *const *)inputs, (float*)outputs[0], stream, batchSize);
+        if (mTopK > 0) {
+            // decode into the workspace, the output only receives what survives NMS
+            float* raw = (float*)workspace;
+            forwardGpu((const float *const *)inputs, raw, stream, batchSize);
+            nmsGpu(raw, (float*)outputs[0], batchSize, mMaxOutObject, mTopK, mConfThresh, mNmsThresh, stream);
+        } else {
+            forwardGpu((const float *const *)inputs, (float*)outputs[0], stream, batchSize);
+        }
         return 0;
     }
 
@@ -292,6 +564,10 @@ namespace nvinfer1
         int input_w = -1;
         int input_h = -1;
         int max_output_object_count = -1;
+        int top_k = 0;
+        float conf_thresh = 0;
+        float nms_thresh = 0;
+        std::vector<float> class_min;
         std::vector<Yolo::YoloKernel> yolo_kernels(3);
 
         const PluginField* fields = fc->fields;
@@ -313,10 +589,20 @@ namespace nvinfer1
                     kernel.anchors[j] = tmp[j + 2];
                 }
                 yolo_kernels[2 - (fields[i].name[8] - '1')] = kernel;
+            } else if (strcmp(fields[i].name, "nmsdata") == 0) {
+                assert(fields[i].type == PluginFieldType::kFLOAT32);
+                const float *tmp = (const float*)(fields[i].data);
+                top_k = (int)tmp[0];
+                conf_thresh = tmp[1];
+                nms_thresh = tmp[2];
+            } else if (strcmp(fields[i].name, "classdata") == 0) {
+                assert(fields[i].type == PluginFieldType::kFLOAT32);
+                const float *tmp = (const float*)(fields[i].data);
+                class_min.assign(tmp, tmp + fields[i].length);
             }
         }
         assert(class_count && input_w && input_h && max_output_object_count);
-        YoloLayerPlugin* obj = new YoloLayerPlugin(class_count, input_w, input_h, max_output_object_count, yolo_kernels);
+        YoloLayerPlugin* obj = new YoloLayerPlugin(class_count, input_w, input_h, max_output_object_count, yolo_kernels, top_k, conf_thresh, nms_thresh, class_min);
         obj->setPluginNamespace(mNamespace.c_str());
         return obj;
     }
@@ -17,8 +17,10 @@ namespace Yolo
     };
     static constexpr int MAX_OUTPUT_BBOX_COUNT = 1000;
     static constexpr int CLASS_NUM = 80;
+    // default network input, engines can be built for any multiple of 32 (see -s ... -r WxH)
     static constexpr int INPUT_H = 608;
     static constexpr int INPUT_W = 608;
+    static constexpr int INPUT_ALIGN = 32;
 
     static constexpr int LOCATIONS = 4;
     struct alignas(float) Detection {
@@ -27,6 +29,33 @@ namespace Yolo
         float conf;  // bbox_conf * cls_conf
         float class_id;
     };
+
+    static constexpr int MAX_KERNEL_COUNT = 3;
+
+    // Per-class score floors of a class filter: a box of class c is kept if its score is
+    // above classMin[c]. CLASS_ANY keeps every box of a class, CLASS_OFF none.
+    static constexpr float CLASS_ANY = -1.0f;
+    static constexpr float CLASS_OFF = 1.0f;
+    // most classes a filter built into the engine can have
+    static constexpr int MAX_FILTER_CLASSES = 256;
+
+    // Decodes the raw head tensors into the plugin output: per batch item a float
+    // detection count followed by up to maxOut Detection records, in no particular order.
+    // With classMin (one floor per class) boxes the filter drops are not written and take
+    // no slot. decodeGpu runs on the device and is what the plugin enqueues; decodeCpu is
+    // the host reference it is checked against (see -b).
+    void decodeGpu(const float *const * inputs, float* output, const std::vector<YoloKernel>& kernels, int batchSize, int netWidth, int netHeight, int maxOut, int classes, cudaStream_t stream, const float* classMin = nullptr);
+    void decodeCpu(const float *const * inputs, float* output, const std::vector<YoloKernel>& kernels, int batchSize, int netWidth, int netHeight, int maxOut, int classes, const float* classMin = nullptr);
+
+    // largest maxOut the device NMS sorts in shared memory
+    static constexpr int NMS_MAX_BOX = 1024;
+
+    // Optional stage after the decode: keeps the boxes above confThresh, runs class-aware NMS
+    // and writes the topK best per batch item as a float count followed by the Detection
+    // records, highest score first. nmsCpu is the host reference; both keep the same boxes as
+    // nms() in common.hpp, which only differs in the order it returns them.
+    void nmsGpu(const float* raw, float* output, int batchSize, int maxOut, int topK, float confThresh, float nmsThresh, cudaStream_t stream);
+    void nmsCpu(const float* raw, float* output, int batchSize, int maxOut, int topK, float confThresh, float nmsThresh);
 }
 
 namespace nvinfer1
@@ -34,7 +63,7 @@ namespace nvinfer1
     class YoloLayerPlugin : public IPluginV2IOExt
     {
     public:
-        YoloLayerPlugin(int classCount, int netWidth, int netHeight, int maxOut, const std::vector<Yolo::YoloKernel>& vYoloKernel);
+        YoloLayerPlugin(int classCount, int netWidth, int netHeight, int maxOut, const std::vector<Yolo::YoloKernel>& vYoloKernel, int topK = 0, float confThresh = 0, float nmsThresh = 0, const std::vector<float>& classMin = std::vector<float>());
         YoloLayerPlugin(const void* data, size_t length);
         ~YoloLayerPlugin();
 
@@ -49,7 +78,11 @@ namespace nvinfer1
 
         virtual void terminate() override {};
 
-        virtual size_t getWorkspaceSize(int maxBatchSize) const override { return 0; }
+        virtual size_t getWorkspaceSize(int maxBatchSize) const override
+        {
+            // the device NMS reads the full decode from here
+            return mTopK > 0 ? maxBatchSize * (1 + mMaxOutObject * sizeof(Yolo::Detection) / sizeof(float)) * sizeof(float) : 0;
+        }
 
         virtual int enqueue(int batchSize, const void*const * inputs, void** outputs, void* workspace, cudaStream_t stream) override;
 
@@ -88,7 +121,7 @@ namespace nvinfer1
 
     private:
         void forwardGpu(const float *const * inputs, float * output, cudaStream_t stream, int batchSize = 1);
-        int mThreadCount = 256;
+        int mThreadCount = 256;  // unused, kept so that existing engines still deserialize
         const char* mPluginNamespace;
         int mKernelCount;
         int mClassCount;
@@ -96,7 +129,10 @@ namespace nvinfer1
         int mYoloV5NetHeight;
         int mMaxOutObject;
         std::vector<Yolo::YoloKernel> mYoloKernel;
-        void** mAnchor;
+        int mTopK;  // 0 outputs the raw decode for nms() on the host
+        float mConfThresh;
+        float mNmsThresh;
+        std::vector<float> mClassMin;  // empty, or the score floor of every class for the decode
     };
 
     class YoloPluginCreator : public IPluginCreator
@@ -5,6 +5,9 @@
 #include <exception>
 #include <vector>
 #include <atomic>
+#include <random>
+#include <iomanip>
+#include <sstream>
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/types.hpp>
@@ -15,29 +18,91 @@
 #include "logging.h"
 #include "common.hpp"
 #include "utils.h"
+#include "dir_scanner.hpp"
+#include "evaluate.hpp"
 #include "calibrator.h"
 #include "passing_one_obj.hpp"
+#include "async_logger.hpp"
+#include "executor.hpp"
+#include "cluster.hpp"
+#include "overlay.hpp"
+#include "recorder.hpp"
+#include "passthrough.hpp"
+#include "membudget.hpp"
+#include "shm_ring.hpp"
+#include "capture.hpp"
+#include "classfilter.hpp"
+#include "placement.hpp"
+#include "taskpool.hpp"
+#include "trace.hpp"
+#include "bench.hpp"
 
 #define USE_FP16  // set USE_INT8 or USE_FP16 or USE_FP32
 #define DEVICE 0  // GPU id
 #define NMS_THRESH 0.4
 #define CONF_THRESH 0.5
 #define BATCH_SIZE 1
+#define NUM_WORKERS 2  // execution contexts running batches of the video sources concurrently
+#define CPU_THREADS 4  // work-stealing pool for letterboxing, image decoding, NMS and drawing, 0 to do it all on the calling threads
+#define DAEMON_MAX_SOURCES 64  // sources a -daemon can run at once
+#define PLACEMENT "off"   // cores of the threads: "off", "auto" from the /sys topology, or e.g. "main=0 infer=1,2 pool=3-6 decode=8-15 encode=8-15"
+#define PLACEMENT_NODE -1  // NUMA node "auto" keeps threads and frames on, -1 for the node of the GPU
+#define NMS_TOP_K 100  // boxes kept per image by engines built with -nms, the thresholds above are baked in
+#define EVAL_CONF_THRESH 0.001  // score threshold of -e for host NMS, low as usual for mAP; engines built with -nms keep CONF_THRESH
+#define CLASSES ""  // classes kept of sources without a #classes= of their own, e.g. "0,2:0.6,7" for persons, cars above 0.6 and trucks, "" for all
+
+#define BINARY_LOG ""  // set to a file name to write the pipeline log in binary form, decode it with -l
+#define TRACE_FILE ""  // set to a .json file to record the stages of every frame on every thread, for chrome://tracing or Perfetto
+#define MEMORY_BUDGET_MB 0      // memory the pipeline may hold, 0 for no limit. queues shrink from 70%, frames are scaled down from 85%, no new sources from 95%
+#define MEMORY_METRICS_FILE ""  // set to a .prom file to export the memory usage for the node exporter textfile collector
+#define REDUCED_WIDTH 1280      // width frames are scaled down to under memory pressure
+#define CAPTURE_REPORT_SEC 30  // seconds between the grabbed/retrieved reports of live sources
 
 #define IMGSHOW_COLS 960
 #define IMGSHOW_ROWS 540
+#define SHOW_WINDOW true   // mosaic window of -f/-c, with SAVE_VIDEO false too nothing is drawn at all
+#define SAVE_VIDEO true    // per-source AVI files of the mosaic tiles
+#define PASSTHROUGH_RECORD false  // with SAVE_VIDEO, keep the original stream and a .det sidecar instead of encoding tiles, see -play
+#define PASSTHROUGH_CAMERAS false // with PASSTHROUGH_RECORD, also copy -c cameras, over a second RTSP session each; otherwise their tiles are encoded
+#define RECORD_EVENTS false     // with SAVE_VIDEO, only record clips around detections of RECORD_CLASSES
+#define RECORD_CLASSES {0}      // class ids that start a clip, 0 is person in COCO
+#define RECORD_HOLDOFF_SEC 5    // a clip ends this long after the last trigger
+#define RECORD_PREROLL_SEC 3    // and starts this long before the first one
+#define RECORD_PREROLL_MB 8     // memory cap of the JPEG pre-roll of one source
 
 // stuff we know about the network and the input/output blobs
-static const int INPUT_H = Yolo::INPUT_H;
-static const int INPUT_W = Yolo::INPUT_W;
 static const int CLASS_NUM = Yolo::CLASS_NUM;
 static const int OUTPUT_SIZE = Yolo::MAX_OUTPUT_BBOX_COUNT * sizeof(Yolo::Detection) / sizeof(float) + 1;  // we assume the yololayer outputs no more than MAX_OUTPUT_BBOX_COUNT boxes that conf >= 0.1
 const char* INPUT_BLOB_NAME = "data";
 const char* OUTPUT_BLOB_NAME = "prob";
+const char* OUTPUT_NMS_BLOB_NAME = "prob_nms";  // output of engines that run NMS on the device
 static Logger gLogger;
 
+// input geometry of a deserialized engine, read from its bindings
+struct EngineInfo {
+    int input_index;
+    int output_index;
+    int input_w;
+    int input_h;
+    bool packed_u8;     // input is letterboxed uint8 BGR HWC, converted by the preprocess layer
+    bool device_nms;    // output holds the boxes kept by NMS on the device, best first
+    int output_size;    // floats per image of the output binding
+
+    // bytes per image of the input binding
+    size_t input_bytes() const {
+        return packed_u8 ? (size_t)3 * input_h * input_w : (size_t)3 * input_h * input_w * sizeof(float);
+    }
+};
+
 std::vector<passing_one_obj<cv::Mat> *> frame_vec;
+std::vector<FrameClock *> clock_vec;  // arrival times of camera frames for passthrough recording
 std::atomic<bool> exit_flag(false);
+const std::chrono::steady_clock::time_point process_start = std::chrono::steady_clock::now();
+
+static double ms_since_start()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - process_start).count();
+}
 
 
 static int get_width(int x, float gw, int divisor = 8) {
@@ -56,11 +121,19 @@ static int get_depth(int x, float gd) {
     }
 }
 
-ICudaEngine* build_engine(unsigned int maxBatchSize, IBuilder* builder, IBuilderConfig* config, DataType dt, float& gd, float& gw, std::string& wts_name) {
+ICudaEngine* build_engine(unsigned int maxBatchSize, IBuilder* builder, IBuilderConfig* config, DataType dt, float& gd, float& gw, std::string& wts_name, int input_w, int input_h, bool packed_u8, bool device_nms, const std::vector<float>& class_min) {
     INetworkDefinition* network = builder->createNetworkV2(0U);
 
-    // Create input tensor of shape {3, INPUT_H, INPUT_W} with name INPUT_BLOB_NAME
-    ITensor* data = network->addInput(INPUT_BLOB_NAME, dt, Dims3{ 3, INPUT_H, INPUT_W });
+    ITensor* data;
+    if (packed_u8) {
+        // Create input tensor of letterboxed uint8 BGR HWC pixels packed four to an int32, {input_h, input_w * 3 / 4}
+        ITensor* packed = network->addInput(INPUT_BLOB_NAME, DataType::kINT32, DimsHW{ input_h, input_w * 3 / 4 });
+        assert(packed);
+        data = addPreprocessLayer(network, *packed, input_w, input_h)->getOutput(0);
+    } else {
+        // Create input tensor of shape {3, input_h, input_w} with name INPUT_BLOB_NAME
+        data = network->addInput(INPUT_BLOB_NAME, dt, Dims3{ 3, input_h, input_w });
+    }
     assert(data);
 
     std::map<std::string, Weights> weightMap = loadWeights(wts_name);
@@ -119,8 +192,8 @@ ICudaEngine* build_engine(unsigned int maxBatchSize, IBuilder* builder, IBuilder
     auto bottleneck_csp23 = C3(network, weightMap, *cat22->getOutput(0), get_width(1024, gw), get_width(1024, gw), get_depth(3, gd), false, 1, 0.5, "model.23");
     IConvolutionLayer* det2 = network->addConvolutionNd(*bottleneck_csp23->getOutput(0), 3 * (Yolo::CLASS_NUM + 5), DimsHW{ 1, 1 }, weightMap["model.24.m.2.weight"], weightMap["model.24.m.2.bias"]);
 
-    auto yolo = addYoLoLayer(network, weightMap, det0, det1, det2);
-    yolo->getOutput(0)->setName(OUTPUT_BLOB_NAME);
+    auto yolo = addYoLoLayer(network, weightMap, det0, det1, det2, input_w, input_h, device_nms ? NMS_TOP_K : 0, CONF_THRESH, NMS_THRESH, class_min);
+    yolo->getOutput(0)->setName(device_nms ? OUTPUT_NMS_BLOB_NAME : OUTPUT_BLOB_NAME);
     network->markOutput(*yolo->getOutput(0));
 
     // Build engine
@@ -132,8 +205,11 @@ ICudaEngine* build_engine(unsigned int maxBatchSize, IBuilder* builder, IBuilder
     std::cout << "Your platform support int8: " << (builder->platformHasFastInt8() ? "true" : "false") << std::endl;
     assert(builder->platformHasFastInt8());
     config->setFlag(BuilderFlag::kINT8);
-    Int8EntropyCalibrator2* calibrator = new Int8EntropyCalibrator2(1, INPUT_W, INPUT_H, "./coco_calib/", "int8calib.table", INPUT_BLOB_NAME);
-    config->setInt8Calibrator(calibrator);
+    // letterboxed calibration images are cached per input size, so rebuilding another variant skips decoding
+    std::string tensor_cache = "int8calib_" + std::to_string(input_w) + "x" + std::to_string(input_h) + ".tensors";
+    // outlives buildEngineWithConfig below; its destructor joins the decode workers and removes an unfinished cache
+    std::unique_ptr<Int8EntropyCalibrator2> calibrator(new Int8EntropyCalibrator2(1, input_w, input_h, "./coco_calib/", "int8calib.table", INPUT_BLOB_NAME, true, 0, 1, packed_u8, tensor_cache.c_str()));
+    config->setInt8Calibrator(calibrator.get());
 #endif
 
     std::cout << "Building engine, please wait for a while..." << std::endl;
@@ -152,13 +228,13 @@ ICudaEngine* build_engine(unsigned int maxBatchSize, IBuilder* builder, IBuilder
     return engine;
 }
 
-void APIToModel(unsigned int maxBatchSize, IHostMemory** modelStream, float& gd, float& gw, std::string& wts_name) {
+void APIToModel(unsigned int maxBatchSize, IHostMemory** modelStream, float& gd, float& gw, std::string& wts_name, int input_w, int input_h, bool packed_u8, bool device_nms, const std::vector<float>& class_min) {
     // Create builder
     IBuilder* builder = createInferBuilder(gLogger);
     IBuilderConfig* config = builder->createBuilderConfig();
 
     // Create model to populate the network, then set the outputs and create an engine
-    ICudaEngine* engine = build_engine(maxBatchSize, builder, config, DataType::kFLOAT, gd, gw, wts_name);
+    ICudaEngine* engine = build_engine(maxBatchSize, builder, config, DataType::kFLOAT, gd, gw, wts_name, input_w, input_h, packed_u8, device_nms, class_min);
     assert(engine != nullptr);
 
     // Serialize the engine
@@ -170,39 +246,932 @@ void APIToModel(unsigned int maxBatchSize, IHostMemory** modelStream, float& gd,
     config->destroy();
 }
 
-void doInference(IExecutionContext& context, cudaStream_t& stream, void **buffers, float* input, float* output, int batchSize) {
+bool read_engine_info(ICudaEngine* engine, EngineInfo& info) {
+    if (engine->getNbBindings() != 2) return false;
+    info.input_index = engine->getBindingIndex(INPUT_BLOB_NAME);
+    info.output_index = engine->getBindingIndex(OUTPUT_BLOB_NAME);
+    info.device_nms = info.output_index < 0;
+    if (info.device_nms)
+        info.output_index = engine->getBindingIndex(OUTPUT_NMS_BLOB_NAME);
+    if (info.input_index < 0 || info.output_index < 0) return false;
+    Dims out_dims = engine->getBindingDimensions(info.output_index);
+    info.output_size = out_dims.d[0];
+    if (info.output_size > OUTPUT_SIZE) return false;
+    Dims dims = engine->getBindingDimensions(info.input_index);
+    info.packed_u8 = engine->getBindingDataType(info.input_index) == DataType::kINT32;
+    if (info.packed_u8) {
+        if (dims.nbDims != 2) return false;
+        info.input_h = dims.d[0];
+        info.input_w = dims.d[1] * 4 / 3;
+    } else {
+        if (dims.nbDims != 3 || dims.d[0] != 3) return false;
+        info.input_h = dims.d[1];
+        info.input_w = dims.d[2];
+    }
+    return true;
+}
+
+// fills slot b of the host input buffer from a BGR image, the layout depends on the engine input
+void prepare_input(cv::Mat& img, void* input, int b, const EngineInfo& info) {
+    uchar* slot = (uchar*)input + b * info.input_bytes();
+    if (info.packed_u8) {
+        // the engine converts on the device, only letterbox straight into the input buffer
+        preprocess_img(img, info.input_w, info.input_h, slot);
+    } else {
+        cv::Mat pr_img = preprocess_img(img, info.input_w, info.input_h); // letterbox BGR to RGB
+        hwc_bgr_to_chw_rgb(pr_img.data, pr_img.step, info.input_w, info.input_h, (float*)slot);
+    }
+}
+
+// returns the number of bytes copied back from the device
+size_t doInference(IExecutionContext& context, cudaStream_t& stream, void **buffers, void* input, float* output, int batchSize, const EngineInfo& info) {
     // DMA input batch data to device, infer on the batch asynchronously, and DMA output back to host
-    CUDA_CHECK(cudaMemcpyAsync(buffers[0], input, batchSize * 3 * INPUT_H * INPUT_W * sizeof(float), cudaMemcpyHostToDevice, stream));
+    CUDA_CHECK(cudaMemcpyAsync(buffers[0], input, batchSize * info.input_bytes(), cudaMemcpyHostToDevice, stream));
     context.enqueue(batchSize, buffers, stream, nullptr);
-    CUDA_CHECK(cudaMemcpyAsync(output, buffers[1], batchSize * OUTPUT_SIZE * sizeof(float), cudaMemcpyDeviceToHost, stream));
+    if (!info.device_nms) {
+        CUDA_CHECK(cudaMemcpyAsync(output, buffers[1], batchSize * info.output_size * sizeof(float), cudaMemcpyDeviceToHost, stream));
+        cudaStreamSynchronize(stream);
+        return batchSize * info.output_size * sizeof(float);
+    }
+    // the boxes are compacted on the device, read the counts first and then only the used prefixes
+    const int det_size = sizeof(Yolo::Detection) / sizeof(float);
+    const float* dev_out = (const float*)buffers[1];
+    CUDA_CHECK(cudaMemcpy2DAsync(output, info.output_size * sizeof(float), dev_out, info.output_size * sizeof(float),
+                                 sizeof(float), batchSize, cudaMemcpyDeviceToHost, stream));
     cudaStreamSynchronize(stream);
+    size_t bytes = batchSize * sizeof(float);
+    for (int b = 0; b < batchSize; b++) {
+        size_t n = (size_t)output[b * info.output_size] * det_size;
+        if (n == 0) continue;
+        CUDA_CHECK(cudaMemcpyAsync(output + b * info.output_size + 1, dev_out + b * info.output_size + 1, n * sizeof(float), cudaMemcpyDeviceToHost, stream));
+        bytes += n * sizeof(float);
+    }
+    cudaStreamSynchronize(stream);
+    return bytes;
 }
 
-void read_video_src(const std::string& video_src, const int& src_id)
+// boxes of image b of the output, the engine may already have run NMS. classes, if set, drops
+// the boxes of other classes before host NMS, or the kept boxes of device NMS.
+void get_detections(std::vector<Yolo::Detection>& res, float* output, int b, const EngineInfo& info, const classfilter::Filter* classes = nullptr, float conf_thresh = CONF_THRESH) {
+    float* out = output + b * info.output_size;
+    if (!info.device_nms) {
+        nms(res, out, conf_thresh, NMS_THRESH, classes ? classes->min_scores().data() : nullptr);
+        return;
+    }
+    const Yolo::Detection* dets = (const Yolo::Detection*)(out + 1);
+    res.clear();
+    for (int i = 0; i < (int)out[0]; i++)
+        if (!classes || classes->keeps(dets[i])) res.push_back(dets[i]);
+}
+
+// the CPU work on the images of a batch and on the mosaic tiles, shared by the executor workers and the display loop
+TaskPool& cpu_pool() {
+    static TaskPool pool(CPU_THREADS, true);
+    return pool;
+}
+
+// one execution context of the shared engine, with its own stream and buffers
+class TrtBackend : public InferBackend {
+public:
+    TrtBackend(ICudaEngine* engine, const EngineInfo& info)
+        : info_(info)
+        , input_(BATCH_SIZE * info.input_bytes())
+        , output_(BATCH_SIZE * info.output_size)
+        // host and device buffers, on Jetson both come out of the same memory
+        , charge_(membudget::kInference, 2 * (input_.size() * sizeof(input_[0]) + output_.size() * sizeof(float)))
+    {
+        context_ = engine->createExecutionContext();
+        assert(context_ != nullptr);
+        CUDA_CHECK(cudaMalloc(&buffers_[info.input_index], BATCH_SIZE * info.input_bytes()));
+        CUDA_CHECK(cudaMalloc(&buffers_[info.output_index], BATCH_SIZE * info.output_size * sizeof(float)));
+        CUDA_CHECK(cudaStreamCreate(&stream_));
+    }
+
+    ~TrtBackend() {
+        cudaStreamDestroy(stream_);
+        CUDA_CHECK(cudaFree(buffers_[0]));
+        CUDA_CHECK(cudaFree(buffers_[1]));
+        context_->destroy();
+    }
+
+    void start() override { cudaSetDevice(DEVICE); }
+
+    // the first inference of a context pays for lazy CUDA and TensorRT initialization, done on zeros before live frames
+    void warm_up() override {
+        auto t0 = std::chrono::steady_clock::now();
+        std::fill(input_.begin(), input_.end(), 0);
+        doInference(*context_, stream_, buffers_, input_.data(), output_.data(), BATCH_SIZE, info_);
+        ALOG_INFO("warm-up inference took {}ms", bench_ms(t0, std::chrono::steady_clock::now()));
+    }
+
+    int max_batch() const override { return BATCH_SIZE; }
+
+    void infer(std::vector<InferJob>& batch) override {
+        // every image is letterboxed into its own part of the input
+        cpu_pool().for_each((int)batch.size(), [&](int b) {
+            trace::Span span("preprocess", batch[b].source, batch[b].seq);
+            if (!batch[b].frame.empty())
+                prepare_input(batch[b].frame, input_.data(), b, info_);
+        });
+        {
+            trace::Span span("inference");
+            doInference(*context_, stream_, buffers_, input_.data(), output_.data(), batch.size(), info_);
+        }
+        cpu_pool().for_each((int)batch.size(), [&](int b) {
+            trace::Span span("nms", batch[b].source, batch[b].seq);
+            batch[b].dets.clear();
+            if (!batch[b].frame.empty())
+                get_detections(batch[b].dets, output_.data(), b, info_, batch[b].classes.get());
+        });
+    }
+
+private:
+    EngineInfo info_;
+    IExecutionContext* context_;
+    cudaStream_t stream_;
+    void* buffers_[2];
+    std::vector<uchar> input_;
+    std::vector<float> output_;
+    membudget::Charge charge_;
+};
+
+// decode and device NMS of random head tensors: device against the host references, and throughput
+void bench_decode(int input_w, int input_h, int iterations, cudaStream_t& stream) {
+    const float anchors[Yolo::MAX_KERNEL_COUNT][Yolo::CHECK_COUNT * 2] = {
+        {10, 13, 16, 30, 33, 23}, {30, 61, 62, 45, 59, 119}, {116, 90, 156, 198, 373, 326}};
+    std::vector<Yolo::YoloKernel> kernels(Yolo::MAX_KERNEL_COUNT);
+    std::vector<std::vector<float>> host(kernels.size());
+    std::vector<float*> dev(kernels.size());
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> logit(-10.0f, 3.0f);
+    std::uniform_int_distribution<int> pick(0, CLASS_NUM - 1);
+    for (size_t h = 0; h < kernels.size(); h++) {
+        int stride = 8 << h;
+        kernels[h].width = input_w / stride;
+        kernels[h].height = input_h / stride;
+        memcpy(kernels[h].anchors, anchors[h], sizeof(kernels[h].anchors));
+        int grid = kernels[h].width * kernels[h].height;
+        host[h].resize((size_t)BATCH_SIZE * Yolo::CHECK_COUNT * (5 + CLASS_NUM) * grid);
+        for (auto& v : host[h]) v = logit(rng);
+        for (size_t a = 0; a < host[h].size() / ((5 + CLASS_NUM) * grid); a++) {
+            float* cell = &host[h][a * (5 + CLASS_NUM) * grid];
+            for (int i = 0; i < grid; i++) {
+                cell[4 * grid + i] = (rng() % 64) ? -6.0f : logit(rng) + 4.0f;  // about 1.5% objects
+                // saturated class scores tie at 1.0, the first class must win
+                if (rng() % 8 == 0) {
+                    cell[(5 + pick(rng)) * grid + i] = 17.0f;
+                    cell[(5 + pick(rng)) * grid + i] = 30.0f;
+                }
+            }
+        }
+        CUDA_CHECK(cudaMalloc((void**)&dev[h], host[h].size() * sizeof(float)));
+        CUDA_CHECK(cudaMemcpyAsync(dev[h], host[h].data(), host[h].size() * sizeof(float), cudaMemcpyHostToDevice, stream));
+    }
+    std::vector<const float*> host_in;
+    for (auto& v : host) host_in.push_back(v.data());
+    float* dev_out;
+    std::vector<float> out_ref(BATCH_SIZE * OUTPUT_SIZE), out_gpu(BATCH_SIZE * OUTPUT_SIZE);
+    CUDA_CHECK(cudaMalloc((void**)&dev_out, out_gpu.size() * sizeof(float)));
+
+    Yolo::decodeGpu(dev.data(), dev_out, kernels, BATCH_SIZE, input_w, input_h, Yolo::MAX_OUTPUT_BBOX_COUNT, CLASS_NUM, stream);
+    CUDA_CHECK(cudaMemcpyAsync(out_gpu.data(), dev_out, out_gpu.size() * sizeof(float), cudaMemcpyDeviceToHost, stream));
+    cudaStreamSynchronize(stream);
+    auto c0 = std::chrono::steady_clock::now();
+    Yolo::decodeCpu(host_in.data(), out_ref.data(), kernels, BATCH_SIZE, input_w, input_h, Yolo::MAX_OUTPUT_BBOX_COUNT, CLASS_NUM);
+    auto c1 = std::chrono::steady_clock::now();
+
+    // the device writes in any order, pair every reference box with an identical device box
+    const int det_size = sizeof(Yolo::Detection) / sizeof(float);
+    auto compare = [&](size_t& boxes, size_t& mismatches) {
+        for (int b = 0; b < BATCH_SIZE; b++) {
+            const float* ref = &out_ref[b * OUTPUT_SIZE];
+            const float* gpu = &out_gpu[b * OUTPUT_SIZE];
+            int n = std::min((int)ref[0], Yolo::MAX_OUTPUT_BBOX_COUNT);
+            if (ref[0] != gpu[0]) mismatches++;
+            std::vector<bool> used(n, false);
+            for (int i = 0; i < n; i++) {
+                const float* r = ref + 1 + i * det_size;
+                bool found = false;
+                for (int j = 0; j < n && !found; j++) {
+                    const float* g = gpu + 1 + j * det_size;
+                    if (used[j] || r[5] != g[5]) continue;
+                    found = true;
+                    for (int k = 0; k < 5; k++)  // host and device expf may differ in the last bits
+                        found = found && std::fabs(r[k] - g[k]) <= 1e-5f * std::max(1.0f, std::fabs(r[k]));
+                    if (found) used[j] = true;
+                }
+                mismatches += !found;
+            }
+            boxes += n;
+        }
+    };
+    size_t boxes = 0, mismatches = 0;
+    compare(boxes, mismatches);
+
+    auto g0 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++)
+        Yolo::decodeGpu(dev.data(), dev_out, kernels, BATCH_SIZE, input_w, input_h, Yolo::MAX_OUTPUT_BBOX_COUNT, CLASS_NUM, stream);
+    cudaStreamSynchronize(stream);
+    auto g1 = std::chrono::steady_clock::now();
+    std::cout << "decode: " << boxes << " boxes, " << mismatches << " mismatches against the host reference; device "
+              << 1e3 * bench_ms(g0, g1) / iterations << "us/batch, host reference " << 1e3 * bench_ms(c0, c1) << "us/batch" << std::endl;
+
+    // the same with a class filter in the decode, as built with -classes
+    classfilter::Filter filter;
+    filter.parse(strlen(CLASSES) ? CLASSES : "0,2:0.6,7");
+    const float* class_min = filter.min_scores().data();
+    Yolo::decodeGpu(dev.data(), dev_out, kernels, BATCH_SIZE, input_w, input_h, Yolo::MAX_OUTPUT_BBOX_COUNT, CLASS_NUM, stream, class_min);
+    CUDA_CHECK(cudaMemcpyAsync(out_gpu.data(), dev_out, out_gpu.size() * sizeof(float), cudaMemcpyDeviceToHost, stream));
+    cudaStreamSynchronize(stream);
+    Yolo::decodeCpu(host_in.data(), out_ref.data(), kernels, BATCH_SIZE, input_w, input_h, Yolo::MAX_OUTPUT_BBOX_COUNT, CLASS_NUM, class_min);
+    size_t filtered = 0, filtered_mismatches = 0;
+    compare(filtered, filtered_mismatches);
+    auto f0 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++)
+        Yolo::decodeGpu(dev.data(), dev_out, kernels, BATCH_SIZE, input_w, input_h, Yolo::MAX_OUTPUT_BBOX_COUNT, CLASS_NUM, stream, class_min);
+    cudaStreamSynchronize(stream);
+    auto f1 = std::chrono::steady_clock::now();
+    std::cout << "decode with class filter " << filter.str() << ": " << filtered << " of " << boxes << " boxes written, " << filtered_mismatches
+              << " mismatches against the host reference; device " << 1e3 * bench_ms(f0, f1) / iterations << "us/batch" << std::endl;
+
+    // device NMS on the device decode, which must match the host reference exactly
+    const int nms_size = 1 + NMS_TOP_K * det_size;
+    std::vector<float> nms_ref(BATCH_SIZE * nms_size), nms_gpu(BATCH_SIZE * nms_size);
+    float* dev_nms;
+    CUDA_CHECK(cudaMalloc((void**)&dev_nms, nms_gpu.size() * sizeof(float)));
+    Yolo::decodeGpu(dev.data(), dev_out, kernels, BATCH_SIZE, input_w, input_h, Yolo::MAX_OUTPUT_BBOX_COUNT, CLASS_NUM, stream);
+    CUDA_CHECK(cudaMemcpyAsync(out_gpu.data(), dev_out, out_gpu.size() * sizeof(float), cudaMemcpyDeviceToHost, stream));
+    Yolo::nmsGpu(dev_out, dev_nms, BATCH_SIZE, Yolo::MAX_OUTPUT_BBOX_COUNT, NMS_TOP_K, CONF_THRESH, NMS_THRESH, stream);
+    CUDA_CHECK(cudaMemcpyAsync(nms_gpu.data(), dev_nms, nms_gpu.size() * sizeof(float), cudaMemcpyDeviceToHost, stream));
+    cudaStreamSynchronize(stream);
+    Yolo::nmsCpu(out_gpu.data(), nms_ref.data(), BATCH_SIZE, Yolo::MAX_OUTPUT_BBOX_COUNT, NMS_TOP_K, CONF_THRESH, NMS_THRESH);
+    size_t kept = 0, nms_mismatches = 0, used_bytes = 0;
+    for (int b = 0; b < BATCH_SIZE; b++) {
+        int n = (int)nms_ref[b * nms_size];
+        kept += n;
+        used_bytes += (1 + n * det_size) * sizeof(float);
+        nms_mismatches += memcmp(&nms_ref[b * nms_size], &nms_gpu[b * nms_size], (1 + n * det_size) * sizeof(float)) != 0;
+    }
+
+    auto n0 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++)
+        Yolo::nmsGpu(dev_out, dev_nms, BATCH_SIZE, Yolo::MAX_OUTPUT_BBOX_COUNT, NMS_TOP_K, CONF_THRESH, NMS_THRESH, stream);
+    cudaStreamSynchronize(stream);
+    auto n1 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        for (int b = 0; b < BATCH_SIZE; b++) {
+            std::vector<float> raw(out_gpu.begin() + b * OUTPUT_SIZE, out_gpu.begin() + (b + 1) * OUTPUT_SIZE);
+            std::vector<Yolo::Detection> res;
+            nms(res, raw.data(), CONF_THRESH, NMS_THRESH);
+        }
+    }
+    auto n2 = std::chrono::steady_clock::now();
+    for (auto p : dev) CUDA_CHECK(cudaFree(p));
+    CUDA_CHECK(cudaFree(dev_out));
+    CUDA_CHECK(cudaFree(dev_nms));
+    std::cout << "device nms: " << kept << " boxes kept, " << nms_mismatches << " mismatches against the host reference; device "
+              << 1e3 * bench_ms(n0, n1) / iterations << "us/batch, host nms() " << 1e3 * bench_ms(n1, n2) / iterations
+              << "us/batch saved; " << used_bytes / BATCH_SIZE << " bytes/frame copied instead of " << OUTPUT_SIZE * sizeof(float) << std::endl;
+}
+
+// frames of synthetic://[WxH] sources: a box moving over a plain background at 25 fps, for
+// exercising the pipelines without cameras
+static void read_synthetic_src(const std::string& video_src, passing_one_obj<cv::Mat>* dst, const std::atomic<bool>& stop)
+{
+    int w = 1280, h = 720;
+    sscanf(video_src.c_str() + strlen("synthetic://"), "%dx%d", &w, &h);
+    auto next = std::chrono::steady_clock::now();
+    for (int i = 0; !stop.load(); i++) {
+        cv::Mat frame(h, w, CV_8UC3, cv::Scalar(90, 120, 150));
+        int x = (i * 8) % std::max(w - w / 4, 1);
+        cv::rectangle(frame, cv::Rect(x, h / 3, w / 4, h / 3), cv::Scalar(40, 40, 200), -1);
+        {
+            trace::Span span("send", -1, i);
+            dst->send(frame);
+        }
+        next += std::chrono::milliseconds(40);
+        std::this_thread::sleep_until(next);
+    }
+}
+
+// frames a decoder process (-p) publishes into a shared-memory ring. the frame is copied out of
+// the slot because it outlives it in the pipeline, and dropped if the writer reused the slot during
+// the copy; a decoder that dies or restarts only pauses it.
+static void read_shm_src(const std::string& video_src, passing_one_obj<cv::Mat>* dst, const std::atomic<bool>& stop)
+{
+    shm::FrameReader reader(video_src);
+    shm::Frame f;
+    while (!stop.load()) {
+        if (!reader.next(f, 100)) continue;
+        cv::Mat frame = f.view.clone();
+        if (reader.valid(f))
+            dst->send(frame);
+    }
+}
+
+// frames grabbed from a capture versus those decoded to BGR, and the CPU time the decoding took
+struct CaptureStats {
+    uint64_t grabbed = 0;
+    uint64_t retrieved = 0;
+    int64_t retrieve_ns = 0;
+};
+
+static void report_capture(const std::string& video_src, const CaptureStats& stats)
+{
+    if (!stats.retrieved) return;
+    double retrieve_ms = stats.retrieve_ns / 1e6 / stats.retrieved;
+    ALOG_INFO("source {}: {} frames grabbed, {} retrieved, {}ms/retrieve, {}ms of CPU saved on skipped frames",
+              video_src, stats.grabbed, stats.retrieved, retrieve_ms, retrieve_ms * (stats.grabbed - stats.retrieved));
+}
+
+// logs the memory usage and exports it to MEMORY_METRICS_FILE, at most every CAPTURE_REPORT_SEC
+static void report_memory()
 {
+    static auto last = std::chrono::steady_clock::now();
+    auto now = std::chrono::steady_clock::now();
+    if (now - last < std::chrono::seconds(CAPTURE_REPORT_SEC)) return;
+    last = now;
+    ALOG_INFO("{}", membudget::budget().summary());
+    if (strlen(MEMORY_METRICS_FILE) && !membudget::budget().export_metrics(MEMORY_METRICS_FILE))
+        ALOG_EVERY_MS(alog::Severity::kWARNING, 60000, "cannot write memory metrics to {}", MEMORY_METRICS_FILE);
+}
+
+// frames of a capture made with -cap: replay://<file> at the pace they were captured at,
+// replay-fast://<file> as fast as the pipeline takes them. with -f no frame is dropped, so a
+// replay gets the same frames to the engine in every run.
+static void read_replay_src(const std::string& video_src, passing_one_obj<cv::Mat>* dst, const std::atomic<bool>& stop)
+{
+    bool fast = video_src.compare(0, strlen("replay-fast://"), "replay-fast://") == 0;
+    std::string path = video_src.substr(video_src.find("://") + 3);
+    capture::Reader reader;
+    if (!reader.open(path)) {
+        ALOG_ERROR("cannot read capture {}", path);
+        return;
+    }
+    ALOG_INFO("replaying {}: {} frames{}", path, (uint64_t)reader.frames(), reader.letterboxed() ? ", letterboxed" : "");
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < reader.frames() && !stop.load(); i++) {
+        if (!fast)
+            std::this_thread::sleep_until(start + std::chrono::microseconds(reader.t_us(i) - reader.t_us(0)));
+        // the frame outlives the mapping in the pipeline
+        cv::Mat frame = reader.frame(i).clone();
+        trace::Span span("send", -1, i);
+        dst->send(frame);
+    }
+}
+
+// reads a video file, camera stream, shared-memory ring, capture or synthetic source into dst until it ends or
+// stop is set. clock, if set, gets the arrival time of every frame handed out, or for a passing that must not
+// drop (files) the position of the frame in the stream, in us. a #classes= filter of the source is ignored here.
+void read_source(const std::string& source, passing_one_obj<cv::Mat>* dst, const std::atomic<bool>& stop, FrameClock* clock = nullptr)
+{
+    const std::string video_src = classfilter::url_of(source);
+    trace::tracer().set_thread_name("reader " + video_src);
+    placement::placement().pin(placement::kDecode);
+    if (video_src.compare(0, strlen("synthetic://"), "synthetic://") == 0) {
+        read_synthetic_src(video_src, dst, stop);
+        return;
+    }
+    if (video_src.compare(0, strlen("shm://"), "shm://") == 0) {
+        read_shm_src(video_src, dst, stop);
+        return;
+    }
+    if (video_src.compare(0, strlen("replay://"), "replay://") == 0 || video_src.compare(0, strlen("replay-fast://"), "replay-fast://") == 0) {
+        read_replay_src(video_src, dst, stop);
+        return;
+    }
     cv::VideoCapture cap(video_src); 
     
     // Check if camera opened successfully
     if(!cap.isOpened()){
-        std::cout << "error opening video source." << std::endl;
+        ALOG_ERROR("error opening video source {}", video_src);
         return;
     } 
 
-    while (!exit_flag.load()) {
+    // live sources: every packet is grabbed to keep the stream current, but a frame is only converted
+    // to BGR once the consumer has taken the previous one. a passing that must not drop (files) gets all.
+    CaptureStats stats;
+    // the frame waiting in the passing, the executor charges it once the consumer took it
+    membudget::Charge slot(membudget::kFrames);
+    auto last_report = std::chrono::steady_clock::now();
+    while (!stop.load()) {
+        if (!dst->is_object_present())
+            slot.set(0);
+        {
+            trace::Span span("grab", -1, stats.grabbed);
+            if (!cap.grab())
+                break;
+        }
+        int64_t arrival = !clock ? 0 : dst->is_sync() ? (int64_t)(cap.get(cv::CAP_PROP_POS_MSEC) * 1000) : wall_us();
+        stats.grabbed++;
+        if (!dst->is_sync() && dst->is_object_present())
+            continue;
         cv::Mat frame;
-        cap >> frame;
-        if (frame.empty())
-            break;
-        frame_vec[src_id]->send(frame);
+        int64_t cpu0 = thread_cpu_ns();
+        {
+            trace::Span span("retrieve", -1, stats.grabbed - 1);
+            if (!cap.retrieve(frame) || frame.empty())
+                break;
+            // under memory pressure large frames are scaled down before they are passed on
+            if (membudget::budget().level() >= membudget::kReduceResolution && frame.cols > REDUCED_WIDTH)
+                cv::resize(frame, frame, cv::Size(REDUCED_WIDTH, frame.rows * REDUCED_WIDTH / frame.cols), 0, 0, cv::INTER_LINEAR);
+        }
+        stats.retrieve_ns += thread_cpu_ns() - cpu0;
+        stats.retrieved++;
+        slot.set(frame.total() * frame.elemSize());
+        if (stats.retrieved == 1)
+            ALOG_INFO("source {}: first frame after {}ms", video_src, ms_since_start());
+        if (clock)
+            clock->stamp(frame, arrival);
+        {
+            // a file waits here until the pipeline took the frame before
+            trace::Span span("send", -1, stats.grabbed - 1);
+            dst->send(frame);
+        }
+        if (std::chrono::steady_clock::now() - last_report >= std::chrono::seconds(CAPTURE_REPORT_SEC)) {
+            last_report = std::chrono::steady_clock::now();
+            report_capture(video_src, stats);
+        }
     }
+    report_capture(video_src, stats);
     cap.release();
     return;
 }
 
+void read_video_src(const std::string& video_src, const int& src_id)
+{
+    read_source(video_src, frame_vec[src_id], exit_flag, clock_vec.empty() ? nullptr : clock_vec[src_id]);
+}
+
+// the sources of a worker or daemon, each in a slot of one executor. sources are added, removed,
+// paused and throttled while the executor and the other sources keep running.
+class StreamSet {
+public:
+    StreamSet(std::vector<std::unique_ptr<InferBackend>> backends, int slots)
+        : slots_(slots), executor_(std::move(backends), slots, 2 * slots)
+    {
+        for (int i = slots - 1; i >= 0; i--) free_slots_.push_back(i);
+    }
+
+    ~StreamSet() {
+        while (!streams_.empty()) remove(streams_.begin()->first);
+        while (!draining_.empty()) {
+            reap();
+            if (!draining_.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+
+    bool empty() const { return streams_.empty(); }
+    bool has(int id) const { return streams_.count(id) > 0; }
+    bool full() const { return free_slots_.empty(); }
+    double utilization() { return executor_.utilization(); }
+
+    // false if the id is taken, all slots are, or the #classes= of the url is malformed
+    bool add(int id, const std::string& url) {
+        std::shared_ptr<const classfilter::Filter> classes;
+        if (has(id) || full() || !classfilter::for_source(url, CLASSES, classes)) return false;
+        std::unique_ptr<Stream> st(new Stream());
+        st->url = url;
+        st->classes = classes;
+        st->slot = free_slots_.back();
+        free_slots_.pop_back();
+        Stream* sp = st.get();
+        st->reader = std::async(std::launch::async, [sp, url] { read_source(url, &sp->frames, sp->stop); });
+        streams_[id] = std::move(st);
+        return true;
+    }
+
+    // stops the reader without waiting for it, a reader stuck in a grab would hold up every other
+    // source. its slot is freed once the reader has returned, see reap()
+    bool remove(int id) {
+        auto it = streams_.find(id);
+        if (it == streams_.end()) return false;
+        it->second->stop = true;
+        draining_.push_back(std::move(it->second));
+        streams_.erase(it);
+        return true;
+    }
+
+    // a paused camera is only grabbed, its frames are neither converted nor inferred
+    bool pause(int id, bool paused) {
+        if (!has(id)) return false;
+        streams_[id]->paused = paused;
+        return true;
+    }
+
+    // at most max_fps frames a second of the source are inferred, 0 for all
+    bool set_fps(int id, double max_fps) {
+        if (!has(id) || max_fps < 0) return false;
+        streams_[id]->min_interval = std::chrono::microseconds(max_fps > 0 ? (long)(1e6 / max_fps) : 0);
+        return true;
+    }
+
+    // one line per source: <id> <url> running|paused <max fps> <frames inferred>
+    std::vector<std::string> list() const {
+        std::vector<std::string> lines;
+        for (auto& kv : streams_) {
+            const Stream& st = *kv.second;
+            std::ostringstream ss;
+            ss << kv.first << " " << st.url << " " << (st.paused ? "paused" : "running") << " "
+               << (st.min_interval.count() ? 1e6 / st.min_interval.count() : 0) << " " << st.frame;
+            lines.push_back(ss.str());
+        }
+        return lines;
+    }
+
+    // infers a frame of every running source that has one, concurrently, and hands the results to
+    // done(id, frame number, job) in id order. returns the number of frames, ended gets the sources
+    // whose reader finished; they stay in the set until removed.
+    int round(const std::function<void(int, uint64_t, InferJob&)>& done, std::vector<int>& ended) {
+        reap();
+        executor_.set_capacity(membudget::budget().level() >= membudget::kShrinkQueues ? slots_ : 2 * slots_);
+        auto now = std::chrono::steady_clock::now();
+        std::vector<int> ids;
+        for (auto& kv : streams_) {
+            Stream& st = *kv.second;
+            if (st.reader.wait_for(std::chrono::seconds(0)) == std::future_status::ready && !st.frames.is_object_present()) {
+                ended.push_back(kv.first);
+            } else if (!st.paused && st.frames.is_object_present() && now - st.last_submit >= st.min_interval) {
+                st.last_submit = now;
+                executor_.submit(st.slot, st.frames.receive(), st.classes);
+                ids.push_back(kv.first);
+            }
+        }
+        for (int id : ids) {
+            InferJob job;
+            Stream& st = *streams_[id];
+            if (!executor_.next(st.slot, job)) break;
+            done(id, st.frame++, job);
+        }
+        return (int)ids.size();
+    }
+
+private:
+    // frees the slots of the removed sources whose reader has returned
+    void reap() {
+        for (auto it = draining_.begin(); it != draining_.end();) {
+            Stream& st = **it;
+            // a reader blocked in send() needs its frame taken
+            if (st.frames.is_object_present()) st.frames.receive();
+            if (st.reader.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                ++it;
+                continue;
+            }
+            free_slots_.push_back(st.slot);
+            it = draining_.erase(it);
+        }
+    }
+
+    struct Stream {
+        std::string url;
+        int slot;               // source index within the executor
+        std::shared_ptr<const classfilter::Filter> classes;
+        uint64_t frame = 0;
+        bool paused = false;
+        std::chrono::microseconds min_interval{0};
+        std::chrono::steady_clock::time_point last_submit;
+        std::atomic<bool> stop;
+        passing_one_obj<cv::Mat> frames;
+        std::future<void> reader;
+        Stream() : stop(false), frames(false) {}
+    };
+
+    int slots_;
+    InferExecutor executor_;
+    std::vector<int> free_slots_;
+    std::map<int, std::unique_ptr<Stream>> streams_;
+    std::vector<std::unique_ptr<Stream>> draining_;    // removed, their reader has not returned yet
+};
+
+// worker process of a coordinator (-w): infers the sources assigned to it on its backends and
+// streams the detections back. capacity is the number of sources it offers to take.
+int run_worker(const std::string& addr, int capacity, std::vector<std::unique_ptr<InferBackend>> backends)
+{
+    cluster::LineConn conn(cluster::open_socket(addr, false));
+    if (conn.fd() < 0) {
+        ALOG_ERROR("worker: cannot connect to coordinator {}", addr);
+        return -1;
+    }
+    char host[64] = "";
+    gethostname(host, sizeof(host) - 1);
+    conn.send_line("HELLO " + std::string(host) + ":" + std::to_string(getpid()) + " " + std::to_string(capacity));
+
+    StreamSet streams(std::move(backends), capacity);
+    placement::placement().pin(placement::kMain);
+    auto last_load = std::chrono::steady_clock::now();
+    int rc = 0;
+    while (!exit_flag.load()) {
+        pollfd p;
+        p.fd = conn.fd();
+        p.events = POLLIN;
+        if (poll(&p, 1, streams.empty() ? 200 : 0) > 0) {
+            std::vector<std::string> lines;
+            bool alive = conn.read_lines(lines);
+            for (auto& line : lines) {
+                std::istringstream ss(line);
+                std::string cmd, url;
+                int s = -1;
+                ss >> cmd >> s;
+                if (cmd == "ASSIGN" && membudget::budget().level() >= membudget::kRefuseSources) {
+                    ALOG_WARN("worker: source {} refused, {}", s, membudget::budget().summary());
+                    conn.send_line("REFUSE " + std::to_string(s));
+                } else if (cmd == "ASSIGN" && (ss >> url) && streams.add(s, url)) {
+                    ALOG_INFO("worker: source {} {}", s, url);
+                } else if (cmd == "REVOKE" && streams.remove(s)) {
+                    ALOG_INFO("worker: source {} revoked", s);
+                }
+            }
+            if (!alive) {
+                ALOG_ERROR("worker: lost the coordinator");
+                rc = -1;
+                break;
+            }
+        }
+
+        // one round: a frame of every source that has one, inferred concurrently
+        report_memory();
+        std::vector<int> ended;
+        int n = streams.round([&](int s, uint64_t frame, InferJob& job) {
+            conn.send_line(format_detections(s, frame, job.dets));
+        }, ended);
+        for (int s : ended) {
+            streams.remove(s);
+            conn.send_line("EOS " + std::to_string(s));
+        }
+        if (n == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_load >= std::chrono::seconds(1)) {
+            last_load = now;
+            std::ostringstream ss;
+            ss << "LOAD " << streams.utilization();
+            conn.send_line(ss.str());
+        }
+    }
+    return rc;
+}
+
+// long-running service (-daemon): starts without sources and takes commands on a local control
+// socket, one per line, answered with OK or ERR <reason>:
+//   ADD <id> <url>           PAUSE <id>        SET <id> fps <max frames/s, 0 for all>
+//   REMOVE <id>              RESUME <id>       LIST (one "SOURCE <id> <url> <state> <fps> <frames>" line each)
+//   QUIT
+// detections are printed like the coordinator's, sources that end are removed.
+int run_daemon(const std::string& addr, int max_sources, std::vector<std::unique_ptr<InferBackend>> backends)
+{
+    // the control socket takes commands without authentication, so it must not be reachable from other hosts
+    if (!cluster::is_local(addr)) {
+        ALOG_ERROR("daemon: {} is not a unix: path or a loopback address", addr);
+        return -1;
+    }
+    int listen_fd = cluster::open_socket(addr, true);
+    if (listen_fd < 0) {
+        ALOG_ERROR("daemon: cannot listen on {}", addr);
+        return -1;
+    }
+    ALOG_INFO("daemon: control socket {}, up to {} sources", addr, max_sources);
+    StreamSet streams(std::move(backends), max_sources);
+    placement::placement().pin(placement::kMain);
+    std::map<int, std::unique_ptr<cluster::LineConn>> clients;
+    while (!exit_flag.load()) {
+        std::vector<pollfd> fds(1);
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (auto& kv : clients) {
+            pollfd p;
+            p.fd = kv.first;
+            p.events = POLLIN;
+            fds.push_back(p);
+        }
+        poll(fds.data(), fds.size(), streams.empty() ? 200 : 0);
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) clients[fd].reset(new cluster::LineConn(fd));
+        }
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (!fds[i].revents) continue;
+            cluster::LineConn& conn = *clients[fds[i].fd];
+            std::vector<std::string> lines;
+            bool alive = conn.read_lines(lines);
+            for (auto& line : lines) {
+                std::istringstream ss(line);
+                std::string cmd, arg;
+                int id = -1;
+                ss >> cmd >> id;
+                std::string err;
+                if (cmd == "ADD") {
+                    if (!(ss >> arg)) err = "usage: ADD <id> <url>";
+                    else if (streams.has(id)) err = "source exists";
+                    else if (streams.full() || membudget::budget().level() >= membudget::kRefuseSources) err = "no room for another source";
+                    else if (!streams.add(id, arg)) err = "bad class filter";
+                } else if (cmd == "REMOVE") {
+                    if (!streams.remove(id)) err = "no such source";
+                } else if (cmd == "PAUSE" || cmd == "RESUME") {
+                    if (!streams.pause(id, cmd == "PAUSE")) err = "no such source";
+                } else if (cmd == "SET") {
+                    double value = -1;
+                    if (!(ss >> arg >> value) || arg != "fps") err = "usage: SET <id> fps <value>";
+                    else if (!streams.set_fps(id, value)) err = "no such source";
+                } else if (cmd == "LIST") {
+                    for (auto& l : streams.list()) conn.send_line("SOURCE " + l);
+                } else if (cmd == "QUIT") {
+                    exit_flag.store(true);
+                } else {
+                    err = "unknown command";
+                }
+                if (err.empty()) ALOG_INFO("daemon: {}", line);
+                conn.send_line(err.empty() ? "OK" : "ERR " + err);
+            }
+            if (!alive) clients.erase(fds[i].fd);
+        }
 
-bool parse_args(int argc, char** argv, std::string& wts, std::string& engine, float& gd, float& gw, std::string& img_dir) {
-    if (argc < 4) return false;
-    if (std::string(argv[1]) == "-s" && (argc == 5 || argc == 7)) {
+        report_memory();
+        std::vector<int> ended;
+        int n = streams.round([](int id, uint64_t frame, InferJob& job) {
+            printf("%s\n", format_detections(id, frame, job.dets).c_str());
+        }, ended);
+        for (int id : ended) {
+            ALOG_INFO("daemon: source {} ended", id);
+            streams.remove(id);
+        }
+        fflush(stdout);
+        if (n == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    clients.clear();
+    close(listen_fd);
+    return 0;
+}
+
+// splits the arguments of -o after the engine into the files and the -det and -avi flags
+static void offline_args(int argc, char** argv, std::vector<std::string>& files, bool& detections, bool& annotate)
+{
+    for (int i = 3; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "-det") detections = true;
+        else if (arg == "-avi") annotate = true;
+        else files.push_back(arg);
+    }
+}
+
+// offline processing of archived files (-o), for throughput instead of a live view: no window, no pacing and no
+// mosaic. every file is read, submitted and collected on its own, so a fast or short file never waits for the
+// others, and enough frames are queued for every worker to run full batches. the detections of every frame
+// (-det, [name].det) and the annotated frames at full resolution ([name]-out.avi) are only written if asked for.
+// at the end the busy time of every stage, the frames/s of every file and the overall frames/s are printed.
+int run_offline(const std::vector<std::string>& files, std::vector<std::unique_ptr<InferBackend>> backends,
+                int input_w, int input_h, bool detections, bool annotate)
+{
+    int num_files = (int)files.size();
+    int batch = backends.empty() ? 1 : backends[0]->max_batch();
+    // frames in flight per file: all files together fill two batches of every worker
+    int depth = std::max(2, (int)(2 * backends.size() * batch + num_files - 1) / num_files);
+    // the stages are timed by their trace spans
+    trace::tracer().set_totals(true);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<passing_one_obj<cv::Mat>>> frames;
+    std::vector<std::future<void>> readers;
+    for (int f = 0; f < num_files; f++) {
+        frames.emplace_back(new passing_one_obj<cv::Mat>(true));  // no frame of a file is dropped
+        readers.push_back(std::async(std::launch::async, read_source, files[f], frames[f].get(), std::cref(exit_flag), (FrameClock*)nullptr));
+    }
+    std::vector<std::unique_ptr<DetectionSidecar>> sidecars(num_files);
+    std::vector<cv::VideoWriter> writers(num_files);
+    std::vector<std::string> names(num_files);
+    std::vector<std::shared_ptr<const classfilter::Filter>> classes(num_files);
+    for (int f = 0; f < num_files; f++) {
+        classfilter::for_source(files[f], CLASSES, classes[f]);
+        // replay://cam1.y5cap writes cam1.det
+        std::string url = classfilter::url_of(files[f]);
+        size_t scheme = url.find("://");
+        std::string path = scheme == std::string::npos ? url : url.substr(scheme + 3);
+        names[f] = path.substr(0, path.find_last_of("."));
+        if (detections)
+            sidecars[f].reset(new DetectionSidecar(names[f] + ".det", false, input_w, input_h));
+    }
+
+    InferExecutor executor(std::move(backends), num_files, (size_t)depth * num_files);
+    std::vector<int> in_flight(num_files, 0);
+    std::vector<bool> finished(num_files, false);
+    std::vector<uint64_t> results(num_files, 0), det_hash(num_files, capture::kHashSeed);
+    std::vector<double> seconds(num_files, 0);
+    std::vector<std::vector<InferJob>> done(num_files);
+    overlay::Renderer renderer;
+    placement::placement().pin(placement::kMain);
+    int left = num_files;
+    while (left > 0 && !exit_flag.load()) {
+        report_memory();
+        int limit = membudget::budget().level() >= membudget::kShrinkQueues ? 1 : depth;
+        bool progress = false;
+        for (int f = 0; f < num_files; f++) {
+            if (finished[f]) continue;
+            // checked first: once the reader has ended, a frame it sent is present or already taken
+            bool ended = readers[f].wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+            while (in_flight[f] < limit && frames[f]->is_object_present()) {
+                trace::Span span("submit", f);
+                executor.submit(f, frames[f]->receive(), classes[f]);
+                in_flight[f]++;
+                progress = true;
+            }
+            InferJob job;
+            while (executor.try_next(f, job)) {
+                in_flight[f]--;
+                results[f]++;
+                det_hash[f] = capture::hash_detections(det_hash[f], job.dets.data(), job.dets.size() * sizeof(Yolo::Detection));
+                if (detections || annotate) done[f].push_back(std::move(job));
+                progress = true;
+            }
+            if (ended && in_flight[f] == 0 && !frames[f]->is_object_present()) {
+                finished[f] = true;
+                left--;
+                seconds[f] = bench_ms(start, std::chrono::steady_clock::now()) / 1000;
+                ALOG_INFO("offline: {} done, {} frames in {}s", files[f], results[f], seconds[f]);
+            }
+        }
+        // the results of different files are written in parallel, those of one file in order
+        cpu_pool().for_each(num_files, [&](int f) {
+            for (auto& job : done[f]) {
+                if (sidecars[f])
+                    sidecars[f]->write((int64_t)job.seq, job.dets);
+                if (!annotate || job.frame.empty()) continue;
+                cv::Mat out(job.frame.size(), job.frame.type());
+                {
+                    trace::Span span("annotate", f, job.seq);
+                    renderer.render(job.frame, job.dets, input_w, input_h, out);
+                }
+                trace::Span span("encode", f, job.seq);
+                if (!writers[f].isOpened())
+                    writers[f].open(names[f] + "-out.avi", cv::VideoWriter::fourcc('X', 'V', 'I', 'D'), 25.0, out.size(), true);
+                writers[f].write(out);
+            }
+            done[f].clear();
+        });
+        if (!progress)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // readers stopped early wait for their frame to be taken
+    for (int f = 0; f < num_files; f++)
+        while (readers[f].wait_for(std::chrono::milliseconds(5)) != std::future_status::ready)
+            if (frames[f]->is_object_present()) frames[f]->receive();
+    double sec = bench_ms(start, std::chrono::steady_clock::now()) / 1000;
+    for (auto& w : writers) w.release();
+    sidecars.clear();
+
+    std::vector<trace::Total> stages = trace::tracer().totals();
+    std::sort(stages.begin(), stages.end(), [](const trace::Total& a, const trace::Total& b) { return a.ns > b.ns; });
+    for (auto& s : stages) {
+        double busy = s.ns / 1e9;
+        // threads busy on average: decoders, workers and pool threads run a stage side by side
+        std::cout << "stage " << s.name << ": " << s.count << " calls, " << (s.count ? busy * 1000 / s.count : 0) << "ms each, "
+                  << (busy > 0 ? s.count / busy : 0) << "/s on one thread, " << busy / sec << " threads busy" << std::endl;
+    }
+    uint64_t total = 0;
+    for (int f = 0; f < num_files; f++) {
+        total += results[f];
+        double own = finished[f] ? seconds[f] : sec;
+        std::cout << "file " << files[f] << ": " << results[f] << " frames, " << (own > 0 ? results[f] / own : 0) << " frames/s, detections 0x"
+                  << std::hex << std::setw(16) << std::setfill('0') << det_hash[f] << std::dec << std::setfill(' ') << std::endl;
+    }
+    std::cout << "overall: " << total << " frames of " << num_files << " files in " << sec << "s, " << (sec > 0 ? total / sec : 0) << " frames/s" << std::endl;
+    return left == 0 ? 0 : -1;
+}
+
+// AP of every class of the dataset and their means, evaluated on the CPU pool
+void report_evaluation(const evaluate::Dataset& dataset, const std::vector<evaluate::Object>& dets) {
+    auto t0 = std::chrono::steady_clock::now();
+    evaluate::Result result = evaluate::evaluate(dataset, dets, cpu_pool());
+    double ms = bench_ms(t0, std::chrono::steady_clock::now());
+    std::cout << std::fixed << std::setprecision(3);
+    for (auto& c : result.classes) {
+        if (c.ap50 < 0) continue;
+        std::cout << "class " << c.category << " " << c.name << ": " << c.objects << " objects, " << c.detections << " detections, AP@0.5 "
+                  << c.ap50 << ", AP@0.5:0.95 " << c.ap << std::endl;
+    }
+    int classes = 0;
+    for (auto& c : result.classes) classes += c.ap50 >= 0;
+    std::cout << "mAP@0.5 " << result.map50 << ", mAP@0.5:0.95 " << result.map << " over " << classes << " classes" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+    std::cout << "evaluated " << dataset.objects.size() << " objects and " << dets.size() << " detections of " << dataset.images.size()
+              << " images in " << ms << "ms on " << std::max(1, cpu_pool().threads()) << " threads" << std::endl;
+}
+
+// every source, with CLASSES for those without a #classes= of their own, has a filter that parses
+bool valid_filters(const std::vector<std::string>& sources) {
+    std::shared_ptr<const classfilter::Filter> classes;
+    for (auto& src : sources) {
+        if (!classfilter::for_source(src, CLASSES, classes)) {
+            std::cerr << "bad class filter in " << src << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parse_args(int argc, char** argv, std::string& wts, std::string& engine, float& gd, float& gw, std::string& img_dir, int& shard_id, int& num_shards, std::string& checkpoint, int& input_w, int& input_h, bool& packed_u8, bool& device_nms, std::string& classes, int& iterations, std::string& log_path) {
+    if (argc < 3) return false;
+    if (std::string(argv[1]) == "-s" && argc >= 5) {
         wts = std::string(argv[2]);
         engine = std::string(argv[3]);
         auto net = std::string(argv[4]);
@@ -218,22 +1187,95 @@ bool parse_args(int argc, char** argv, std::string& wts, std::string& engine, fl
         } else if (net == "x") {
             gd = 1.33;
             gw = 1.25;
-        } else if (net == "c" && argc == 7) {
+        } else if (net == "c" && argc >= 7) {
             gd = atof(argv[5]);
             gw = atof(argv[6]);
         } else {
             return false;
         }
+        for (int i = net == "c" ? 7 : 5; i < argc; i++) {
+            std::string opt(argv[i]);
+            if (opt == "-r" && i + 1 < argc) {
+                if (sscanf(argv[++i], "%dx%d", &input_w, &input_h) != 2) return false;
+                if (input_w <= 0 || input_h <= 0 || input_w % Yolo::INPUT_ALIGN || input_h % Yolo::INPUT_ALIGN) {
+                    std::cerr << "input size must be a multiple of " << Yolo::INPUT_ALIGN << std::endl;
+                    return false;
+                }
+            } else if (opt == "-u8") {
+                packed_u8 = true;
+            } else if (opt == "-nms") {
+                device_nms = true;
+            } else if (opt == "-classes" && i + 1 < argc) {
+                classes = argv[++i];
+                classfilter::Filter filter;
+                if (!filter.parse(classes)) return false;
+            } else {
+                return false;
+            }
+        }
     } 
-    else if (std::string(argv[1]) == "-d" && argc == 4) {
+    else if (std::string(argv[1]) == "-d" && argc >= 4 && argc <= 6) {
         engine = std::string(argv[2]);
-        img_dir = std::string(argv[3]);
+        img_dir = classfilter::url_of(argv[3]);
+        if (!valid_filters(std::vector<std::string>(1, argv[3]))) return false;
+        if (argc >= 5) {
+            if (sscanf(argv[4], "%d/%d", &shard_id, &num_shards) != 2 || num_shards < 1 || shard_id < 0 || shard_id >= num_shards)
+                return false;
+        }
+        if (argc == 6)
+            checkpoint = std::string(argv[5]);
     } 
-    else if (std::string(argv[1]) == "-f") {
+    else if (std::string(argv[1]) == "-e" && (argc == 5 || argc == 6)) {
+        // image folder or detections, annotations and the detections to write are read from argv
+        engine = std::string(argv[2]);
+        if (engine == "-" && argc != 5) return false;
+    }
+    else if (std::string(argv[1]) == "-f" && argc >= 4) {
         engine = std::string(argv[2]);
+        if (!valid_filters(std::vector<std::string>(argv + 3, argv + argc))) return false;
     } 
-    else if (std::string(argv[1]) == "-c") {
+    else if (std::string(argv[1]) == "-c" && argc >= 4) {
         engine = std::string(argv[2]);
+        if (!valid_filters(std::vector<std::string>(argv + 3, argv + argc))) return false;
+    }
+    else if (std::string(argv[1]) == "-o" && argc >= 4) {
+        engine = std::string(argv[2]);
+        std::vector<std::string> files;
+        bool detections = false, annotate = false;
+        offline_args(argc, argv, files, detections, annotate);
+        if (files.empty() || !valid_filters(files)) return false;
+    }
+    else if (std::string(argv[1]) == "-coord" && argc >= 4) {
+        // listen address and sources are read from argv
+        if (!valid_filters(std::vector<std::string>(argv + 3, argv + argc))) return false;
+    }
+    else if (std::string(argv[1]) == "-w" && argc == 5) {
+        engine = std::string(argv[2]);
+        if (atoi(argv[4]) <= 0) return false;
+    }
+    else if (std::string(argv[1]) == "-daemon" && argc == 4) {
+        engine = std::string(argv[2]);
+    }
+    else if (std::string(argv[1]) == "-play" && argc == 3) {
+        // recording is read from argv
+    }
+    else if (std::string(argv[1]) == "-p" && argc == 4) {
+        // source and ring name are read from argv
+    }
+    else if (std::string(argv[1]) == "-cap" && (argc == 5 || argc == 6)) {
+        // source, capture file and frame count are read from argv
+        if (atol(argv[4]) < 0) return false;
+        if (argc == 6 && (sscanf(argv[5], "%dx%d", &input_w, &input_h) != 2 || input_w <= 0 || input_h <= 0)) return false;
+        if (argc == 5) input_w = input_h = 0;
+    }
+    else if (std::string(argv[1]) == "-l" && argc == 3) {
+        log_path = std::string(argv[2]);
+    }
+    else if (std::string(argv[1]) == "-b" && argc <= 4) {
+        engine = std::string(argv[2]);
+        if (argc == 4)
+            iterations = atoi(argv[3]);
+        if (iterations <= 0) return false;
     }
     else {
         return false;
@@ -248,19 +1290,54 @@ int main(int argc, char** argv) {
     std::string engine_name = "";
     float gd = 0.0f, gw = 0.0f;
     std::string img_dir;
-    if (!parse_args(argc, argv, wts_name, engine_name, gd, gw, img_dir)) {
+    int shard_id = 0, num_shards = 1;
+    std::string checkpoint;
+    int input_w = Yolo::INPUT_W, input_h = Yolo::INPUT_H;
+    bool packed_u8 = false;
+    bool device_nms = false;
+    std::string classes;
+    int iterations = 200;
+    std::string log_path;
+    if (!parse_args(argc, argv, wts_name, engine_name, gd, gw, img_dir, shard_id, num_shards, checkpoint, input_w, input_h, packed_u8, device_nms, classes, iterations, log_path)) {
         std::cerr << "arguments not right!" << std::endl;
-        std::cerr << "./yolov5 -s [.wts] [.engine] [s/m/l/x or c gd gw]  // serialize model to engine file." << std::endl;
-        std::cerr << "./yolov5 -d [.engine] [video-file-folder]     // run inference with multiple image files and save results." << std::endl;
+        std::cerr << "./yolov5 -s [.wts] [.engine] [s/m/l/x or c gd gw] [-r WxH] [-u8] [-nms] [-classes 0,2:0.6,7]  // serialize model to engine file, optionally with a WxH input (multiples of 32), a packed uint8 BGR input, NMS on the device and/or only the listed classes decoded." << std::endl;
+        std::cerr << "./yolov5 -d [.engine] [image-folder] [shard k/N] [checkpoint-file]     // run inference with multiple image files and save results." << std::endl;
         std::cerr << "./yolov5 -f [engine-file] [video-file1] [video-file2] [....]      // run inference with multiple video files and save result to output files." << std::endl;
         std::cerr << "./yolov5 -c [engine-file] [rtsp-cam1] [rtsp-cam2] [...]       // run inference with multiple rtsp Ipcam and save result to output files." << std::endl;
+        std::cerr << "                                  // any source can keep only some classes, above a score of their own: rtsp://cam1#classes=0,2:0.6,7" << std::endl;
+        std::cerr << "./yolov5 -o [engine-file or mock] [video-file1] [video-file2] [....] [-det] [-avi]      // process archived files as fast as possible, optionally writing detections and annotated videos, and report the frames/s per stage." << std::endl;
+        std::cerr << "./yolov5 -e [engine-file] [image-folder] [annotations.json] [detections.json]       // mAP@0.5 and mAP@0.5:0.95 per class on a COCO-format set, with the latency and throughput of the engine, optionally writing the detections." << std::endl;
+        std::cerr << "./yolov5 -e - [detections.json] [annotations.json]       // the same for detections exported in COCO results format." << std::endl;
+        std::cerr << "./yolov5 -b [engine-file or -] [iterations]       // benchmark the per-frame cost of an engine on synthetic 1080p frames, - runs the CPU benchmarks only." << std::endl;
+        std::cerr << "./yolov5 -coord [listen-address] [source1] [source2] [...]       // spread the sources over worker processes and print their merged detections." << std::endl;
+        std::cerr << "./yolov5 -w [engine-file or mock] [coordinator-address] [capacity]       // worker process taking up to capacity sources from a coordinator." << std::endl;
+        std::cerr << "./yolov5 -daemon [engine-file or mock] [control-address]       // long-running service, sources are added, removed, paused and throttled over the control socket." << std::endl;
+        std::cerr << "./yolov5 -play [recording]                  // plays a video file or stream recorded with PASSTHROUGH_RECORD, with the detections of its .det sidecar drawn in." << std::endl;
+        std::cerr << "./yolov5 -p [video-source] [ring-name]       // decoder process publishing the frames of a source into a shared-memory ring, read as shm://ring-name." << std::endl;
+        std::cerr << "./yolov5 -cap [video-source] [capture-file] [frames, 0 for all] [WxH]       // write the decoded frames of a source, or their WxH letterboxed input, to a capture read back as replay://capture-file or replay-fast://capture-file." << std::endl;
+        std::cerr << "./yolov5 -l [binary-log]       // print a log written with BINARY_LOG as text." << std::endl;
         return -1;
     }
 
+    if (std::string(argv[1]) == "-l") {
+        return alog::AsyncLogger::decode_binary(log_path.c_str(), stdout) < 0 ? -1 : 0;
+    }
+    if (strlen(BINARY_LOG) && !alog::logger().set_binary_output(BINARY_LOG)) {
+        std::cerr << "could not open " << BINARY_LOG << std::endl;
+    }
+    membudget::budget().set_limit((int64_t)MEMORY_BUDGET_MB << 20);
+    trace::Session tracing(TRACE_FILE);
+    // before any thread is started, they inherit the memory node
+    int placement_node = PLACEMENT_NODE >= 0 ? PLACEMENT_NODE : placement::gpu_node(DEVICE);
+    if (!placement::placement().configure(PLACEMENT, placement_node, NUM_WORKERS, CPU_THREADS))
+        return -1;
+
     // create a model using the API directly and serialize it to a stream
     if (std::string(argv[1]) == "-s" && !wts_name.empty()) {
         IHostMemory* modelStream{ nullptr };
-        APIToModel(BATCH_SIZE, &modelStream, gd, gw, wts_name);
+        classfilter::Filter filter;
+        if (!classes.empty()) filter.parse(classes);
+        APIToModel(BATCH_SIZE, &modelStream, gd, gw, wts_name, input_w, input_h, packed_u8, device_nms, filter.min_scores());
         assert(modelStream != nullptr);
         std::ofstream p(engine_name, std::ios::binary);
         if (!p) {
@@ -272,11 +1349,142 @@ int main(int argc, char** argv) {
         return 0;
     }
 
-    // deserialize the .engine and run inference
+    if (std::string(argv[1]) == "-e" && engine_name == "-") {
+        evaluate::Dataset dataset;
+        std::vector<evaluate::Object> dets;
+        if (!evaluate::load_annotations(argv[4], dataset) || !evaluate::load_detections(argv[3], dets)) {
+            std::cerr << "could not read " << argv[4] << " or " << argv[3] << std::endl;
+            return -1;
+        }
+        report_evaluation(dataset, dets);
+        return 0;
+    }
+
+    if (std::string(argv[1]) == "-coord") {
+        // detections go to stdout, the log to stderr
+        alog::logger().set_text_output(stderr);
+        std::vector<std::string> sources(argv + 3, argv + argc);
+        cluster::Coordinator coordinator(argv[2], sources);
+        return coordinator.run(exit_flag) < 0 ? -1 : 0;
+    }
+    if (std::string(argv[1]) == "-play")
+        return play_recording(argv[2], cv::Size(IMGSHOW_COLS, IMGSHOW_ROWS));
+    if (std::string(argv[1]) == "-p") {
+        // decoder process: every frame of the source goes to the ring, the inference process reads shm://<ring-name>
+        shm::FrameWriter writer(argv[3]);
+        passing_one_obj<cv::Mat> frames(true);
+        auto reader = std::async(std::launch::async, read_source, std::string(argv[2]), &frames, std::cref(exit_flag), (FrameClock*)nullptr);
+        while (reader.wait_for(std::chrono::seconds(0)) != std::future_status::ready || frames.is_object_present()) {
+            if (!frames.is_object_present()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            if (!writer.publish(frames.receive())) {
+                ALOG_ERROR("could not publish frames of {} to {}", argv[2], argv[3]);
+                exit_flag.store(true);
+            }
+        }
+        return 0;
+    }
+    if (std::string(argv[1]) == "-cap") {
+        // the frames exactly as read_source hands them to the pipeline, with their position in the stream
+        capture::Writer writer;
+        if (!writer.open(argv[3], cv::Size(input_w, input_h))) {
+            std::cerr << "could not write " << argv[3] << std::endl;
+            return -1;
+        }
+        uint64_t max_frames = atol(argv[4]);
+        FrameClock clock;
+        passing_one_obj<cv::Mat> frames(true);
+        auto reader = std::async(std::launch::async, read_source, std::string(argv[2]), &frames, std::cref(exit_flag), &clock);
+        auto start = std::chrono::steady_clock::now(), first = start;
+        int64_t t0 = -1, last = 0;
+        while (reader.wait_for(std::chrono::seconds(0)) != std::future_status::ready || frames.is_object_present()) {
+            if (!frames.is_object_present()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            cv::Mat frame = frames.receive();
+            if (max_frames && writer.frames() >= max_frames) {
+                exit_flag.store(true);  // and take what the reader still sends
+                continue;
+            }
+            // sources without a position in the stream (synthetic, shm) get the time the frame came
+            int64_t pos = clock.take(frame);
+            auto now = std::chrono::steady_clock::now();
+            if (t0 < 0) {
+                t0 = pos >= 0 ? pos : 0;
+                first = now;
+            }
+            int64_t t = pos >= 0 ? pos - t0 : std::chrono::duration_cast<std::chrono::microseconds>(now - first).count();
+            last = std::max(t, last);
+            if (input_w > 0)
+                frame = preprocess_img(frame, input_w, input_h);
+            if (!writer.append(frame, last)) {
+                ALOG_ERROR("could not write frames of {} to {}", argv[2], argv[3]);
+                exit_flag.store(true);
+            }
+        }
+        double sec = bench_ms(start, std::chrono::steady_clock::now()) / 1000;
+        std::cout << writer.frames() << " frames, " << writer.bytes() / (1 << 20) << "MB written to " << argv[3]
+                  << " in " << sec << "s" << (input_w > 0 ? ", letterboxed to " + std::to_string(input_w) + "x" + std::to_string(input_h) : "") << std::endl;
+        return writer.close() ? 0 : -1;
+    }
+    std::vector<std::string> offline_files;
+    bool offline_detections = false, offline_annotate = false;
+    if (std::string(argv[1]) == "-o")
+        offline_args(argc, argv, offline_files, offline_detections, offline_annotate);
+    if ((std::string(argv[1]) == "-w" || std::string(argv[1]) == "-daemon" || std::string(argv[1]) == "-o") && engine_name == "mock") {
+        // no GPU: mock backends that take 20ms a batch
+        std::vector<std::unique_ptr<InferBackend>> workers;
+        for (int k = 0; k < NUM_WORKERS; k++)
+            workers.push_back(std::unique_ptr<InferBackend>(new MockBackend(BATCH_SIZE, 20.0, 0.0)));
+        if (std::string(argv[1]) == "-daemon") {
+            alog::logger().set_text_output(stderr);
+            return run_daemon(argv[3], DAEMON_MAX_SOURCES, std::move(workers));
+        }
+        if (std::string(argv[1]) == "-o")
+            return run_offline(offline_files, std::move(workers), input_w, input_h, offline_detections, offline_annotate);
+        return run_worker(argv[3], atoi(argv[4]), std::move(workers));
+    }
+
+    if (std::string(argv[1]) == "-b") {
+        bench_logger(iterations);
+        bench_executor([] { return std::unique_ptr<InferBackend>(new MockBackend(BATCH_SIZE, 2.0, 0.0)); },
+                       cv::Mat(), 8, std::max(iterations / 8, 1), true);
+        bench_shm(iterations * 5, input_w, input_h);
+        bench_overlay(iterations, input_w, input_h);
+        bench_postprocess(cpu_pool(), iterations, input_w, input_h);
+        bench_classfilter(iterations, input_w, input_h, CONF_THRESH, NMS_THRESH, strlen(CLASSES) ? CLASSES : "0,2:0.6,7");
+        bench_trace(iterations);
+        bench_pool(iterations);
+        bench_placement(PLACEMENT, placement_node, NUM_WORKERS, CPU_THREADS, iterations, input_w, input_h);
+        placement::placement().configure(PLACEMENT, placement_node, NUM_WORKERS, CPU_THREADS);
+        if (engine_name == "-")
+            return 0;
+    }
+
+    // -f/-c: the sources are opened and start decoding while the engine loads
+    bool video_mode = std::string(argv[1]) == "-f" || std::string(argv[1]) == "-c";
+    std::vector<std::future<void>> future_vec;
+    if (video_mode) {
+        bool sync = std::string(argv[1]) == "-f";  // video files must not drop frames, cameras do
+        // the readers look up their clock, so all are created before the first reader starts
+        if (SAVE_VIDEO && PASSTHROUGH_RECORD && PASSTHROUGH_CAMERAS && !sync)
+            for (auto i=0; i <argc-3; i++)
+                clock_vec.push_back(new FrameClock());
+        for (auto i=0; i <argc-3; i++) {
+            frame_vec.push_back(new passing_one_obj<cv::Mat>(sync));
+            future_vec.push_back(std::async(std::launch::async, read_video_src, std::string(argv[i+3]), i));
+        }
+    }
+
+    // deserialize the .engine and run inference. the CUDA context is created while the file is read
+    auto cuda_ready = std::async(std::launch::async, [] { cudaSetDevice(DEVICE); cudaFree(0); });
     std::ifstream file(engine_name, std::ios::binary);
     if (!file.good()) {
         std::cerr << "read " << engine_name << " error!" << std::endl;
-        return -1;
+        std::exit(-1);  // without waiting for the readers
     }
     char *trtModelStream = nullptr;
     size_t size = 0;
@@ -287,12 +1495,8 @@ int main(int argc, char** argv) {
     assert(trtModelStream);
     file.read(trtModelStream, size);
     file.close();
+    cuda_ready.get();
 
-    // prepare input data ---------------------------
-    static float data[BATCH_SIZE * 3 * INPUT_H * INPUT_W];
-    //for (int i = 0; i < 3 * INPUT_H * INPUT_W; i++)
-    //    data[i] = 1.0;
-    static float prob[BATCH_SIZE * OUTPUT_SIZE];
     IRuntime* runtime = createInferRuntime(gLogger);
     assert(runtime != nullptr);
     ICudaEngine* engine = runtime->deserializeCudaEngine(trtModelStream, size);
@@ -300,170 +1504,390 @@ int main(int argc, char** argv) {
     IExecutionContext* context = engine->createExecutionContext();
     assert(context != nullptr);
     delete[] trtModelStream;
-    assert(engine->getNbBindings() == 2);
-    void* buffers[2];
     // In order to bind the buffers, we need to know the names of the input and output tensors.
-    // Note that indices are guaranteed to be less than IEngine::getNbBindings()
-    const int inputIndex = engine->getBindingIndex(INPUT_BLOB_NAME);
-    const int outputIndex = engine->getBindingIndex(OUTPUT_BLOB_NAME);
+    // The input size is a property of the engine, it is read from the input binding.
+    EngineInfo info;
+    if (!read_engine_info(engine, info)) {
+        std::cerr << engine_name << " has unexpected bindings!" << std::endl;
+        std::exit(-1);
+    }
+    const int inputIndex = info.input_index;
+    const int outputIndex = info.output_index;
     assert(inputIndex == 0);
     assert(outputIndex == 1);
+    std::cout << "engine input: " << info.input_w << "x" << info.input_h << (info.packed_u8 ? " uint8 BGR" : " float RGB")
+              << (info.device_nms ? ", NMS on the device" : "") << std::endl;
+    ALOG_INFO("engine ready after {}ms", ms_since_start());
+
+    // prepare input data ---------------------------
+    std::vector<uchar> data_buf(BATCH_SIZE * info.input_bytes());
+    void* data = data_buf.data();
+    static float prob[BATCH_SIZE * OUTPUT_SIZE];  // images are info.output_size apart
+    void* buffers[2];
     // Create GPU buffers on device
-    CUDA_CHECK(cudaMalloc(&buffers[inputIndex], BATCH_SIZE * 3 * INPUT_H * INPUT_W * sizeof(float)));
-    CUDA_CHECK(cudaMalloc(&buffers[outputIndex], BATCH_SIZE * OUTPUT_SIZE * sizeof(float)));
+    CUDA_CHECK(cudaMalloc(&buffers[inputIndex], BATCH_SIZE * info.input_bytes()));
+    CUDA_CHECK(cudaMalloc(&buffers[outputIndex], BATCH_SIZE * info.output_size * sizeof(float)));
     // Create stream
     cudaStream_t stream;
     CUDA_CHECK(cudaStreamCreate(&stream));
 
     if (std::string(argv[1]) == "-d") {
-        std::vector<std::string> file_names;
-        if (read_files_in_dir(img_dir.c_str(), file_names) < 0) {
-            std::cerr << "read_files_in_dir failed." << std::endl;
+        DirScanner scanner(img_dir, shard_id, num_shards, checkpoint);
+        if (!scanner.open())
             return -1;
-        }
-        int fcount = 0;
-        for (int f = 0; f < (int)file_names.size(); f++) {
-            fcount++;
-            if (fcount < BATCH_SIZE && f + 1 != (int)file_names.size()) continue;
-            for (int b = 0; b < fcount; b++) {
-                cv::Mat img = cv::imread(img_dir + "/" + file_names[f - fcount + 1 + b]);
-                if (img.empty()) continue;
-                cv::Mat pr_img = preprocess_img(img, INPUT_W, INPUT_H); // letterbox BGR to RGB
-                int i = 0;
-                for (int row = 0; row < INPUT_H; ++row) {
-                    uchar* uc_pixel = pr_img.data + row * pr_img.step;
-                    for (int col = 0; col < INPUT_W; ++col) {
-                        data[b * 3 * INPUT_H * INPUT_W + i] = (float)uc_pixel[2] / 255.0;
-                        data[b * 3 * INPUT_H * INPUT_W + i + INPUT_H * INPUT_W] = (float)uc_pixel[1] / 255.0;
-                        data[b * 3 * INPUT_H * INPUT_W + i + 2 * INPUT_H * INPUT_W] = (float)uc_pixel[0] / 255.0;
-                        uc_pixel += 3;
-                        ++i;
-                    }
-                }
-            }
+        std::shared_ptr<const classfilter::Filter> folder_classes;
+        classfilter::for_source(argv[3], CLASSES, folder_classes);
+        std::vector<std::string> file_names;
+        std::string file_name;
+        bool more = true;
+        while (more) {
+            file_names.clear();
+            while ((int)file_names.size() < BATCH_SIZE && (more = scanner.next(file_name)))
+                file_names.push_back(file_name);
+            int fcount = file_names.size();
+            if (fcount == 0) break;
+            cpu_pool().for_each(fcount, [&](int b) {
+                cv::Mat img = cv::imread(img_dir + "/" + file_names[b]);
+                if (!img.empty())
+                    prepare_input(img, data, b, info);
+            });
 
             // Run inference
             auto start = std::chrono::system_clock::now();
-            doInference(*context, stream, buffers, data, prob, BATCH_SIZE);
+            doInference(*context, stream, buffers, data, prob, BATCH_SIZE, info);
             auto end = std::chrono::system_clock::now();
-            std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+            ALOG_INFO("{}ms", std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
             std::vector<std::vector<Yolo::Detection>> batch_res(fcount);
-            for (int b = 0; b < fcount; b++) {
-                auto& res = batch_res[b];
-                nms(res, &prob[b * OUTPUT_SIZE], CONF_THRESH, NMS_THRESH);
-            }
-            for (int b = 0; b < fcount; b++) {
+            cpu_pool().for_each(fcount, [&](int b) {
                 auto& res = batch_res[b];
+                get_detections(res, prob, b, info, folder_classes.get());
                 //std::cout << res.size() << std::endl;
-                cv::Mat img = cv::imread(img_dir + "/" + file_names[f - fcount + 1 + b]);
+                cv::Mat img = cv::imread(img_dir + "/" + file_names[b]);
                 for (size_t j = 0; j < res.size(); j++) {
-                    cv::Rect r = get_rect(img, res[j].bbox);
+                    cv::Rect r = get_rect(img, res[j].bbox, info.input_w, info.input_h);
                     cv::rectangle(img, r, cv::Scalar(0x27, 0xC1, 0x36), 2);
                     cv::putText(img, std::to_string((int)res[j].class_id), cv::Point(r.x, r.y - 1), cv::FONT_HERSHEY_PLAIN, 1.2, cv::Scalar(0xFF, 0xFF, 0xFF), 2);
                 }
-                cv::imwrite("_" + file_names[f - fcount + 1 + b], img);
+                cv::imwrite("_" + file_names[b], img);
+            });
+            // the checkpoint is written in batch order
+            for (int b = 0; b < fcount; b++)
+                scanner.mark_done(file_names[b]);
+        }
+        if (scanner.skipped())
+            std::cout << scanner.skipped() << " images skipped, already in checkpoint " << checkpoint << std::endl;
+    }
+    else if (std::string(argv[1]) == "-e") {
+        evaluate::Dataset dataset;
+        if (!evaluate::load_annotations(argv[4], dataset)) {
+            std::cerr << "could not read annotations " << argv[4] << std::endl;
+            return -1;
+        }
+        std::string dir = argv[3];
+        size_t num_images = dataset.images.size();
+        std::vector<evaluate::Object> dets;
+        std::vector<double> latency_ms;
+        double read_ms = 0, pre_ms = 0, infer_ms = 0, post_ms = 0;
+        int missing = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t first = 0; first < num_images; first += BATCH_SIZE) {
+            int fcount = (int)std::min((size_t)BATCH_SIZE, num_images - first);
+            std::vector<cv::Mat> imgs(fcount);
+            auto t0 = std::chrono::steady_clock::now();
+            cpu_pool().for_each(fcount, [&](int b) {
+                imgs[b] = cv::imread(dir + "/" + dataset.images[first + b].file_name);
+            });
+            auto t1 = std::chrono::steady_clock::now();
+            cpu_pool().for_each(fcount, [&](int b) {
+                if (!imgs[b].empty())
+                    prepare_input(imgs[b], data, b, info);
+            });
+            auto t2 = std::chrono::steady_clock::now();
+            doInference(*context, stream, buffers, data, prob, BATCH_SIZE, info);
+            auto t3 = std::chrono::steady_clock::now();
+            // the boxes of model class k are those of the k-th category by id, as the 80 of COCO
+            std::vector<std::vector<evaluate::Object>> found(fcount);
+            cpu_pool().for_each(fcount, [&](int b) {
+                if (imgs[b].empty()) return;
+                std::vector<Yolo::Detection> res;
+                get_detections(res, prob, b, info, nullptr, EVAL_CONF_THRESH);
+                for (auto& d : res) {
+                    if ((size_t)d.class_id >= dataset.categories.size()) continue;
+                    evaluate::Object o = {dataset.images[first + b].id, dataset.categories[(int)d.class_id].id,
+                                          evaluate::from_letterbox(d.bbox, imgs[b].cols, imgs[b].rows, info.input_w, info.input_h), d.conf, false};
+                    found[b].push_back(o);
+                }
+            });
+            auto t4 = std::chrono::steady_clock::now();
+            for (int b = 0; b < fcount; b++) {
+                missing += imgs[b].empty();
+                dets.insert(dets.end(), found[b].begin(), found[b].end());
             }
-            fcount = 0;
+            read_ms += bench_ms(t0, t1);
+            pre_ms += bench_ms(t1, t2);
+            infer_ms += bench_ms(t2, t3);
+            post_ms += bench_ms(t3, t4);
+            latency_ms.push_back(bench_ms(t1, t4));
+        }
+        double sec = bench_ms(start, std::chrono::steady_clock::now()) / 1000;
+        if (missing)
+            std::cerr << missing << " of " << num_images << " images could not be read from " << dir << std::endl;
+        if (argc == 6 && !evaluate::save_detections(argv[5], dets))
+            std::cerr << "could not write " << argv[5] << std::endl;
+        if (num_images > 0) {
+            // from the letterboxing to the boxes in image pixels, reading the image from disk is counted apart
+            std::sort(latency_ms.begin(), latency_ms.end());
+            double n = (double)num_images;
+            std::cout << "latency of a batch of " << BATCH_SIZE << ": p50 " << latency_ms[latency_ms.size() / 2] << "ms, p99 "
+                      << latency_ms[std::min(latency_ms.size() - 1, latency_ms.size() * 99 / 100)] << "ms; per image: read " << read_ms / n
+                      << "ms, preprocess " << pre_ms / n << "ms, inference " << infer_ms / n << "ms, nms and mapping " << post_ms / n << "ms" << std::endl;
+            std::cout << "throughput: " << n / ((pre_ms + infer_ms + post_ms) / 1000) << " images/s without reading, " << n / sec
+                      << " images/s overall (" << (info.device_nms ? "NMS on the device at CONF_THRESH" : "host NMS at EVAL_CONF_THRESH") << ")" << std::endl;
         }
+        report_evaluation(dataset, dets);
     }
-    else if (std::string(argv[1]) == "-f" || std::string(argv[1]) == "-c") {
-        bool sync;
-        if (std::string(argv[1]) == "-f")
-            sync = true;        // video file
-        else 
-            sync = false;       // video camera
+    else if (std::string(argv[1]) == "-b") {
+        // synthetic 16:9 frame, the letterbox padding is what rectangular engines save
+        cv::Mat img(1080, 1920, CV_8UC3, cv::Scalar(90, 120, 150));
+        float r = std::min(info.input_w / (float)img.cols, info.input_h / (float)img.rows);
+        double content = (double)(int)(r * img.cols) * (int)(r * img.rows);
+        double padding = 1.0 - content / ((double)info.input_w * info.input_h);
+        double pre_ms = 0, infer_ms = 0, post_ms = 0;
+        size_t d2h_bytes = 0;
+        for (int it = -10; it < iterations; it++) {  // the first 10 iterations are warm-up
+            auto t0 = std::chrono::steady_clock::now();
+            for (int b = 0; b < BATCH_SIZE; b++)
+                prepare_input(img, data, b, info);
+            auto t1 = std::chrono::steady_clock::now();
+            size_t bytes = doInference(*context, stream, buffers, data, prob, BATCH_SIZE, info);
+            auto t2 = std::chrono::steady_clock::now();
+            for (int b = 0; b < BATCH_SIZE; b++) {
+                std::vector<Yolo::Detection> res;
+                get_detections(res, prob, b, info);
+            }
+            auto t3 = std::chrono::steady_clock::now();
+            if (it < 0) continue;
+            d2h_bytes += bytes;
+            pre_ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+            infer_ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+            post_ms += std::chrono::duration<double, std::milli>(t3 - t2).count();
+        }
+        double frames = (double)iterations * BATCH_SIZE;
+
+        // check the device conversion of packed uint8 input against the CPU reference
+        cv::Mat pr_img = preprocess_img(img, info.input_w, info.input_h);
+        std::vector<float> chw_ref(3 * info.input_h * info.input_w), chw_gpu(3 * info.input_h * info.input_w);
+        hwc_bgr_to_chw_rgb(pr_img.data, pr_img.step, info.input_w, info.input_h, chw_ref.data());
+        void *hwc_dev, *chw_dev;
+        CUDA_CHECK(cudaMalloc(&hwc_dev, 3 * info.input_h * info.input_w));
+        CUDA_CHECK(cudaMalloc(&chw_dev, chw_gpu.size() * sizeof(float)));
+        CUDA_CHECK(cudaMemcpyAsync(hwc_dev, pr_img.data, 3 * info.input_h * info.input_w, cudaMemcpyHostToDevice, stream));
+        Yolo::hwc2chwGpu((const uint8_t*)hwc_dev, (float*)chw_dev, 1, info.input_w, info.input_h, stream);
+        CUDA_CHECK(cudaMemcpyAsync(chw_gpu.data(), chw_dev, chw_gpu.size() * sizeof(float), cudaMemcpyDeviceToHost, stream));
+        cudaStreamSynchronize(stream);
+        CUDA_CHECK(cudaFree(hwc_dev));
+        CUDA_CHECK(cudaFree(chw_dev));
+        size_t mismatches = 0;
+        for (size_t i = 0; i < chw_ref.size(); i++)
+            mismatches += chw_ref[i] != chw_gpu[i];
+        std::cout << "uint8 HWC -> float CHW on device: " << mismatches << " mismatches against the CPU reference" << std::endl;
 
-        std::vector<std::future<void>> future_vec;
+        // host cost of the float layout, which packed uint8 engines skip
+        auto c0 = std::chrono::steady_clock::now();
+        for (int it = 0; it < iterations; it++)
+            hwc_bgr_to_chw_rgb(pr_img.data, pr_img.step, info.input_w, info.input_h, chw_ref.data());
+        auto c1 = std::chrono::steady_clock::now();
+        std::cout << "host to device " << info.input_bytes() << " bytes/frame ("
+                  << (info.packed_u8 ? "uint8 BGR" : "float RGB") << "), the other layout needs "
+                  << (info.packed_u8 ? 4 * info.input_bytes() : info.input_bytes() / 4) << "; CHW float conversion costs "
+                  << std::chrono::duration<double, std::milli>(c1 - c0).count() / iterations << "ms/frame on the host" << std::endl;
+        std::cout << "input " << info.input_w << "x" << info.input_h << ", " << (long)info.input_w * info.input_h << " px/frame, "
+                  << 100.0 * padding << "% padding for 1920x1080, "
+                  << 100.0 * info.input_w * info.input_h / (Yolo::INPUT_W * Yolo::INPUT_H) << "% of the compute of " << Yolo::INPUT_W << "x" << Yolo::INPUT_H << std::endl;
+        bench_decode(info.input_w, info.input_h, iterations, stream);
+        bench_executor([&] { return std::unique_ptr<InferBackend>(new TrtBackend(engine, info)); },
+                       img, 8, std::max(iterations / 8, 1), false);
+        std::cout << "device to host " << d2h_bytes / frames << " bytes/frame, " << (info.device_nms ? "NMS on the device" : "full decode for host NMS")
+                  << ", the raw decode is " << OUTPUT_SIZE * sizeof(float) << " bytes" << std::endl;
+        std::cout << "per frame: preprocess " << pre_ms / frames << "ms, inference " << infer_ms / frames
+                  << "ms, " << (info.device_nms ? "unpack " : "nms ") << post_ms / frames << "ms, total " << (pre_ms + infer_ms + post_ms) / frames << "ms" << std::endl;
+    }
+    else if (std::string(argv[1]) == "-w") {
+        std::vector<std::unique_ptr<InferBackend>> workers;
+        for (int k = 0; k < NUM_WORKERS; k++)
+            workers.push_back(std::unique_ptr<InferBackend>(new TrtBackend(engine, info)));
+        int rc = run_worker(argv[3], atoi(argv[4]), std::move(workers));
+        if (rc != 0) return rc;
+    }
+    else if (std::string(argv[1]) == "-daemon") {
+        // detections go to stdout, the log to stderr
+        alog::logger().set_text_output(stderr);
+        std::vector<std::unique_ptr<InferBackend>> workers;
+        for (int k = 0; k < NUM_WORKERS; k++)
+            workers.push_back(std::unique_ptr<InferBackend>(new TrtBackend(engine, info)));
+        int rc = run_daemon(argv[3], DAEMON_MAX_SOURCES, std::move(workers));
+        if (rc != 0) return rc;
+    }
+    else if (std::string(argv[1]) == "-o") {
+        std::vector<std::unique_ptr<InferBackend>> workers;
+        for (int k = 0; k < NUM_WORKERS; k++)
+            workers.push_back(std::unique_ptr<InferBackend>(new TrtBackend(engine, info)));
+        int rc = run_offline(offline_files, std::move(workers), info.input_w, info.input_h, offline_detections, offline_annotate);
+        if (rc != 0) return rc;
+    }
+    else if (video_mode) {
         std::vector<cv::VideoWriter> out_file_vec;
+        std::vector<std::unique_ptr<EventRecorder>> recorders;
+        std::vector<std::unique_ptr<DetectionSidecar>> sidecars;
+        std::vector<std::unique_ptr<StreamRecorder>> stream_recorders;
         int grid_size = 1;
         for (auto i=0; i <argc-3; i++) 
             if (grid_size * grid_size < argc - 2)
                 grid_size ++;
         int subimg_cols = IMGSHOW_COLS/grid_size;
         int subimg_rows = IMGSHOW_ROWS/grid_size;
+        // a camera can only be copied over a connection of its own, which doubles its bandwidth, so that is opt-in
+        bool camera = std::string(argv[1]) == "-c";
+        bool passthrough = SAVE_VIDEO && PASSTHROUGH_RECORD && (!camera || PASSTHROUGH_CAMERAS);
+        if (SAVE_VIDEO && PASSTHROUGH_RECORD && !passthrough)
+            ALOG_WARN("cameras are recorded as encoded tiles, set PASSTHROUGH_CAMERAS to copy their packets over a second session");
 
-        
         for (auto i=0; i <argc-3; i++) { 
-            frame_vec.push_back(new passing_one_obj<cv::Mat>(sync));
-            future_vec.push_back(std::async(std::launch::async, read_video_src, std::string(argv[i+3]), i));
-
             // save video files
             cv::VideoWriter out;
-            std::string fullname = std::string(argv[i+3]);
+            std::string fullname = classfilter::url_of(argv[i+3]);
             size_t lastindex = fullname.find_last_of(".");
-            std::string rawname = fullname.substr(0, lastindex); 
-            if (std::string(argv[1]) == "-f")
-                out.open(rawname + "-out.avi", cv::VideoWriter::fourcc('X', 'V', 'I', 'D'), 25.0, cv::Size(subimg_cols, subimg_rows), true); 
-            else
-                out.open("rtsp-" + std::to_string(i) + "-out.avi", cv::VideoWriter::fourcc('X', 'V', 'I', 'D'), 25.0, cv::Size(subimg_cols, subimg_rows), true);
+            std::string rawname = std::string(argv[1]) == "-f" ? fullname.substr(0, lastindex) : "rtsp-" + std::to_string(i);
+            if (passthrough) {
+                // files are kept as they are, cameras are copied packet by packet
+                sidecars.push_back(std::unique_ptr<DetectionSidecar>(new DetectionSidecar(rawname + ".det", camera, info.input_w, info.input_h)));
+                if (camera)
+                    stream_recorders.push_back(std::unique_ptr<StreamRecorder>(new StreamRecorder(fullname, rawname)));
+            }
+            else if (SAVE_VIDEO && RECORD_EVENTS)
+                recorders.push_back(std::unique_ptr<EventRecorder>(new EventRecorder(rawname, std::set<int>(RECORD_CLASSES), 25.0,
+                    cv::Size(subimg_cols, subimg_rows), RECORD_HOLDOFF_SEC, RECORD_PREROLL_SEC, RECORD_PREROLL_MB << 20)));
+            else if (SAVE_VIDEO)
+                out.open(rawname + "-out.avi", cv::VideoWriter::fourcc('X', 'V', 'I', 'D'), 25.0, cv::Size(subimg_cols, subimg_rows), true);
             out_file_vec.push_back(out);
         }
         
             
-        cv::Mat img_show[BATCH_SIZE];
+        // NUM_WORKERS contexts of the engine infer the frames of different sources at the same time
+        int num_sources = (int)future_vec.size();
+        std::vector<std::shared_ptr<const classfilter::Filter>> source_classes(num_sources);
+        for (int f = 0; f < num_sources; f++)
+            classfilter::for_source(argv[f + 3], CLASSES, source_classes[f]);
+        std::vector<std::unique_ptr<InferBackend>> workers;
+        for (int k = 0; k < NUM_WORKERS; k++)
+            workers.push_back(std::unique_ptr<InferBackend>(new TrtBackend(engine, info)));
+        InferExecutor executor(std::move(workers), num_sources, 2 * num_sources);
+        std::vector<bool> first_result(num_sources, true), first_detection(num_sources, true);
+        std::vector<InferJob> jobs(num_sources);
+        // per source: frames inferred and a hash of all their detections, to compare runs over the same captures
+        std::vector<uint64_t> results(num_sources, 0), det_hash(num_sources, capture::kHashSeed);
+        auto loop_start = std::chrono::steady_clock::now();
+
+        overlay::Renderer renderer;
+        int open_writers = 0;
+        for (auto& out : out_file_vec)
+            open_writers += out.isOpened();
+        membudget::Charge encoders(membudget::kEncoders, (int64_t)open_writers * membudget::kEncoderFrames * subimg_cols * subimg_rows * 3);
+        placement::placement().pin(placement::kMain);
+        // a source whose reader returned and whose last frame was taken has no more frames
+        auto ended = [&](int f) {
+            return future_vec[f].wait_for(std::chrono::seconds(0)) == std::future_status::ready && !frame_vec[f]->is_object_present();
+        };
         while (true) {
-            int fcount = 0;
-            std::vector <cv::Mat> img_display_vec;
-            for (int f = 0; f < (int)future_vec.size(); f++) {
-                fcount++;
-                if (fcount < BATCH_SIZE && f + 1 != (int)future_vec.size()) continue;
-                for (int b = 0; b < fcount; b++) {  
-                    cv::Mat img = frame_vec[f]->receive();
-                    if (img.empty()) continue;
-                    img_show[b] = img.clone();
-                    cv::Mat pr_img = preprocess_img(img, INPUT_W, INPUT_H); // letterbox BGR to RGB
-                    int i = 0;
-                    for (int row = 0; row < INPUT_H; ++row) {
-                        uchar* uc_pixel = pr_img.data + row * pr_img.step;
-                        for (int col = 0; col < INPUT_W; ++col) {
-                            data[b * 3 * INPUT_H * INPUT_W + i] = (float)uc_pixel[2] / 255.0;
-                            data[b * 3 * INPUT_H * INPUT_W + i + INPUT_H * INPUT_W] = (float)uc_pixel[1] / 255.0;
-                            data[b * 3 * INPUT_H * INPUT_W + i + 2 * INPUT_H * INPUT_W] = (float)uc_pixel[0] / 255.0;
-                            uc_pixel += 3;
-                            ++i;
-                        }
-                    }
+            // one frame per source is the least the round below needs
+            executor.set_capacity(membudget::budget().level() >= membudget::kShrinkQueues ? num_sources : 2 * num_sources);
+            report_memory();
+            // display multiple images in a single window, each frame is scaled straight into its tile
+            cv::Mat img_dst(IMGSHOW_ROWS, IMGSHOW_COLS, CV_8UC3, cv::Scalar(0,50,0));
+            for (int f = 0; f < num_sources; f++) {
+                // an ended source takes part with an empty frame, which is neither inferred nor drawn
+                cv::Mat frame;
+                {
+                    trace::Span span("wait frame", f);
+                    while (!frame_vec[f]->is_object_present() && !ended(f) && !exit_flag.load())
+                        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+                    if (frame_vec[f]->is_object_present())
+                        frame = frame_vec[f]->receive();
                 }
-
-                // Run inference
-                doInference(*context, stream, buffers, data, prob, BATCH_SIZE);
-                std::vector<std::vector<Yolo::Detection>> batch_res(fcount);
-                for (int b = 0; b < fcount; b++) {
-                    auto& res = batch_res[b];
-                    nms(res, &prob[b * OUTPUT_SIZE], CONF_THRESH, NMS_THRESH);
+                trace::Span span("submit", f);
+                executor.submit(f, frame, source_classes[f]);
+            }
+            int collected = 0;
+            for (; collected < num_sources; collected++) {
+                int f = collected;
+                InferJob& job = jobs[f];
+                {
+                    // includes waiting for the frames of other sources the workers took first
+                    trace::Span span("wait result", f);
+                    if (!executor.next(f, job)) break;
+                    span.set_frame(job.seq);
+                }
+                results[f]++;
+                det_hash[f] = capture::hash_detections(det_hash[f], job.dets.data(), job.dets.size() * sizeof(Yolo::Detection));
+                cv::Mat& img = job.frame;
+                if (img.empty()) continue;
+                if (first_result[f]) {
+                    first_result[f] = false;
+                    ALOG_INFO("source {}: first inference after {}ms", argv[f + 3], ms_since_start());
                 }
-                for (int b = 0; b < fcount; b++) {
-                    auto& res = batch_res[b];
-                    for (size_t j = 0; j < res.size(); j++) {
-                        cv::Rect r = get_rect(img_show[b], res[j].bbox);
-                        cv::rectangle(img_show[b], r, cv::Scalar(0x27, 0xC1, 0x36), 2);
-                        cv::putText(img_show[b], std::to_string((int)res[j].class_id), cv::Point(r.x, r.y - 1), cv::FONT_HERSHEY_PLAIN, 1.2, cv::Scalar(0xFF, 0xFF, 0xFF), 2);
-                    }
-                    // resize image 
-                    cv::resize(img_show[b], img_show[b], cv::Size(subimg_cols, subimg_rows), 0, 0, cv::INTER_AREA);
-                    // save to display vector
-                    img_display_vec.push_back(img_show[b]);
+                if (first_detection[f] && !job.dets.empty()) {
+                    first_detection[f] = false;
+                    ALOG_INFO("source {}: first detection after {}ms", argv[f + 3], ms_since_start());
                 }
-                fcount = 0;
+                if (!sidecars.empty())
+                    sidecars[f]->write(clock_vec.empty() ? (int64_t)job.seq : clock_vec[f]->take(img), job.dets);
             }
-            // display multiple images in a single window 
-            cv::Mat img_dst(540, 960, CV_8UC3, cv::Scalar(0,50,0));
-            for (int i = 0; i < (int)img_display_vec.size(); i++)   { 
-                img_display_vec[i].copyTo(img_dst(cv::Rect((i%grid_size) * subimg_cols, ((i/grid_size)%grid_size) * subimg_rows, subimg_cols, subimg_rows)));
-                // write video file
-                out_file_vec[i].write(img_display_vec[i]);
+            // the tiles are disjoint parts of the mosaic, so the sources are scaled and drawn in parallel
+            std::vector<cv::Mat> tiles(collected);
+            cpu_pool().for_each(collected, [&](int f) {
+                bool recorded = out_file_vec[f].isOpened() || !recorders.empty();
+                if (jobs[f].frame.empty() || (!SHOW_WINDOW && !recorded)) return;
+                trace::Span span("render", f, jobs[f].seq);
+                tiles[f] = img_dst(cv::Rect((f%grid_size) * subimg_cols, ((f/grid_size)%grid_size) * subimg_rows, subimg_cols, subimg_rows));
+                renderer.render(jobs[f].frame, jobs[f].dets, info.input_w, info.input_h, tiles[f]);
+            });
+            // write video files, in source order
+            for (int f = 0; f < collected; f++) {
+                jobs[f].frame.release();
+                if (tiles[f].empty()) continue;
+                trace::Span span("write", f, jobs[f].seq);
+                if (!recorders.empty())
+                    recorders[f]->push(tiles[f], jobs[f].dets, shm::now_ns());
+                else if (out_file_vec[f].isOpened())
+                    out_file_vec[f].write(tiles[f]);
             }
+            bool all_ended = true;
+            for (int f = 0; f < num_sources; f++)
+                all_ended = all_ended && ended(f);
+            if (exit_flag.load() || all_ended)
+                break;
+            if (!SHOW_WINDOW)
+                continue;
+            trace::Span span("display");
             cv::imshow("Objcet Detection Overlay", img_dst);
             if (cv::waitKey(33) == 27) {
                 exit_flag.store(true);
                 break;
             }
         }  
-        cv::destroyWindow("Objcet Detection Overlay");
+        if (SHOW_WINDOW)
+            cv::destroyWindow("Objcet Detection Overlay");
         
         for (auto i: out_file_vec) 
             i.release();
+        recorders.clear();
+        stream_recorders.clear();
+        sidecars.clear();
         std::cout << "videowriter released..." << std::endl;
+        double sec = bench_ms(loop_start, std::chrono::steady_clock::now()) / 1000;
+        for (int f = 0; f < num_sources; f++)
+            std::cout << "source " << argv[f + 3] << ": " << results[f] << " frames, " << results[f] / sec << " frames/s, detections 0x"
+                      << std::hex << std::setw(16) << std::setfill('0') << det_hash[f] << std::dec << std::setfill(' ') << std::endl;
         
         // clear frames in buffers
         for (int i = 0; i < (int)future_vec.size(); i++) {